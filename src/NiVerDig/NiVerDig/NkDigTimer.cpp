@@ -581,19 +581,79 @@ void frameMain::SetTitle(wxString port, wxString answer)
     formMain::SetTitle(wxT("NiVerDig ") + wxGetFileVersion(wxEmptyString) + wxT(" ") + port + wxT(" ") + answer);
 }
 
+// opens another NiVerDig for a recording of several devices (see panelScope::OpenDevices)
+// at the baud rate SetPort found for it and reads its pins. returns NULL if it does not answer.
+NKCOMPORT* frameMain::OpenDevice(wxString port, SItems& pins)
+{
+    NKCOMPORT* device = NULL;
+    if (!NkComPort_Open(&device, port + m_profile->Read(wxString::Format(wxT("Port/%s"), port))))
+    {
+        return NULL;
+    }
+    NkComPort_SetBuffers(device, 16192, 1024);
+
+    // the line functions work on m_port
+    NKCOMPORT* main = m_port;
+    m_port = device;
+    wchar_t answer[1024] = { 0 };
+    WriteLine(wxT("?\n"));
+    bool ok = (ReadLine(answer, countof(answer) - 1, 2000) > 0) && !wcsncmp(answer, wxT("NiVerDig"), 8);
+    if (ok)
+    {
+        ReadAll();
+        ParseItems(wxT("dpin"), pins);
+        size_t mode_field = pins.fields.find(wxT("mode"));
+        for (size_t ipin = 0; ipin < pins.items.size(); ++ipin)
+        {
+            SItem& pin = pins.items[ipin];
+            pin.type = pin.find_type(pins.v(ipin, mode_field));
+        }
+    }
+    m_port = main;
+
+    if (!ok)
+    {
+        NkComPort_Close(&device);
+        return NULL;
+    }
+    return device;
+}
+
 bool frameMain::IsConnected()
 {
     return NkComPort_IsConnected(m_port);
 }
 
+// when the control panel subscribed to state changes, the device pushes 'p'/'t' lines between
+// the answers: they are queued for the control panel, whichever command is waiting
 long frameMain::ReadLine(wchar_t* answer, long size, unsigned long timeout)
 {
-    long count = NkComPort_ReadLine(m_port, answer, size, timeout);
-    if (count <= 0) return count;
-    wchar_t* cr = wcspbrk(answer, L"\r");
-    if (cr) { cr[0] = L'\n'; cr[1] = 0; }
-    m_statusBar->SetStatusText(answer);
-    m_log.Log(answer,false);
+    long count;
+    while (0 < (count = NkComPort_ReadLine(m_port, answer, size, timeout)))
+    {
+        wchar_t* cr = wcspbrk(answer, L"\r");
+        if (cr) { cr[0] = L'\n'; cr[1] = 0; }
+        m_log.Log(answer,false);
+        if (!IsStateChange(answer)) break;
+        m_events.Add(answer);
+    }
+    if (count > 0) m_statusBar->SetStatusText(answer);
+    return count;
+}
+
+// 'p <pin> <state>' or 't <task> <state>'
+bool frameMain::IsStateChange(const wchar_t* line)
+{
+    return ((line[0] == L'p') || (line[0] == L't')) && (line[1] == L' ') && iswdigit(line[2]);
+}
+
+long frameMain::ReadAnswer(wxRegEx& re, wchar_t* answer, long size, unsigned long timeout)
+{
+    long count;
+    while (0 < (count = ReadLine(answer, size, timeout)))
+    {
+        if (re.Matches(answer)) return count;
+    }
     return count;
 }
 
@@ -700,13 +760,6 @@ void frameMain::ParseItems(wxString command, SItems& items)
     items.clear();
     items.command = command;
 
-    wxRegEx reRange(wxT(" *<(.+)> *: *\\[(-?\\d+) +to +(\\d+)\\]"), wxRE_EXTENDED);
-    wxRegEx reEnum(wxT(" *<(.+)> *: *\\((.+)\\)"), wxRE_EXTENDED);
-    wxRegEx reString(wxT(" *<(.+)> *: *(.*)"), wxRE_EXTENDED);
-    wxRegEx reMode(wxT("<(.+?)> *(\\[(\\d+) +to +(\\d+)\\])? *(\\((.+)\\))? ?"), wxRE_EXTENDED);
-    wxRegEx trimQuotes(wxT("'(.*)'"));
-    wxRegEx reIndex(wxT("\\[(\\d+)\\]"));
-
     wchar_t answer[4096];
     long count;
     WriteLine(command + wxT(" ?\n"));
@@ -720,151 +773,141 @@ void frameMain::ParseItems(wxString command, SItems& items)
         if (wcsncmp(answer, wxT(" "), 1)) continue;
 
         // field definition starts with a <
-        if (answer[1] == wxT('<'))
+        deviceTokenizer line(answer);
+        deviceToken name;
+        line.Spaces();
+        if ((answer[1] == wxT('<')) && line.Char(wxT('<')) && line.Until(wxT('>'), name) && name.n)
         {
+            line.Spaces();
+            if (!line.Char(wxT(':'))) continue;
+            line.Spaces();
+            SField field;
+            field.name = name.str();
+
             // simple range
-            if (reRange.Matches(answer))
+            if (line.Range(field.lower, field.higher))
             {
-                SField field; wxString tmp;
                 field.type = SField::eRange;
-                field.name = reRange.GetMatch(answer, 1);
                 if (field.name == wxT("index")) field.type = SField::eStatic;
-                tmp = reRange.GetMatch(answer, 2);
-                tmp.ToLongLong(&field.lower);
-                tmp = reRange.GetMatch(answer, 3);
-                tmp.ToLongLong(&field.higher);
                 items.fields.push_back(field);
                 continue;
             }
 
             // simple enum
-            if (reEnum.Matches(answer))
+            deviceToken values;
+            if (line.Enum(values))
             {
-                SField field; wxString tmp;
                 field.type = SField::eEnum;
-                field.name = reEnum.GetMatch(answer, 1);
-                tmp = reEnum.GetMatch(answer, 2);
-                field.values = wxSplit(tmp, wxT('|'));
+                deviceSplit(values, field.values);
                 items.fields.push_back(field);
                 continue;
             }
 
-            if (reString.Matches(answer))
+            // simple string
+            if (line.Peek() != wxT('<'))
             {
-                SField field; wxString tmp;  size_t start; size_t len;
-                field.name = reString.GetMatch(answer, 1);
-                reString.GetMatch(&start, &len, 2);
-
-                // simple string
-                if (answer[start] != wxT('<'))
+                field.type = SField::eString;
+                deviceToken skipped;
+                while (line.Until(wxT('['), skipped))
                 {
-                    field.type = SField::eString;
-                    wxString descr(answer + start, len);
-                    if(reIndex.Matches(descr))
-                    { 
-                        reIndex.GetMatch(descr, 1).ToLongLong(&field.higher);
+                    deviceTokenizer index = line;
+                    uint64_t size;
+                    if (index.Unsigned(size) && index.Char(wxT(']')))
+                    {
+                        field.higher = int64_t(size);
+                        break;
                     }
-                    items.fields.push_back(field);
-                    continue;
                 }
+                items.fields.push_back(field);
+                continue;
+            }
 
-                // enum/range depending on mode
-                field.type = SField::eEnum;
-                wchar_t* p = answer + start;
-                while(1)
+            // enum/range depending on mode: '<mode> [lower to higher] (a|b)' up to and including the first )
+            field.type = SField::eEnum;
+            while (!line.End())
+            {
+                const wchar_t* end = line.m_p;
+                while ((end < line.m_end) && (*end++ != wxT(')')));
+                deviceTokenizer p(line.m_p, end);
+                if (!p.Find(wxT('<')) || !p.Until(wxT('>'), name) || !name.n) break;
+                SField mode;
+                mode.name = name.str();
+                p.Spaces();
+                // the lower limit of a mode has no sign
+                int64_t lower, higher;
+                deviceTokenizer range = p;
+                if (range.Range(lower, higher) && (lower >= 0))
                 {
-                    size_t e = wcscspn(p, wxT(")"));
-                    if (p[e] == wxT(')')) ++e;
-                    wchar_t c = p[e];
-                    p[e] = 0;
-                    bool match = reMode.Matches(p);
-                    p[e] = c;
-                    if (!match) break;
-                    size_t mc = reMode.GetMatchCount();
-                    reMode.GetMatch(&start, &len, 0);
-                    wchar_t* nextp = p + start + len;
-                    SField mode;
-                    mode.name = reMode.GetMatch(p, 1);
-                    reMode.GetMatch(&start, &len, 2);
-                    if ((start != wxString::npos) && (p[start] == wxT('[')))
-                    {
-                        mode.type = SField::eRange;
-                        tmp = reMode.GetMatch(p, 3);
-                        tmp.ToLongLong(&mode.lower);
-                        tmp = reMode.GetMatch(p, 4);
-                        tmp.ToLongLong(&mode.higher);
-                    }
-                    reMode.GetMatch(&start, &len, 5);
-                    if ((start != wxString::npos) && (p[start] == wxT('(')))
-                    {
-                        mode.type = SField::eEnum;
-                        mode.values = wxSplit(reMode.GetMatch(p, 6), wxT('|'));
-                    }
-                    field.modes[mode.name] = mode;
-                    p = nextp;
+                    mode.type = SField::eRange;
+                    mode.lower = lower;
+                    mode.higher = higher;
+                    p = range;
                 }
-                if (field.modes.size())
+                p.Spaces();
+                if (p.Enum(values))
+                {
+                    mode.type = SField::eEnum;
+                    deviceSplit(values, mode.values);
+                }
+                p.Char(wxT(' '));
+                field.modes[mode.name] = mode;
+                line.m_p = p.m_p;
+            }
+            if (field.modes.size())
+            {
+                wxString first_mode = field.modes.begin()->first;
+                // try to find if this mode was already defined
+                field.mode_field = -1;
+                for (auto f = items.fields.begin(); (field.mode_field == -1) && (f != items.fields.end()); ++f)
                 {
-                    wxString first_mode = field.modes.begin()->first;
-                    // try to find if this mode was already defined
-                    field.mode_field = -1;
-                    for (auto f = items.fields.begin(); (field.mode_field == -1) && (f != items.fields.end()); ++f)
+                    if (f->modes.size())
                     {
-                        if (f->modes.size())
+                        for (auto m : f->modes)
                         {
-                            for (auto m : f->modes)
+                            if (m.first == first_mode)
                             {
-                                if (m.first == first_mode)
-                                {
-                                    field.mode_field = f - items.fields.begin();
-                                    break;
-                                }
+                                field.mode_field = f - items.fields.begin();
+                                break;
                             }
                         }
-                        else
+                    }
+                    else
+                    {
+                        for (auto& v : f->values)
                         {
-                            for (auto& v : f->values)
+                            if (v == first_mode)
                             {
-                                if (v == first_mode)
-                                {
-                                    field.mode_field = f - items.fields.begin();
-                                    break;
-                                }
+                                field.mode_field = f - items.fields.begin();
+                                break;
                             }
                         }
                     }
-                    if (field.mode_field == -1)
+                }
+                if (field.mode_field == -1)
+                {
+                    // not found: this field defines it, so add all modes to the combobox
+                    for (auto& mode : field.modes)
                     {
-                        // not found: this field defines it, so add all modes to the combobox
-                        for (auto& mode : field.modes)
-                        {
-                            field.values.insert(field.values.end(), mode.second.values.begin(), mode.second.values.end());
-                        }
+                        field.values.insert(field.values.end(), mode.second.values.begin(), mode.second.values.end());
                     }
                 }
-                items.fields.push_back(field);
-                continue;
             }
+            items.fields.push_back(field);
+            continue;
         }
 
         // item definition starts with a digit
         if (iswdigit(answer[1]))
         {
             SItem item;
-            item.values = wxSplit(answer, wxT('\t'));
-            item.values.resize(items.fields.size());
-            for (auto& v : item.values)
+            deviceTokenizer columns(answer);
+            deviceToken value;
+            while ((item.values.size() < items.fields.size()) && columns.Split(wxT('\t'), value))
             {
-                if (trimQuotes.Matches(v))
-                {
-                    v = trimQuotes.GetMatch(v, 1);
-                }
-                else
-                {
-                    v = v.Trim(false);
-                    v = v.Trim(true);
-                }
+                deviceToken quoted;
+                item.values.push_back(value.Quoted(quoted) ? quoted.str() : value.Trim().str());
             }
+            item.values.resize(items.fields.size());
             items.items.push_back(item);
         }
     }
@@ -895,8 +938,7 @@ void frameMain::ParsePins()
         SItem& pin = m_pins.items[ipin];
         pin.type = pin.find_type(m_pins.v(ipin, mode_field));
         WriteLine(wxString::Format(wxT("pin %lld\n"), ipin + 1));
-        ReadLine(answer, countof(answer), 200);
-        if (pinState.Matches(answer))
+        if (ReadAnswer(pinState, answer, countof(answer), 200) > 0)
         {
             pinState.GetMatch(answer, 1).ToLongLong(&pin.state);
         }
@@ -910,8 +952,7 @@ int64_t frameMain::SetPin(size_t ipin, size_t value)
     wchar_t answer[64];
     wxRegEx pinState(wxT("pin\\[\\d+\\]=(\\d+)"), wxRE_EXTENDED);
     WriteLine(wxString::Format(wxT("pin %lld %lld\n"), ipin + 1, value));
-    ReadLine(answer, countof(answer), 200);
-    if (pinState.Matches(answer))
+    if (ReadAnswer(pinState, answer, countof(answer), 200) > 0)
     {
         pinState.GetMatch(answer, 1).ToLongLong(&pin.state);
     }
@@ -929,8 +970,7 @@ void frameMain::ParseTasks()
         SItem& task = m_tasks.items[itask];
         task.type = task.find_type(m_tasks.v(itask, mode_index));
         WriteLine(wxString::Format(wxT("task %lld\n"), itask + 1));
-        ReadLine(answer, countof(answer), 200);
-        if (taskState.Matches(answer))
+        if (ReadAnswer(taskState, answer, countof(answer), 200) > 0)
         {
             int64_t state = 0;
             taskState.GetMatch(answer, 1).ToLongLong(&state);
@@ -949,8 +989,7 @@ int64_t frameMain::SetTask(size_t itask, size_t value)
     wxRegEx taskState(wxT("task\\[\\d+\\]=(\\d+)"), wxRE_EXTENDED);
     if (value == 2) value = 3; // fired
     WriteLine(wxString::Format(wxT("task %lld %lld\n"), itask + 1, value));
-    ReadLine(answer, countof(answer), 200);
-    if (taskState.Matches(answer))
+    if (ReadAnswer(taskState, answer, countof(answer), 200) > 0)
     {
         int64_t state = 0;
         taskState.GetMatch(answer, 1).ToLongLong(&state);
@@ -972,6 +1011,46 @@ bool frameMain::GetHalt()
     return m_halt;
 }
 
+// reads the pin or task table of the device as image in the format the 'load' command accepts
+bool frameMain::ReadImage(const wxString& table, wxString& image)
+{
+    wchar_t answer[1024];
+    wxRegEx header(wxT("^load (\\d+) (\\d+) (\\d+) (\\d+) (\\d+)"), wxRE_EXTENDED);
+    image.clear();
+    WriteLine(wxT("load ") + table + wxT("\n"));
+    if (ReadAnswer(header, answer, countof(answer), 500) <= 0) return false;
+    unsigned long pin_count = 0;
+    unsigned long task_count = 0;
+    header.GetMatch(answer, 3).ToULong(&pin_count);
+    header.GetMatch(answer, 4).ToULong(&task_count);
+    image = wxString(answer).Trim() + wxT("\n");
+    for (unsigned long record = 0; record < pin_count + task_count; ++record)
+    {
+        if (NkComPort_ReadLine(m_port, answer, countof(answer), 500) <= 0)
+        {
+            image.clear();
+            return false;
+        }
+        image += wxString(answer).Trim() + wxT("\n");
+    }
+    return true;
+}
+
+// sends the pin and/or task table in one transfer: the device validates the image and swaps the tables while halted
+bool frameMain::SendImage(const wxString& image)
+{
+    wchar_t answer[1024];
+    wxRegEx loaded(wxT("^load (done|error)"), wxRE_EXTENDED);
+    wxString header = image.BeforeFirst(wxT('\n'));
+    wxString records = image.AfterFirst(wxT('\n'));
+    if (!header.StartsWith(wxT("load "))) return false;
+    WriteLine(header + wxT("\n"));
+    wxCharBuffer data = records.ToAscii();
+    NkComPort_WriteA(m_port, data.data(), long(data.length()));
+    if (ReadAnswer(loaded, answer, countof(answer), 2000) <= 0) return false;
+    return loaded.GetMatch(answer, 1) == wxT("done");
+}
+
 void frameMain::SendItems(SItems& new_items)
 {
     wchar_t answer[2048];
@@ -980,6 +1059,14 @@ void frameMain::SendItems(SItems& new_items)
     else if (new_items.command == wxT("dtask")) org_items = &m_tasks;
     if (!org_items) return;
 
+    // items that were loaded unchanged together with their image are sent in one round trip
+    if (!new_items.image.IsEmpty() && (new_items.imageItems == new_items.Text()) && SendImage(new_items.image))
+    {
+        if (new_items.command == wxT("dpin")) ParsePins();
+        else ParseTasks();
+        return;
+    }
+
     for(int64_t diff = int64_t(org_items->items.size()) - int64_t(new_items.items.size()); diff > 0; --diff)
     {
         WriteLine(new_items.command + wxT(" -"));
@@ -1094,6 +1181,24 @@ bool frameMain::SaveItems(SItems& items)
         }
         f.Write();
         f.Close();
+
+        // when the items are the ones on the device, save the device image as well for a fast 'load'
+        SItems& device_items = (items.command == wxT("dpin")) ? m_pins : m_tasks;
+        wxFileName image_name(filename);
+        image_name.SetExt(ext == wxT("nkdtp") ? wxT("nkdpi") : wxT("nkdti"));
+        if (image_name.Exists()) wxRemoveFile(image_name.GetFullPath());
+        wxString image;
+        if (IsConnected() && (items.Text() == device_items.Text()) && ReadImage((ext == wxT("nkdtp")) ? wxT("pin") : wxT("task"), image))
+        {
+            wxTextFile fi(image_name.GetFullPath());
+            if (fi.Create())
+            {
+                wxArrayString lines = wxSplit(image.BeforeLast(wxT('\n')), wxT('\n'));
+                for (auto& line : lines) fi.AddLine(line);
+                fi.Write();
+                fi.Close();
+            }
+        }
         return true;
     }
 }
@@ -1144,6 +1249,21 @@ bool frameMain::LoadItems(SItems& items)
         }
         f.Close();
 
+        items.image.clear();
+        items.imageItems.clear();
+        wxFileName image_name(dlg.GetPath());
+        image_name.SetExt((items.command == wxT("dpin")) ? wxT("nkdpi") : wxT("nkdti"));
+        wxTextFile fi(image_name.GetFullPath());
+        if (image_name.Exists() && fi.Open())
+        {
+            for (wxString line = fi.GetFirstLine(); !fi.Eof(); line = fi.GetNextLine())
+            {
+                items.image += line + wxT("\n");
+            }
+            fi.Close();
+            items.imageItems = items.Text();
+        }
+
         if (items.command == wxT("dpin"))
         {
             size_t mode_field = items.fields.find(wxT("mode"));
@@ -61,11 +61,28 @@ struct SItems
     SFields            fields;
     std::vector<SItem> items;
     long               dataBits;
+    size_t             dataOffset; // of the first sample in a recording: the size of its header
+    size_t             startTime;  // of a recording
+    wxString           image;      // device table image ('load' command) saved with the items
+    wxString           imageItems; // the item lines the image belongs to
     void clear()
     {
         fields.clear();
         items.clear();
         dataBits = 8;
+        dataOffset = 0;
+        startTime = 0;
+        image.clear();
+        imageItems.clear();
+    }
+    wxString Text()
+    {
+        wxString text;
+        for (auto& item : items)
+        {
+            text += command + wxT("\t") + wxJoin(item.values, wxT('\t')) + wxT("\n");
+        }
+        return text;
     }
     wxString v(size_t index, const wxString& field)
     {
@@ -120,14 +137,23 @@ struct SItems
         if (!fields[field_index].modes.count(mode)) return field;
         return fields[field_index].modes[mode];
     }
-    bool LoadFromFile(HANDLE data, size_t& lastsample)
+    bool LoadFromFile(HANDLE data, size_t& lastsample, scopeIndex* index = NULL, scopeChunkIndex* chunks = NULL, scopeLod* lod = NULL, scopeEdges* edges = NULL)
     {
         clear();
+        if (index) index->clear();
+        if (chunks) chunks->clear();
+        if (lod) lod->clear();
+        if (edges) edges->clear();
         fields.push_back(SField(wxT("index"), SField::eString));
         fields.push_back(SField(wxT("name"), SField::eString));
+        lastsample = 0;
+
+        // the header holds the channel info; its appendix is written when the recording is complete
+        unsigned long flags = 0;
+        bool hasHeader = ReadHeader(data, flags);
 
         // try to read the channel info from the appendix
-        while (1)
+        while (!hasHeader || (flags & SCOPE_HEADER_COMPLETE))
         {
             LARGE_INTEGER len;
             LARGE_INTEGER null;
@@ -142,42 +168,95 @@ struct SItems
             if (!read) break;
             SetFilePointerEx(data, pos, &pos2, FILE_BEGIN);
             if (pos.QuadPart != pos2.QuadPart) break;
-            size_t buf_len = len.QuadPart - pos.QuadPart;
-            if (buf_len >= 8192) break;
-            wchar_t buf[4096];
+            if (pos.QuadPart >= len.QuadPart - 8) break;
+            if (pos.QuadPart < (LONGLONG)dataOffset) break;
+            size_t buf_len = len.QuadPart - 8 - pos.QuadPart;
+            if (buf_len >= 32768) buf_len = 32766; // a binary seek index follows the text (up to 128 pin lines)
+            wchar_t buf[16384];
             ReadFile(data, buf, buf_len, &read, NULL);
             if (read != buf_len) break;
             buf[buf_len / 2] = 0;
+            // the binary blocks follow the terminated text in the order of their lines
+            LARGE_INTEGER block;
+            block.QuadPart = pos.QuadPart + (wcslen(buf) + 1) * sizeof(wchar_t);
             wxString str(buf);
             wxArrayString lines = wxSplit(str, wxT('\n'));
             for (size_t i = 0; i < lines.size(); ++i)
             {
                 wxArrayString fields = wxSplit(lines[i], wxT('\t'));
                 if (fields.size() < 1) break;
-                if (fields[0] == wxT("pin"))
+                if ((fields[0] == wxT("pin")) || (fields[0] == wxT("bits")))
+                {
+                    if (!hasHeader && !ParseInfo(fields)) break;
+                }
+                else if (fields[0] == wxT("index"))
+                {
+                    wxULongLong_t count = 0;
+                    if ((fields.size() < 2) || !fields[1].ToULongLong(&count)) break;
+                    if (index && !ReadBlock(data, block, len.QuadPart - 8, count, *index)) index->clear();
+                    block.QuadPart += count * sizeof(scopeIndexEntry);
+                }
+                else if (fields[0] == wxT("chunks"))
                 {
-                    if (fields.size() != 4) break;
-                    wxLongLong_t index = -1;
-                    fields[1].ToLongLong(&index);
-                    if (index != items.size()) break;
-                    SItem::EItemType type;
-                    fields[3].ToLong((long*)&type);
-                    items.push_back(SItem(fields[1], fields[2], type));
+                    // the chunk table of a compressed recording
+                    wxULongLong_t count = 0;
+                    if ((fields.size() < 2) || !fields[1].ToULongLong(&count)) break;
+                    if (chunks && !ReadBlock(data, block, len.QuadPart - 8, count, *chunks)) chunks->clear();
+                    block.QuadPart += count * sizeof(scopeChunkEntry);
                 }
-                else if (fields[0] == wxT("bits"))
+                else if (fields[0] == wxT("lod"))
                 {
-                    if (fields.size() != 2) break;
-                    if(fields[1].ToLong(&dataBits))
-                    {
-                        if (dataBits < 8) dataBits = 8;
-                        if (dataBits > 16) dataBits = 16;
-                    }
+                    // the level-of-detail pyramid
+                    wxULongLong_t count = 0;
+                    wxULongLong_t last = 0;
+                    long shift = 0;
+                    if ((fields.size() < 4) || !fields[1].ToULongLong(&count) || !fields[2].ToLong(&shift) || !fields[3].ToULongLong(&last)) break;
+                    std::vector<scopeLodEntry> entries;
+                    if (lod && (shift == SCOPE_LOD_SHIFT) && ReadBlock(data, block, len.QuadPart - 8, count, entries)) lod->Load(entries, last);
+                    block.QuadPart += count * sizeof(scopeLodEntry);
+                }
+                else if (fields[0] == wxT("edges"))
+                {
+                    // the edge index, so the first find does not scan the samples
+                    wxULongLong_t size = 0;
+                    if ((fields.size() < 2) || !fields[1].ToULongLong(&size)) break;
+                    std::vector<unsigned char> bytes;
+                    if (edges && ReadBlock(data, block, len.QuadPart - 8, size, bytes)) edges->Load(bytes);
+                    block.QuadPart += size;
                 }
             }
             lastsample = pos.QuadPart;
             break;
         }
-        if (!items.size())
+        if (!items.size() || (hasHeader && !(flags & SCOPE_HEADER_COMPLETE)))
+        {
+            // a recording that was interrupted has no appendix: recover the end of the consistent samples
+            // and, without header, the pins from its journal
+            wchar_t path[MAX_PATH];
+            wxString info;
+            long bits = 8;
+            size_t recovered = 0;
+            DWORD path_len = GetFinalPathNameByHandleW(data, path, MAX_PATH, FILE_NAME_NORMALIZED);
+            if (path_len && (path_len < MAX_PATH) && scopeJournal::Recover(path, data, dataOffset, recovered, bits, info))
+            {
+                wxArrayString lines = wxSplit(hasHeader ? wxString() : info, wxT('\n'));
+                for (size_t i = 0; i < lines.size(); ++i)
+                {
+                    if (lines[i].IsEmpty()) continue;
+                    if (!ParseInfo(wxSplit(lines[i], wxT('\t')))) break;
+                }
+                if (items.size())
+                {
+                    dataBits = bits;
+                    lastsample = recovered;
+                }
+            }
+        }
+        scopeChunkFileHeader header = { 0 };
+        DWORD read = 0;
+        SetFilePointer(data, 0, NULL, FILE_BEGIN);
+        ReadFile(data, &header, sizeof(header), &read, NULL);
+        if (!items.size() && strncmp(header.magic, "NKCEF", sizeof(header.magic)))
         {
             // read the channels from the first samples
             SetFilePointer(data, 0, NULL, FILE_BEGIN);
@@ -192,6 +271,65 @@ struct SItems
         SetFilePointer(data, 0, NULL, FILE_BEGIN);
         return items.size() > 0;
     }
+    // the header and channel table of the binary format, see NkDigTimerScope.h
+    bool ReadHeader(HANDLE data, unsigned long& flags)
+    {
+        std::vector<unsigned char> buf(SCOPE_HEADER_SIZE);
+        DWORD read = 0;
+        SetFilePointer(data, 0, NULL, FILE_BEGIN);
+        if (!ReadFile(data, &buf[0], SCOPE_HEADER_SIZE, &read, NULL) || (read != SCOPE_HEADER_SIZE)) return false;
+        const scopeFileHeader* header = (const scopeFileHeader*)&buf[0];
+        if (strncmp(header->magic, "NKBEF", sizeof(header->magic)) || (header->version != SCOPE_HEADER_VERSION)) return false;
+        if ((header->headerSize < SCOPE_HEADER_SIZE) || (header->channels > (SCOPE_HEADER_SIZE - sizeof(scopeFileHeader)) / sizeof(scopeFileChannel))) return false;
+        const scopeFileChannel* channels = (const scopeFileChannel*)(header + 1);
+        for (size_t i = 0; i < header->channels; ++i)
+        {
+            wchar_t name[SCOPE_HEADER_NAME + 1] = { 0 };
+            wcsncpy_s(name, channels[i].name, SCOPE_HEADER_NAME);
+            items.push_back(SItem(wxString::Format(wxT("%lld"), i), name, (SItem::EItemType)channels[i].type));
+        }
+        dataBits = (header->bits < 8) ? 8 : (header->bits > 16) ? 16 : header->bits;
+        dataOffset = header->headerSize;
+        startTime = header->startTime;
+        flags = header->flags;
+        return true;
+    }
+    // a pin or bits line of the appendix
+    bool ParseInfo(const wxArrayString& fields)
+    {
+        if (fields[0] == wxT("pin"))
+        {
+            if (fields.size() != 4) return false;
+            wxLongLong_t index = -1;
+            fields[1].ToLongLong(&index);
+            if (index != items.size()) return false;
+            SItem::EItemType type;
+            fields[3].ToLong((long*)&type);
+            items.push_back(SItem(fields[1], fields[2], type));
+            return true;
+        }
+        if (fields[0] == wxT("bits"))
+        {
+            if (fields.size() != 2) return false;
+            if(fields[1].ToLong(&dataBits))
+            {
+                if (dataBits < 8) dataBits = 8;
+                if (dataBits > 16) dataBits = 16;
+            }
+            return true;
+        }
+        return false;
+    }
+    template <typename E>
+    bool ReadBlock(HANDLE data, LARGE_INTEGER block, LONGLONG end, size_t count, std::vector<E>& entries)
+    {
+        if ((block.QuadPart + LONGLONG(count * sizeof(E))) > end) return false;
+        entries.resize(count);
+        if (!count) return true;
+        DWORD read = 0;
+        SetFilePointerEx(data, block, NULL, FILE_BEGIN);
+        return ReadFile(data, &entries[0], DWORD(count * sizeof(E)), &read, NULL) && (read == count * sizeof(E));
+    }
 };
 
 class itemData : public wxObject
@@ -226,6 +364,7 @@ public:
     SItems        m_tasks;
     long          m_halt;
     long          m_adc_res;
+    wxArrayString m_events; // 'p'/'t' state changes pushed by the device while waiting for an answer
 
     wxLogFile       m_log;
     wxIndexTextFile m_ilog;
@@ -247,15 +386,20 @@ public:
     void SetHalt (bool halt);
     bool GetHalt();
     long ReadLine(wchar_t * answer, long size, unsigned long timeout);
+    static bool IsStateChange(const wchar_t* line);
+    long ReadAnswer(wxRegEx& re, wchar_t* answer, long size, unsigned long timeout);
     void ReadAll();
     long WriteLine(const wchar_t* line);
     void SendItems(SItems& items);
+    bool ReadImage(const wxString& table, wxString& image);
+    bool SendImage(const wxString& image);
     bool SaveItems(SItems& items);
     void WriteTasks(SItems& items);
     bool LoadItems(SItems& items);
     void SetStatus(wxString str);
     void SetPort(wxString port);
     void ClosePort(void);
+    NKCOMPORT* OpenDevice(wxString port, SItems& pins);
 
     void MSWSetShowCommand(WXUINT showCmd)
     {
@@ -288,6 +432,7 @@ private:
 
 size_t GetCurrentTimeInMs();
 size_t GetCurrentFileTime();
+size_t GetPreciseFileTime();
 wxString FormatLocalFileTime(size_t t);
 wxString LogFormatLocalFileTimeUs(size_t t);
 
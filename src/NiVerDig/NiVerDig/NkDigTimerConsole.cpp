@@ -177,6 +177,7 @@ public:
 				if (answer == wxNO) continue;
 				wxRemoveFile(filename);
 			}
+			m_main->m_log.Flush();
 			if (!wxCopyFile(m_main->m_log.m_name, filename, true))
 			{
 				int answer = wxMessageBox(wxString::Format(wxT("saving to % failed: try again ?"), name.GetName()), message, wxYES | wxNO | wxCANCEL);
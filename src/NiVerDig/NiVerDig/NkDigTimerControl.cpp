@@ -9,22 +9,43 @@ public:
 		: formControl(main->m_mainPanel)
 		, m_main(main)
 		, m_halt(NULL)
+		, m_subscribed(false)
+		, m_flushed(0)
+		, m_frame(16)
 	{
+		int display = wxDisplay::GetFromWindow(main);
+		int refresh = wxDisplay((display == wxNOT_FOUND) ? 0 : display).GetCurrentMode().GetRefresh();
+		if (refresh > 0) m_frame = 1000 / refresh;
 		UpdatePins();
 		UpdateTasks();
 		Layout();
+		Subscribe(true);
 		m_timer.Bind(wxEVT_TIMER, &panelControl::OnTimer, this);
-		m_timer.Start(200);
+		m_timer.Start(m_subscribed ? 20 : 200);
 	}
 
 	~panelControl()
 	{
 		m_timer.Stop();
+		Subscribe(false);
+	}
+
+	void Subscribe(bool on)
+	{
+		if (!NkComPort_IsConnected(m_main->m_port)) return;
+		// the device pushes the state changes at most once per ms
+		// older firmware does not know 'subscribe': then the changes are polled with '.'
+		wxRegEx reply(wxT("subscribe=(\\d+)"), wxRE_EXTENDED);
+		wchar_t answer[64];
+		m_main->WriteLine(on ? wxT("subscribe 1\n") : wxT("subscribe 0\n"));
+		m_subscribed = on && (m_main->ReadAnswer(reply, answer, countof(answer), 200) > 0);
+		m_main->m_events.clear();
 	}
 
 	void UpdatePins()
 	{
 		m_pinSizer->Clear(true);
+		m_damagedPins.clear();
 
 		if (!NkComPort_IsConnected(m_main->m_port))
 		{
@@ -116,6 +137,7 @@ public:
 	void UpdateTasks()
 	{
 		m_taskSizer->Clear(true);
+		m_damagedTasks.clear();
 
 		if (!NkComPort_IsConnected(m_main->m_port))
 		{
@@ -235,7 +257,29 @@ public:
 	void OnTimer(wxTimerEvent& event)
 	{
 		if (m_main->m_port == NULL) return;
+		Collect();
+		Flush();
+	}
+
+	// reads the state changes since the last tick
+	void Collect()
+	{
 		wchar_t answer[1024] = { 0 };
+		// state changes that were pushed while the main frame was waiting for an answer
+		for (size_t i = 0; i < m_main->m_events.size(); ++i)
+		{
+			ParseStateChange(m_main->m_events[i].wc_str());
+		}
+		m_main->m_events.clear();
+		if (m_subscribed)
+		{
+			// collect the changes the device pushed since the last tick
+			while (NkComPort_ReadLine(m_main->m_port, answer, 1024, 0) > 0)
+			{
+				ParseStateChange(answer);
+			}
+			return;
+		}
 		// don't use the WriteLine and ReadLine functions to prevent logging
 		NkComPort_WriteA(m_main->m_port, ".\n", 2);
 		while (1)
@@ -247,90 +291,183 @@ public:
 		}
 	}
 
-	void ParseStateChange(wchar_t* line)
+	// applies a state change to the model: the controls are updated by Flush
+	void ParseStateChange(const wchar_t* line)
 	{
-		//wxRegEx pinState(wxT("\\*pin\\[(\\d+)\\]=(\\d+)"), wxRE_EXTENDED);
-		wxRegEx pinState(wxT("p (\\d+) (\\d+)"), wxRE_EXTENDED);
-		if (pinState.Matches(line))
+		// 'p <pin> <state>'
+		size_t ipin;
+		int64_t state;
+		if (deviceParseState(line, L'p', ipin, state))
 		{
-			size_t ipin;
-			pinState.GetMatch(line, 1).ToULongLong(&ipin);
 			--ipin;
 			if (ipin >= m_main->m_pins.items.size()) return;
+			m_main->m_pins.items[ipin].state = state;
+			m_damagedPins.insert(ipin);
+			return;
+		}
+		// 't <task> <state>'
+		size_t itask;
+		if (deviceParseState(line, L't', itask, state))
+		{
+			--itask;
+			if (itask >= m_main->m_tasks.items.size()) return;
+			SItem& task = m_main->m_tasks.items[itask];
+			task.state = state;
+			if (task.state == 2) task.state = 0; // finished -> idle
+			if (task.state == 3) task.state = 2; // fired
+			m_damagedTasks.insert(itask);
+			return;
+		}
+	}
+
+	// shows the states that changed since the last flush, at most once per frame of the display.
+	// a control is only repainted when it shows another state than the model.
+	void Flush()
+	{
+		if (m_damagedPins.empty() && m_damagedTasks.empty()) return;
+		ULONGLONG tick = GetTickCount64();
+		if ((tick - m_flushed) < m_frame) return;
+		m_flushed = tick;
+
+		for (size_t ipin : m_damagedPins)
+		{
+			if (ipin >= m_main->m_pins.items.size()) break;
 			SItem& pin = m_main->m_pins.items[ipin];
-			pinState.GetMatch(line, 2).ToLongLong(&pin.state);
-			if (pin.control)
+			if (!pin.control) continue;
+			switch (pin.type)
 			{
-				switch (pin.type)
+				case SItem::eAdcPin:
 				{
-					case SItem::eAdcPin:
+					wxStaticText * st = dynamic_cast<wxStaticText*>(pin.control);
+					wxString label = wxString::Format(wxT("%lld"), pin.state);
+					if (st && (st->GetLabel() != label))
 					{
-						wxStaticText * st = dynamic_cast<wxStaticText*>(pin.control);
-						if (st)
-						{
-							st->SetLabel(wxString::Format(wxT("%lld"),pin.state));
-						}
+						st->SetLabel(label);
 					}
-					break;
-					case SItem::ePwmPin:
+				}
+				break;
+				case SItem::ePwmPin:
+				{
+					wxComboBoxEx* cb = dynamic_cast<wxComboBoxEx*>(pin.control);
+					if (cb && (cb->GetSelection() != int(pin.state)))
 					{
-						wxComboBoxEx* cb = dynamic_cast<wxComboBoxEx*>(pin.control);
-						if (cb)
-						{
-							cb->SetSelection(pin.state);
-						}
+						cb->SetSelection(pin.state);
 					}
-					break;
-					default:
+				}
+				break;
+				default:
+				{
+					wxManualToggleButton* btn = dynamic_cast<wxManualToggleButton*>(pin.control);
+					if (btn && (btn->GetValue() != long(pin.state)))
 					{
-						wxManualToggleButton* btn = dynamic_cast<wxManualToggleButton*>(pin.control);
-						if (btn)
-						{
-							btn->SetValue(pin.state);
-							long nv = btn->GetValue();
-							btn->Refresh();
-						}
+						btn->SetValue(pin.state);
+						btn->Refresh();
 					}
-					break;
 				}
+				break;
 			}
-			return;
 		}
-		//wxRegEx taskState(wxT("\\*task\\[(\\d+)\\]=(\\d+)"), wxRE_EXTENDED);
-		wxRegEx taskState(wxT("t (\\d+) (\\d+)"), wxRE_EXTENDED);
-		if (taskState.Matches(line))
+		m_damagedPins.clear();
+
+		for (size_t itask : m_damagedTasks)
 		{
-			size_t itask;
-			taskState.GetMatch(line, 1).ToULongLong(&itask);
-			--itask;
-			if (itask >= m_main->m_tasks.items.size()) return;
+			if (itask >= m_main->m_tasks.items.size()) break;
 			SItem& task = m_main->m_tasks.items[itask];
-			taskState.GetMatch(line, 2).ToLongLong(&task.state);
-			if (task.state == 2) task.state = 0; // finished -> idle
-			if (task.state == 3) task.state = 2; // fired
-			if (task.control)
+			wxManualToggleButton* btn = dynamic_cast<wxManualToggleButton*>(task.control);
+			if (btn && (btn->GetValue() != long(task.state)))
 			{
-				wxManualToggleButton* btn = dynamic_cast<wxManualToggleButton*>(task.control);
-				if (btn)
-				{
-					btn->SetValue(task.state);
-					long nv = btn->GetValue();
-					btn->Refresh();
-				}
+				btn->SetValue(task.state);
+				btn->Refresh();
 			}
-			return;
 		}
+		m_damagedTasks.clear();
 	}
 
-
-
-
 	frameMain*            m_main;
 	wxBitmapToggleButton* m_halt;
 	wxTimer               m_timer;
+	bool                  m_subscribed;
+	std::set<size_t>      m_damagedPins;  // pins with a state change that is not shown yet
+	std::set<size_t>      m_damagedTasks; // tasks with a state change that is not shown yet
+	ULONGLONG             m_flushed;      // tick of the last Flush
+	ULONGLONG             m_frame;        // ms per frame of the display
 };
 
 wxPanel* CreateControlPanel(frameMain* parent)
 {
 	return new panelControl(parent);
-}
\ No newline at end of file
+}
+
+#ifdef PARSE_BENCHMARK
+// cost per line of the state changes and field definitions parsed with wxRegEx (as before) and
+// with the deviceTokenizer. prints to the debugger output.
+void ParseBenchmark()
+{
+	const wchar_t* states[] = { L"p 12 1", L"t 3 2", L"p 5 1023", L"t 17 3" };
+	const wchar_t* fields[] = { L" <index>  : [1 to 32]", L" <mode>   : (output|input|pullup|pwm|adc)", L" <name>   : quoted pin name [15]" };
+	const size_t count = 100000;
+	LARGE_INTEGER frequency, t0, t1, t2;
+	QueryPerformanceFrequency(&frequency);
+	int64_t sum = 0;
+
+	// the regular expressions of ParseStateChange were compiled for each line
+	QueryPerformanceCounter(&t0);
+	for (size_t i = 0; i < count; ++i)
+	{
+		const wchar_t* line = states[i % countof(states)];
+		wxRegEx pinState(wxT("p (\\d+) (\\d+)"), wxRE_EXTENDED);
+		wxRegEx taskState(wxT("t (\\d+) (\\d+)"), wxRE_EXTENDED);
+		wxRegEx& re = pinState.Matches(line) ? pinState : taskState;
+		if (!re.Matches(line)) continue;
+		long long state;
+		re.GetMatch(line, 2).ToLongLong(&state);
+		sum += state;
+	}
+	QueryPerformanceCounter(&t1);
+	for (size_t i = 0; i < count; ++i)
+	{
+		const wchar_t* line = states[i % countof(states)];
+		size_t index;
+		int64_t state;
+		if (deviceParseState(line, L'p', index, state) || deviceParseState(line, L't', index, state)) sum += state;
+	}
+	QueryPerformanceCounter(&t2);
+	OutputDebugString(wxString::Format(wxT("state lines: wxRegEx %.0f ns/line, tokenizer %.0f ns/line\n"),
+		double(t1.QuadPart - t0.QuadPart) * 1e9 / double(frequency.QuadPart) / double(count),
+		double(t2.QuadPart - t1.QuadPart) * 1e9 / double(frequency.QuadPart) / double(count)));
+
+	// the regular expressions of ParseItems are compiled once per command
+	wxRegEx reRange(wxT(" *<(.+)> *: *\\[(-?\\d+) +to +(\\d+)\\]"), wxRE_EXTENDED);
+	wxRegEx reEnum(wxT(" *<(.+)> *: *\\((.+)\\)"), wxRE_EXTENDED);
+	wxRegEx reString(wxT(" *<(.+)> *: *(.*)"), wxRE_EXTENDED);
+	QueryPerformanceCounter(&t0);
+	for (size_t i = 0; i < count; ++i)
+	{
+		const wchar_t* line = fields[i % countof(fields)];
+		wxString name;
+		if (reRange.Matches(line)) name = reRange.GetMatch(line, 1);
+		else if (reEnum.Matches(line)) name = reEnum.GetMatch(line, 1);
+		else if (reString.Matches(line)) name = reString.GetMatch(line, 1);
+		sum += name.length();
+	}
+	QueryPerformanceCounter(&t1);
+	for (size_t i = 0; i < count; ++i)
+	{
+		deviceTokenizer line(fields[i % countof(fields)]);
+		deviceToken name;
+		line.Spaces();
+		if (!line.Char(L'<') || !line.Until(L'>', name)) continue;
+		line.Spaces();
+		line.Char(L':');
+		line.Spaces();
+		int64_t lower, higher;
+		deviceToken values;
+		if (!line.Range(lower, higher)) line.Enum(values);
+		sum += name.str().length();
+	}
+	QueryPerformanceCounter(&t2);
+	OutputDebugString(wxString::Format(wxT("field lines: wxRegEx %.0f ns/line, tokenizer %.0f ns/line (%lld)\n"),
+		double(t1.QuadPart - t0.QuadPart) * 1e9 / double(frequency.QuadPart) / double(count),
+		double(t2.QuadPart - t1.QuadPart) * 1e9 / double(frequency.QuadPart) / double(count), sum));
+}
+#endif
\ No newline at end of file
@@ -1,4 +1,5 @@
 #include "framework.h"
+#include "../nkbef/nkbefRender.h"
 
 wxDEFINE_EVENT(NKDIGTIMERGRAPHEVENT, NkDigTimerGraphEvent);
 
@@ -22,14 +23,39 @@ DWORD scopePages<word>::m_mapPageSize = GetSystemPageSize();
 template <typename T>
 fileSample<T> * scopeReader<T>::First(size_t first)
 {
+	if (IsChunked() || m_index.size())
+	{
+		// binary search the last index entry before first and scan from there.
+		// the samples are only sorted within the delay of the fifo, so start one entry earlier.
+		if (IsChunked())
+		{
+			m_sample = m_chunks.Find(first);
+		}
+		else
+		{
+			scopeIndex::iterator i = std::upper_bound(m_index.begin(), m_index.end(), first,
+				[](size_t t, const scopeIndexEntry& e) { return t < e.timestamp; });
+			if (i != m_index.begin()) --i;
+			if (i != m_index.begin()) --i;
+			m_sample = m_pages.MapOffset(i->offset);
+		}
+		for (fileSample<T>* sample = m_sample; sample; sample = Next())
+		{
+			if ((sample->timestamp >= first) && ScopeSelected(m_channels, sample->channel))
+			{
+				return m_sample;
+			}
+		}
+		return NULL;
+	}
 	if (!m_sample)
 	{
 		// first time: we have no clue: start to map the first pages and check if the
 		// time_stamp is in there
 		m_sample = m_pages.Map(0, 10);
-		for (fileSample* sample = m_sample; sample ; sample = Next())
+		for (fileSample<T>* sample = m_sample; sample ; sample = Next())
 		{
-			if (sample->timestamp >= first)
+			if ((sample->timestamp >= first) && ScopeSelected(m_channels, sample->channel))
 			{
 				m_sample = sample;
 				return m_sample;
@@ -40,7 +66,7 @@ fileSample<T> * scopeReader<T>::First(size_t first)
 	if (first > m_sample->timestamp)
 	{
 		// need to move forward
-		for(fileSample * sample = m_sample; sample; sample = Next())
+		for(fileSample<T>* sample = m_sample; sample; sample = Next())
 		{
 			if (sample->timestamp >= first)
 			{
@@ -53,7 +79,7 @@ fileSample<T> * scopeReader<T>::First(size_t first)
 	//else
 	{
 		// need to move backwards
-		for (fileSample* sample = m_sample; sample; sample = Prev())
+		for (fileSample<T>* sample = m_sample; sample; sample = Prev())
 		{
 			if (sample->timestamp < first)
 			{
@@ -69,11 +95,15 @@ fileSample<T> * scopeReader<T>::First(size_t first)
 template <typename T>
 fileSample<T>* scopeReader<T>::Next()
 {
-	fileSample<T>* sample = m_sample + 1;
-	if (sample >= m_pages.m_end)
+	fileSample<T>* sample = m_sample;
+	do
 	{
-		sample = m_pages.MapNext(10);
-	}
+		++sample;
+		if (sample >= End())
+		{
+			sample = IsChunked() ? m_chunks.MapNext() : m_pages.MapNext(10);
+		}
+	} while (sample && !ScopeSelected(m_channels, sample->channel));
 	if (sample) m_sample = sample;
 	return sample;
 }
@@ -81,11 +111,15 @@ fileSample<T>* scopeReader<T>::Next()
 template <typename T>
 fileSample<T>* scopeReader<T>::Prev()
 {
-	fileSample<T>* sample = m_sample - 1;
-	if (sample < m_pages.m_begin)
+	fileSample<T>* sample = m_sample;
+	do
 	{
-		sample = m_pages.MapPrev(10);
-	}
+		--sample;
+		if (sample < Begin())
+		{
+			sample = IsChunked() ? m_chunks.MapPrev() : m_pages.MapPrev(10);
+		}
+	} while (sample && !ScopeSelected(m_channels, sample->channel));
 	if (sample) m_sample = sample;
 	return sample;
 }
@@ -94,6 +128,7 @@ template <typename T>
 void scopeReader<T>::Reset()
 {
 	m_pages.Unmap();
+	m_chunks.Unmap();
 	m_sample = NULL;
 }
 
@@ -108,7 +143,17 @@ bool NkDigTimerGraph::Create(wxWindow* parent,
 
 	m_timer.Bind(wxEVT_TIMER, &NkDigTimerGraph::OnTimer, this);
 	m_drawGrid = true;
+	m_scrollBy = 0;
+	m_scrolled = 0;
+	m_scrollFirst = 0;
+	m_origin = 0;
 	m_main = NULL;
+	m_pins = NULL;
+	m_worker = NULL;
+	m_renderJob = 0;
+	m_drawFrame = false;
+	m_lod = NULL;
+	m_lodPainted = false;
 	m_period = US_PER_SECOND; // start with a period of 1 second
 	m_first = GetCurrentFileTime();
 	m_last = m_first + m_period;
@@ -118,6 +163,7 @@ bool NkDigTimerGraph::Create(wxWindow* parent,
 	m_frozen = false;
 	m_triggered = true;
 	m_triggerChannel = 0;
+	m_trigger = NULL;
 	m_triggerMode = modeAuto;
 	m_triggerDelay = m_period/1000 * 2; // in ms
 	m_triggerTimeout = 0;
@@ -126,23 +172,60 @@ bool NkDigTimerGraph::Create(wxWindow* parent,
 	return result;
 }
 
-void NkDigTimerGraph::Init(frameMain* main, HANDLE file, size_t lastsample, long adcBits)
+void NkDigTimerGraph::Init(frameMain* main, HANDLE file, size_t lastsample, long adcBits, size_t dataOffset, SItems* pins)
 { 
 	m_main = main;
-	m_lines.resize(m_main->m_pins.items.size());
+	m_pins = pins ? pins : &m_main->m_pins;
+	m_lines.resize(m_pins->items.size());
 	for (size_t i = 0; i < m_lines.size(); ++i)
 	{
-		m_lines[i].type = m_main->m_pins.items[i].type;
+		m_lines[i].type = m_pins->items[i].type;
 	}
 	m_adcBits = adcBits;
-	if(m_adcBits != 8) m_readerWord.SetFile(file, lastsample);
-	else m_readerByte.SetFile(file, lastsample);
+	if(m_adcBits != 8) m_readerWord.SetFile(file, lastsample, dataOffset);
+	else m_readerByte.SetFile(file, lastsample, dataOffset);
+	if (!m_worker)
+	{
+		m_worker = new NkDigTimerGraphWorker(this);
+		m_worker->Start();
+	}
+	m_worker->SetFile(file, lastsample, adcBits, dataOffset);
+}
+
+NkDigTimerGraph::~NkDigTimerGraph()
+{
+	if (m_worker)
+	{
+		m_worker->Stop();
+		delete m_worker;
+	}
 }
 
 void NkDigTimerGraph::SetLastSample(size_t lastsample)
 {
 	if (m_adcBits != 8) m_readerWord.SetLastSample(lastsample);
 	else m_readerByte.SetLastSample(lastsample);
+	if (m_worker) m_worker->SetLastSample(lastsample);
+}
+
+void NkDigTimerGraph::SetIndex(const scopeIndex& index)
+{
+	if (m_adcBits != 8) m_readerWord.SetIndex(index);
+	else m_readerByte.SetIndex(index);
+	if (m_worker) m_worker->SetIndex(index);
+}
+
+void NkDigTimerGraph::SetChunks(const scopeChunkIndex& chunks)
+{
+	if (m_adcBits != 8) m_readerWord.SetChunks(chunks);
+	else m_readerByte.SetChunks(chunks);
+	if (m_worker) m_worker->SetChunks(chunks);
+}
+
+void NkDigTimerGraph::SetLod(const scopeLod* lod)
+{
+	m_lod = lod;
+	m_lodPainted = false;
 }
 
 void NkDigTimerGraph::Reset()
@@ -204,7 +287,7 @@ void NkDigTimerGraph::OnSize(wxSizeEvent& event)
 		for (size_t i = 0; i < m_lines.size(); ++i)
 		{
 			CPinLine& line = m_lines[i];
-			line.label = m_main->m_pins.items[i].values[1];
+			line.label = m_pins->items[i].values[1];
 			line.top = pos;
 			pos += line.type == SItem::eAdcPin ? adc_height : line_height;
 			line.bottom = pos;
@@ -229,6 +312,7 @@ void NkDigTimerGraph::OnPaintImpl(scopeReader<T> & m_reader)
 	HDC hdc = (HDC)bdc.GetHandle();
 	long adcScale = (1 << m_adcBits) / 256;
 
+	bool drawGrid = m_drawGrid;
 	if (m_drawGrid)
 	{
 		m_drawGrid = false;
@@ -283,304 +367,19 @@ void NkDigTimerGraph::OnPaintImpl(scopeReader<T> & m_reader)
 			size_t last_us = m_last / 10ULL;
 			size_t start_t = first_us / US_PER_SECOND;              // start_t is in seconds 
 			size_t start_us = first_us - (start_t * US_PER_SECOND); // us to add to start_t
-			size_t step = 1;                                     // step is in microseconds
-			struct tm* tm = NULL;
+			struct tm* tm = NULL;
+			if (absTime)
+			{
+				tm = localtime((time_t*)&start_t);
+				if (!tm) return;
+			}
+			size_t step = nkbefTimeStep(microseconds / max_labels); // step is in microseconds
 			if (absTime)
 			{
-				tm = localtime((time_t*)&start_t);
-				if (!tm) return;
-			}
-			size_t us_per_label = microseconds / max_labels;
-			if (us_per_label > US_PER_DAY)
-			{
-				// tick every week
-				step = 7LL * US_PER_DAY;
-				if (absTime)
-				{
-					start_t -= tm->tm_sec;
-					start_t -= tm->tm_min * 60;
-					start_t -= tm->tm_hour * 60 * 60;
-					start_t -= tm->tm_wday * 24 * 60 * 60;
-				}
-			}
-			else if (us_per_label > 8LL * US_PER_HOUR)
-			{
-				// tick every day
-				step = US_PER_DAY;
-				if (absTime)
-				{
-					start_t -= tm->tm_sec;
-					start_t -= tm->tm_min * 60;
-					start_t -= tm->tm_hour * 60 * 60;
-				}
-			}
-			else if (us_per_label > 4LL * US_PER_HOUR)
-			{
-				// tick every 8 hours
-				step = 8LL * US_PER_HOUR;
-				if (absTime)
-				{
-					start_t -= tm->tm_sec;
-					start_t -= tm->tm_min * 60;
-					start_t -= (tm->tm_hour % 8) * 60 * 60;
-				}
-			}
-			else if (us_per_label > US_PER_HOUR)
-			{
-				// tick every 4 hours
-				step = 4LL * US_PER_HOUR;
-				if (absTime)
-				{
-					start_t -= tm->tm_sec;
-					start_t -= tm->tm_min * 60;
-					start_t -= (tm->tm_hour % 4) * 60 * 60;
-				}
-			}
-			else if (us_per_label > 30LL * US_PER_MINUTE)
-			{
-				// tick every hour
-				step = US_PER_HOUR;
-				if (absTime)
-				{
-					start_t -= tm->tm_sec;
-					start_t -= tm->tm_min * 60;
-				}
-			}
-			else if (us_per_label > 10LL * US_PER_MINUTE)
-			{
-				// tick every half hour
-				step = 30LL * US_PER_MINUTE;
-				if (absTime)
-				{
-					start_t -= tm->tm_sec;
-					start_t -= (tm->tm_min % 30) * 60;
-				}
-			}
-			else if (us_per_label > 5LL * US_PER_MINUTE)
-			{
-				// tick every 10 minutes
-				step = 10LL * US_PER_MINUTE;
-				if (absTime)
-				{
-					start_t -= tm->tm_sec;
-					start_t -= (tm->tm_min % 10) * 60;
-				}
-			}
-			else if (us_per_label > US_PER_MINUTE)
-			{
-				// tick every 5 minutes
-				step = 5LL * US_PER_MINUTE;
-				if (absTime)
-				{
-					start_t -= (tm->tm_min % 5) * 60;
-				}
-			}
-			else if (us_per_label > 30LL * US_PER_SECOND)
-			{
-				// tick every minute
-				step = US_PER_MINUTE;
-				if (absTime)
-				{
-					start_t -= tm->tm_sec;
-				}
-			}
-			else if (us_per_label > 10LL * US_PER_SECOND)
-			{
-				// tick every 30 seconds
-				step = 30LL * US_PER_SECOND;
-				if (absTime)
-				{
-					start_t -= tm->tm_sec % 30;
-				}
-			}
-			else if (us_per_label > 5LL * US_PER_SECOND)
-			{
-				// tick every 10 seconds
-				step = 10LL * US_PER_SECOND;
-				if (absTime)
-				{
-					start_t -= tm->tm_sec % 10;
-				}
-			}
-			else if (us_per_label > 2LL * US_PER_SECOND)
-			{
-				// tick every 5 seconds
-				step = 5LL * US_PER_SECOND;
-				if (absTime)
-				{
-					start_t -= tm->tm_sec % 5;
-				}
-			}
-			else if (us_per_label > US_PER_SECOND)
-			{
-				// tick every 2 seconds
-				step = 2LL * US_PER_SECOND;
-				if (absTime)
-				{
-					start_t -= tm->tm_sec % 2;
-				}
-			}
-			else if (us_per_label > 500LL * US_PER_MS)
-			{
-				// tick every seconds
-				step = US_PER_SECOND;
-			}
-			else if (us_per_label > 200LL * US_PER_MS)
-			{
-				// step every 0.5 s
-				step = 500L * US_PER_MS;
-				if (absTime)
-				{
-					start_us -= start_us % (500LL * US_PER_MS);
-				}
-			}
-			else if (us_per_label > 100LL * US_PER_MS)
-			{
-				// step every 0.2 s
-				step = 200L * US_PER_MS;
-				if (absTime)
-				{
-					start_us -= start_us % (200LL * US_PER_MS);
-				}
-			}
-			else if (us_per_label > 50LL * US_PER_MS)
-			{
-				// step every 0.1 s
-				step = 100L * US_PER_MS;
-				if (absTime)
-				{
-					start_us -= start_us % (100LL * US_PER_MS);
-				}
-			}
-			else if (us_per_label > 20LL * US_PER_MS)
-			{
-				// step every 0.05 s
-				step = 50L * US_PER_MS;
-				if (absTime)
-				{
-					start_us -= start_us % (50LL * US_PER_MS);
-				}
-			}
-			else if (us_per_label > 10LL * US_PER_MS)
-			{
-				// step every 0.02 s
-				step = 20L * US_PER_MS;
-				if (absTime)
-				{
-					start_us -= start_us % (20LL * US_PER_MS);
-				}
-			}
-			else if (us_per_label > 5LL * US_PER_MS)
-			{
-				// step every 0.01 s
-				step = 10L * US_PER_MS;
-				if (absTime)
-				{
-					start_us -= start_us % (10LL * US_PER_MS);
-				}
-			}
-			else if (us_per_label > 2LL * US_PER_MS)
-			{
-				// step every 0.005 s
-				step = 5L * US_PER_MS;
-				if (absTime)
-				{
-					start_us -= start_us % (5LL * US_PER_MS);
-				}
-			}
-			else if (us_per_label > 1LL * US_PER_MS)
-			{
-				// step every 0.002 s
-				step = 2L * US_PER_MS;
-				if (absTime)
-				{
-					start_us -= start_us % (2LL * US_PER_MS);
-				}
-			}
-			else if (us_per_label > 500)
-			{
-				// step every 0.001 s
-				step = US_PER_MS;
-				if (absTime)
-				{
-					start_us -= start_us % (1LL * US_PER_MS);
-				}
-			}
-			else if (us_per_label > 200)
-			{
-				// step every 0.0005 s
-				step = 500;
-				if (absTime)
-				{
-					start_us -= start_us % 500;
-				}
-			}
-			else if (us_per_label > 100)
-			{
-				// step every 0.0002 s
-				step = 200;
-				if (absTime)
-				{
-					start_us -= start_us % 200;
-				}
-			}
-			else if (us_per_label > 50)
-			{
-				// step every 0.0001 s
-				step = 100;
-				if (absTime)
-				{
-					start_us -= start_us % 100;
-				}
-			}
-			else if (us_per_label > 20)
-			{
-				// step every 0.00005 s
-				step = 50;
-				if (absTime)
-				{
-					start_us -= start_us % 50;
-				}
-			}
-			else if (us_per_label > 10)
-			{
-				// step every 0.00002 s
-				step = 20;
-				if (absTime)
-				{
-					start_us -= start_us % 20;
-				}
-			}
-			else if (us_per_label > 5)
-			{
-				// step every 0.00001 s
-				step = 10;
-				if (absTime)
-				{
-					start_us -= start_us % 10;
-				}
-			}
-			else if (us_per_label > 2)
-			{
-				// step every 0.000005 s
-				step = 5;
-				if (absTime)
-				{
-					start_us -= start_us % 5;
-				}
-			}
-			else if (us_per_label > 1)
-			{
-				// step every 0.000002 s
-				step = 2;
-				if (absTime)
-				{
-					start_us -= start_us % 2;
-				}
-			}
-			else
-			{
-				step = 1;
+				// the first label on a multiple of the step in local time, weeks start on sunday
+				if (step > US_PER_DAY) start_t -= tm->tm_wday * 24 * 60 * 60;
+				if (step >= US_PER_SECOND) start_t -= (tm->tm_hour * 60 * 60 + tm->tm_min * 60 + tm->tm_sec) % ((step > US_PER_DAY ? US_PER_DAY : step) / US_PER_SECOND);
+				else start_us -= start_us % step;
 			}
 
 			// draw the labels
@@ -638,57 +437,13 @@ void NkDigTimerGraph::OnPaintImpl(scopeReader<T> & m_reader)
 					{
 						MoveToEx(hdc, x, graph_area_bottom, NULL);
 						LineTo(hdc, x, graph_area_bottom + 10);
-						wxString text;
-						size_t hours = t / US_PER_HOUR;
-						size_t minutes = t / US_PER_MINUTE;
-						size_t seconds = t / US_PER_SECOND;
-						size_t ms = (t % US_PER_SECOND) / US_PER_MS;
-						if (step < US_PER_MS)
-						{
-							text = wxString::Format(wxT("%6lld"), t);
-						}
-						else if (step < US_PER_SECOND)
-						{
-							text = wxString::Format(wxT("%3lld"), t / US_PER_MS);
-						}
-						else if (step < US_PER_MINUTE)
-						{
-							text = wxString::Format(wxT("%02lld"), seconds);
-						}
-						else if (step < US_PER_HOUR)
-						{
-							text = wxString::Format(wxT("%02lld"), minutes);
-						}
-						else //if (step < US_PER_DAY)
-						{
-							text = wxString::Format(wxT("%02lld"), hours);
-						}
+						wxString text = nkbefTimeLabel(t, step);
 						text_area.left = x - m_txtSize.x;
 						text_area.right = x + m_txtSize.x;
 						DrawText(hdc, text, text.length(), &text_area, DT_CENTER | DT_VCENTER);
 					}
 				}
-				wxString caption;
-				if (step < US_PER_MS)
-				{
-					caption = wxT("[microseconds]");
-				}
-				else if (step < US_PER_SECOND)
-				{
-					caption = wxT("[milliseconds]");
-				}
-				else if (step < US_PER_MINUTE)
-				{
-					caption = wxT("[seconds]");
-				}
-				else if (step < US_PER_HOUR)
-				{
-					caption = wxT("[minutes]");
-				}
-				else //if (step < US_PER_DAY)
-				{
-					caption = wxT("[hours]");
-				}
+				wxString caption = nkbefTimeCaption(step);
 				text_area.left = m_graphArea.x;
 				text_area.right = graph_area_right;
 				text_area.top += m_txtSize.y + 10;
@@ -708,90 +463,304 @@ void NkDigTimerGraph::OnPaintImpl(scopeReader<T> & m_reader)
 		LineTo(hdc, graph_area_right, graph_area_bottom);
 		// move back to 100ns scaling
 		m_hscale /= 10ULL;
+
+		m_scrollBy = 0;
+		m_scrolled = 0;
+		m_scrollFirst = m_first;
+		if (Scrolling() && m_first) DrawScrollScale(hdc);
 	}
-	// paint the data until now
-	bdc.SetPen(*wxBLUE_PEN);
-	for (fileSample<T>* s = m_reader.Next(); s; s = m_reader.Next())
+	else if (m_scrollBy)
 	{
-		if (!m_first)
+		ScrollGraph(bdc, m_scrollBy);
+		m_scrollBy = 0;
+	}
+	// paint the data until now
+	bdc.SetPen(*wxBLUE_PEN);
+	if (drawGrid)
+	{
+		m_lodPainted = PaintLod(hdc, adcScale);
+	}
+	if (m_lodPainted)
+	{
+		return;
+	}
+	CTrace trace = { &m_lines, m_first, m_last, m_current, m_hscale, m_graphArea.x, adcScale, 0 };
+	if (m_worker && !m_timer.IsRunning())
+	{
+		// a window of a recording that is not live: traced by the render worker, see OnFrame
+		if (drawGrid)
+		{
+			// the samples are sorted within the delay of the fifo
+			trace.until = m_last + SCOPE_CHECKPOINT_DISORDER;
+			m_renderJob = m_worker->Render(trace);
+			m_drawFrame = false;
+		}
+		else if (m_drawFrame)
+		{
+			m_drawFrame = false;
+			m_worker->PaintFrame(hdc, m_renderJob);
+		}
+		return;
+	}
+	bool start = !m_first;
+	CGdiSink sink = { hdc };
+	Trace(m_reader, trace, sink);
+	m_first = trace.first;
+	m_last = trace.last;
+	m_current = trace.current;
+	if (start && m_first)
+	{
+		m_scrollFirst = m_origin = m_first;
+	}
+}
+
+// draws the samples the reader returns on the lines of the window of trace, until
+// trace.until. the render worker passes its job: it stops when generation changes.
+template <typename T, typename S>
+bool NkDigTimerGraph::Trace(scopeReader<T>& reader, CTrace& trace, S& sink, const std::atomic<size_t>* generation, size_t job)
+{
+	CPinLines& lines = *trace.lines;
+	size_t count = 0;
+	for (fileSample<T>* s = reader.Next(); s; s = reader.Next())
+	{
+		if (generation && !(++count & 0xFFFF) && (*generation != job))
+		{
+			return false;
+		}
+		if (!trace.first)
+		{
+			size_t period = trace.last - trace.first;
+			trace.first = s->timestamp;
+			trace.last = trace.first + period;
+		}
+		if (s->channel < lines.size())
+		{
+			auto& line = lines[s->channel];
+			size_t t = s->timestamp;
+			if ((line.value != NOT_INITIALIZED) && (t >= trace.first) && (line.last < trace.last))
+			{
+				if (t > trace.last) t = trace.last;
+				int x1 = trace.left;
+				if (line.last > trace.first) x1 += (line.last - trace.first) * trace.hscale;
+				int x2 = trace.left + (t - trace.first) * trace.hscale;
+				int y1;
+				if (line.type == SItem::eAdcPin)
+				{
+					int pos = ((line.value/trace.adcScale) * (line.bottom - line.top - 8)) / 256;
+					y1 = line.bottom - 4 - pos;
+				}
+				else
+				{
+					y1 = line.value ? line.top + 4 : line.bottom - 4;
+				}
+				sink.MoveTo(x1, y1);
+				if (line.type != SItem::eAdcPin)
+				{
+					sink.LineTo(x2, y1);
+				}
+				if (s->timestamp < trace.last)
+				{
+					int y2;
+					if (line.type == SItem::eAdcPin)
+					{
+						int pos = ((s->state/trace.adcScale) * (line.bottom - line.top - 8)) / 256;
+						y2 = line.bottom - 4 - pos;
+					}
+					else
+					{
+						y2 = s->state ? line.top + 4 : line.bottom - 4;
+					}
+					sink.LineTo(x2, y2);
+				}
+			}
+			line.last = s->timestamp;
+			line.value = s->state;
+		}
+		trace.current = s->timestamp;
+		if (trace.until && (s->timestamp > trace.until))
+		{
+			break;
+		}
+	}
+	size_t last = trace.current;
+	if (last >= trace.last)
+	{
+		last = trace.last;
+	}
+	// draw the line of the current state up to last.
+	// to do: for analog lines: the next data point after 'last' and draw a diagonal line ??
+	int x2 = trace.left + (last - trace.first) * trace.hscale;
+	for (auto& line : lines)
+	{
+		if ((line.last < last)/*&& (line.type != SItem::eAdcPin)*/)
+		{
+			int x1 = trace.left;
+			if (line.last > trace.first) x1 += (line.last - trace.first) * trace.hscale;
+			int y;
+			if (line.type == SItem::eAdcPin)
+			{
+				int pos = ((line.value / trace.adcScale) * (line.bottom - line.top - 8)) / 256;
+				y = line.bottom - 4 - pos;
+			}
+			else
+			{
+				y = line.value ? line.top + 4 : line.bottom - 4;
+			}
+			sink.MoveTo(x1, y);
+			sink.LineTo(x2, y);
+			line.last = trace.current;
+		}
+	}
+	return true;
+}
+
+// paint the range from the level-of-detail pyramid when a pixel spans at least one bucket of level 0.
+// per line at most one bucket per pixel is drawn, whatever the number of samples.
+bool NkDigTimerGraph::PaintLod(HDC hdc, long adcScale)
+{
+	if (!m_lod || m_lod->empty() || (m_hscale <= 0.) || (m_last <= m_first)) return false;
+	double units = 1. / m_hscale; // timestamp units per pixel
+	size_t level = 0;
+	if (units < double(1ULL << SCOPE_LOD_SHIFT)) return false;
+	while (((level + 1) < SCOPE_LOD_LEVELS) && (double(1ULL << (SCOPE_LOD_SHIFT + level + 1)) <= units)) ++level;
+	// the lowest levels of a long recording are dropped: draw the samples
+	if (level < m_lod->m_lowest) return false;
+	size_t shift = SCOPE_LOD_SHIFT + level;
+	size_t last = m_lod->m_last < m_last ? m_lod->m_last : m_last;
+	int x_last = m_graphArea.x + int((last > m_first ? last - m_first : 0) * m_hscale);
+	auto ypos = [&](CPinLine& line, word value)
+	{
+		if (line.type == SItem::eAdcPin)
 		{
-			m_first = s->timestamp;
-			m_last = m_first + m_period;
+			int pos = ((value / adcScale) * (line.bottom - line.top - 8)) / 256;
+			return line.bottom - 4 - pos;
 		}
-		if (s->channel < m_lines.size())
+		return value ? line.top + 4 : line.bottom - 4;
+	};
+	for (size_t i = 0; i < m_lines.size(); ++i)
+	{
+		CPinLine& line = m_lines[i];
+		const std::vector<scopeLodEntry>* entries = m_lod->Entries(level, i);
+		if (!entries || entries->empty()) continue;
+		std::vector<scopeLodEntry>::const_iterator e = std::lower_bound(entries->begin(), entries->end(), m_first >> shift,
+			[](const scopeLodEntry& e, size_t bucket) { return e.bucket < bucket; });
+		word value = (e != entries->begin()) ? (e - 1)->last : e->before;
+		int x1 = m_graphArea.x;
+		if ((e == entries->begin()) && ((e->bucket << shift) > m_first)) x1 += int(((e->bucket << shift) - m_first) * m_hscale);
+		for (; (e != entries->end()) && ((e->bucket << shift) < m_last); ++e)
 		{
-			auto& line = m_lines[s->channel];
-			size_t t = s->timestamp;
-			if ((line.value != NOT_INITIALIZED) && (t >= m_first) && (line.last < m_last))
+			size_t t = e->bucket << shift;
+			int x2 = m_graphArea.x + int((t > m_first ? t - m_first : 0) * m_hscale);
+			int y = ypos(line, value);
+			MoveToEx(hdc, x1, y, NULL);
+			LineTo(hdc, x2, y);
+			if (e->edges)
 			{
-				if (t > m_last) t = m_last;
-				int x1 = m_graphArea.x;
-				if (line.last > m_first) x1 += (line.last - m_first) * m_hscale;
-				int x2 = m_graphArea.x + (t - m_first) * m_hscale;
-				int y1;
-				if (line.type == SItem::eAdcPin)
-				{
-					int pos = ((line.value/adcScale) * (line.bottom - line.top - 8)) / 256;
-					y1 = line.bottom - 4 - pos;
-				}
-				else
-				{
-					y1 = line.value ? line.top + 4 : line.bottom - 4;
-				}
-				MoveToEx(hdc, x1, y1, NULL);
-				if (line.type != SItem::eAdcPin)
-				{
-					LineTo(hdc, x2, y1);
-				}
-				if (s->timestamp < m_last)
-				{
-					int y2;
-					if (line.type == SItem::eAdcPin)
-					{
-						int pos = ((s->state/adcScale) * (line.bottom - line.top - 8)) / 256;
-						y2 = line.bottom - 4 - pos;
-					}
-					else
-					{
-						y2 = s->state ? line.top + 4 : line.bottom - 4;
-					}
-					LineTo(hdc, x2, y2);
-				}
+				MoveToEx(hdc, x2, ypos(line, e->min), NULL);
+				LineTo(hdc, x2, ypos(line, e->max));
 			}
-			line.last = s->timestamp;
-			line.value = s->state;
+			value = e->last;
+			x1 = x2;
 		}
-		m_current = s->timestamp;
+		if (x1 < x_last)
+		{
+			int y = ypos(line, value);
+			MoveToEx(hdc, x1, y, NULL);
+			LineTo(hdc, x_last, y);
+		}
+		line.value = value;
+		line.last = last;
 	}
-	size_t last = m_current;
-	if (last >= m_last)
+	m_current = m_lod->m_last;
+	return true;
+}
+
+bool NkDigTimerGraph::Scrolling() const
+{
+	return m_timer.IsRunning() && !m_triggerOn && !m_frozen;
+}
+
+// live mode: shift the graph pixels to the left, with the data, and draw the grid of the exposed strip.
+// the samples are drawn after it as they arrive, so a paint costs the new data, not the window.
+void NkDigTimerGraph::ScrollGraph(wxDC& dc, int pixels)
+{
+	HDC hdc = (HDC)dc.GetHandle();
+	int left = m_graphArea.x;
+	int right = m_graphArea.GetRight() + 1;
+	int top = m_graphArea.y;
+	int bottom = m_graphArea.GetBottom();
+	int strip = right - pixels;
+	BitBlt(hdc, left, top, strip - left, bottom + 1 - top, hdc, left + pixels, top, SRCCOPY);
+
+	dc.SetBrush(*wxWHITE_BRUSH);
+	dc.SetPen(*wxWHITE_PEN);
+	dc.DrawRectangle(strip, top, pixels, bottom + 1 - top);
+
+	// the grid lines of the strip
+	dc.SetPen(*wxLIGHT_GREY_PEN);
+	size_t step = m_period / 10;
+	if (step && (m_first > m_scrollFirst))
 	{
-		last = m_last;
+		for (size_t t = m_scrollFirst + (m_first - m_scrollFirst + step - 1) / step * step; t <= m_last; t += step)
+		{
+			int x = int(left + double(t - m_first) * m_hscale + 0.5);
+			if ((x >= strip) && (x < right)) dc.DrawLine(x, top, x, bottom);
+		}
 	}
-	// draw the line of the current state up to last.
-	// to do: for analog lines: the next data point after 'last' and draw a diagonal line ??
-	int x2 = m_graphArea.x + (last - m_first) * m_hscale;
 	for (auto& line : m_lines)
 	{
-		if ((line.last < last)/*&& (line.type != SItem::eAdcPin)*/)
-		{
-			int x1 = m_graphArea.x;
-			if (line.last > m_first) x1 += (line.last - m_first) * m_hscale;
-			int y;
-			if (line.type == SItem::eAdcPin)
-			{
-				int pos = ((line.value / adcScale) * (line.bottom - line.top - 8)) / 256;
-				y = line.bottom - 4 - pos;
-			}
-			else
-			{
-				y = line.value ? line.top + 4 : line.bottom - 4;
-			}
-			MoveToEx(hdc, x1, y, NULL);
-			LineTo(hdc, x2, y);
-			line.last = m_current;
-		}
+		dc.DrawLine(strip, line.top, right, line.top);
+	}
+	dc.SetPen(*wxBLACK_PEN);
+	dc.DrawLine(strip, bottom, right - 1, bottom);
+	DrawScrollScale(hdc);
+}
+
+// live mode: the scale below the graph at the grid lines, in time since the start of the recording
+void NkDigTimerGraph::DrawScrollScale(HDC hdc)
+{
+	RECT rows = { 0, m_graphArea.GetBottom() + 1, m_wndSize.x, m_wndSize.y };
+	FillRect(hdc, &rows, (HBRUSH)GetStockObject(WHITE_BRUSH));
+	size_t step = m_period / 10;
+	if (!step || (m_hscale <= 0.)) return;
+
+	// the unit of the labels, in 100 ns
+	size_t step_us = step / 10ULL;
+	double unit;
+	wxString caption;
+	if (step_us < US_PER_MS) { unit = 10.; caption = wxT("[microseconds]"); }
+	else if (step_us < US_PER_SECOND) { unit = 10. * US_PER_MS; caption = wxT("[milliseconds]"); }
+	else if (step_us < US_PER_MINUTE) { unit = 10. * US_PER_SECOND; caption = wxT("[seconds]"); }
+	else if (step_us < US_PER_HOUR) { unit = 10. * US_PER_MINUTE; caption = wxT("[minutes]"); }
+	else { unit = 10. * US_PER_HOUR; caption = wxT("[hours]"); }
+	int decimals = (fmod(double(step) / unit, 1.) > 1e-6) ? 1 : 0;
+
+	long graph_area_bottom = m_graphArea.GetBottom();
+	long graph_area_right = m_graphArea.GetRight();
+	RECT text_area;
+	text_area.top = graph_area_bottom + 10;
+	text_area.bottom = text_area.top + m_txtSize.y;
+	size_t first = (m_first > m_scrollFirst) ? m_scrollFirst + (m_first - m_scrollFirst + step - 1) / step * step : m_scrollFirst;
+	for (size_t t = first; t <= m_last; t += step)
+	{
+		long x = long(m_graphArea.x + double(t - m_first) * m_hscale + 0.5);
+		if (x > graph_area_right + 1) break;
+		MoveToEx(hdc, x, graph_area_bottom, NULL);
+		LineTo(hdc, x, graph_area_bottom + 10);
+		wxString text = wxString::Format(wxT("%.*f"), decimals, double(t - m_origin) / unit);
+		text_area.left = x - m_txtSize.x;
+		text_area.right = x + m_txtSize.x;
+		DrawText(hdc, text, text.length(), &text_area, DT_CENTER | DT_VCENTER);
 	}
+	text_area.left = m_graphArea.x;
+	text_area.right = graph_area_right;
+	text_area.top += m_txtSize.y + 10;
+	text_area.bottom = text_area.top + m_txtSize.y;
+	DrawText(hdc, caption, caption.length(), &text_area, DT_CENTER | DT_VCENTER);
+	wxString str = FormatLocalFileTime(m_first);
+	DrawText(hdc, str, str.length(), &text_area, DT_LEFT | DT_VCENTER);
+	str = FormatLocalFileTime(m_last);
+	DrawText(hdc, str, str.length(), &text_area, DT_RIGHT | DT_VCENTER);
 }
 
 void NkDigTimerGraph::OnTimer(wxTimerEvent& event)
@@ -815,9 +784,22 @@ void NkDigTimerGraph::OnTimerImpl(scopeReader<T>& m_reader)
 		{
 			if (!m_triggerOn)
 			{
-				m_first = m_current;
-				m_last = m_first + m_period;
-				m_drawGrid = true;
+				int pixels = int(double(m_current - m_last) * m_hscale) + 1;
+				if (m_drawGrid || (m_hscale <= 0.) || (m_scrollBy + pixels >= m_graphArea.width / 2))
+				{
+					// a gap in the data: start a new page
+					m_first = m_current;
+					m_last = m_first + m_period;
+					m_drawGrid = true;
+				}
+				else
+				{
+					// scroll by whole pixels: from m_scrollFirst, so the rounding does not add up
+					m_scrollBy += pixels;
+					m_scrolled += pixels;
+					m_first = m_scrollFirst + size_t(double(m_scrolled) / m_hscale + 0.5);
+					m_last = m_first + m_period;
+				}
 			}
 			else
 			{
@@ -838,7 +820,10 @@ void NkDigTimerGraph::OnTimerImpl(scopeReader<T>& m_reader)
 	}
 	else
 	{
-		// check in the data if a trigger event occured
+		// check in the data if a trigger event occured.
+		// a compound trigger is evaluated by the recording thread: only look up its time
+		bool compound = m_trigger && m_trigger->IsSet();
+		size_t fired = compound ? m_trigger->Next(m_last) : 0;
 		for (fileSample<T>* s = m_reader.Next(); s; s = m_reader.Next())
 		{
 			m_current = s->timestamp;
@@ -849,7 +834,16 @@ void NkDigTimerGraph::OnTimerImpl(scopeReader<T>& m_reader)
 				m_lines[channel].value = s->state;
 				m_lines[channel].last = s->timestamp;
 			}
-			if ((s->channel == m_triggerChannel) && (s->state == m_triggerPolarity))
+			if (compound)
+			{
+				if (fired && (s->timestamp >= fired))
+				{
+					m_triggered = true;
+					WindBack(m_first = fired - m_period / 10);
+					break;
+				}
+			}
+			else if ((s->channel == m_triggerChannel) && (s->state == m_triggerPolarity))
 			{
 				m_triggered = true;
 				WindBack(m_first = s->timestamp - m_period / 10);
@@ -872,7 +866,16 @@ void NkDigTimerGraph::OnTimerImpl(scopeReader<T>& m_reader)
 
 void NkDigTimerGraph::WindTo(size_t first)
 {
-	if (first < m_current)
+	if (m_worker && !m_timer.IsRunning())
+	{
+		// the render worker positions its own reader
+		m_first = first;
+		m_last = m_first + m_period;
+		m_drawGrid = true;
+		return;
+	}
+	// with a seek index, winding back is a binary search, also for positions ahead
+	if ((first < m_current) || m_readerByte.m_index.size() || m_readerWord.m_index.size() || m_readerByte.IsChunked() || m_readerWord.IsChunked())
 	{
 		WindBack(first);
 	}
@@ -889,46 +892,66 @@ void NkDigTimerGraph::WindBack(size_t first)
 }
 
 template <typename T>
-void NkDigTimerGraph::WindBackImpl(size_t first, scopeReader<T>& m_reader)
-{
-	m_first = first;
-	m_last = m_first + m_period;
-	fileSample<T>* s;
-	for (s = m_reader.m_sample; s; s = m_reader.Prev())
-	{
-		m_current = s->timestamp;
-		if (s->timestamp < m_first)
-		{
-			break;
-		}
-	}
-	for (auto& line : m_lines)
-	{
-		line.last = m_current;
-		line.value = 0xFFFF;
-	}
-	size_t count = m_lines.size();
-	for (; s; s = m_reader.Prev())
-	{
-		size_t channel = s->channel;
-		if (~channel < m_lines.size()) channel = ~channel; // no real event but tick sync event
-		if (channel < m_lines.size())
-		{
-			if (m_lines[channel].value == -1)
-			{
-				m_lines[channel].value = s->state;
-				m_lines[channel].last = s->timestamp;
-				--count;
-				if (!count)
-				{
-					break;
-				}
-			}
-		}
-	}
-	m_drawGrid = true;
-}
-
+void NkDigTimerGraph::WindBackImpl(size_t first, scopeReader<T>& m_reader)
+{
+	m_first = first;
+	m_last = m_first + m_period;
+	m_current = Rewind(m_reader, m_lines, m_first, m_current);
+	m_drawGrid = true;
+}
+
+// positions the reader before first and sets the lines to their state at first.
+// returns the timestamp of the sample the reader is on.
+template <typename T>
+size_t NkDigTimerGraph::Rewind(scopeReader<T>& reader, CPinLines& lines, size_t first, size_t current)
+{
+	fileSample<T>* s;
+	if (reader.m_index.size() || reader.IsChunked())
+	{
+		// position on the last sample before first
+		s = reader.First(first);
+		s = s ? reader.Prev() : reader.m_sample;
+		if (s) current = s->timestamp;
+		else reader.Reset();
+	}
+	else
+	{
+		for (s = reader.m_sample; s; s = reader.Prev())
+		{
+			current = s->timestamp;
+			if (s->timestamp < first)
+			{
+				break;
+			}
+		}
+	}
+	for (auto& line : lines)
+	{
+		line.last = current;
+		line.value = NOT_INITIALIZED;
+	}
+	size_t count = lines.size();
+	for (; s; s = reader.Prev())
+	{
+		size_t channel = s->channel;
+		if (~channel < lines.size()) channel = ~channel; // no real event but tick sync event
+		if (channel < lines.size())
+		{
+			if (lines[channel].value == NOT_INITIALIZED)
+			{
+				lines[channel].value = s->state;
+				lines[channel].last = s->timestamp;
+				--count;
+				if (!count)
+				{
+					break;
+				}
+			}
+		}
+	}
+	return current;
+}
+
 void NkDigTimerGraph::WindFore(size_t first)
 {
 	m_first = first;
@@ -942,6 +965,7 @@ void NkDigTimerGraph::Start(bool on)
 		m_timer.Stop();
 		return;
 	}
+	if (m_worker) m_worker->Cancel();
 	if(m_adcBits != 8) m_readerWord.Reset();
 	else m_readerByte.Reset();
 	size_t period = m_last - m_first;
@@ -1016,6 +1040,11 @@ void NkDigTimerGraph::SetTriggerChannel(size_t channel)
 	m_triggerChannel = channel;
 }
 
+void NkDigTimerGraph::SetTrigger(scopeTrigger* trigger)
+{
+	m_trigger = trigger;
+}
+
 void NkDigTimerGraph::SetTriggerMode(NkDigTimerGraph::ETriggerMode mode)
 {
 	m_frozen = false;
@@ -1035,3 +1064,196 @@ void NkDigTimerGraph::Move(double amount)
 	Refresh(false);
 }
 
+// show timestamp at the first division of the window
+void NkDigTimerGraph::GoTo(size_t timestamp)
+{
+	m_frozen = true;
+	size_t division = m_period / 10;
+	WindTo(timestamp > division ? timestamp - division : 0);
+	Refresh(false);
+}
+
+// build the edge index of a channel of a recording that was not recorded in this window
+void NkDigTimerGraph::ScanEdges(scopeEdges& edges, size_t channel)
+{
+	if (m_adcBits != 8) ScanEdgesImpl<word>(m_readerWord, edges, channel);
+	else ScanEdgesImpl<byte>(m_readerByte, edges, channel);
+}
+
+template <typename T>
+void NkDigTimerGraph::ScanEdgesImpl(scopeReader<T>& reader, scopeEdges& edges, size_t channel)
+{
+	// only the samples of the channel: of a columnar recording only its column is read
+	std::vector<bool> channels(channel + 1, false);
+	channels[channel] = true;
+	reader.SetChannels(channels);
+	edges.Restart(channel);
+	for (fileSample<T>* sample = reader.First(0); sample; sample = reader.Next())
+	{
+		edges.Add(sample->channel, sample->state, sample->timestamp);
+	}
+	edges.SetComplete(channel);
+	reader.SetChannels(std::vector<bool>());
+}
+
+
+// on the GUI thread: the render worker finished a frame
+void NkDigTimerGraph::OnFrame()
+{
+	if (!m_worker) return;
+	{
+		wxCriticalSectionLocker lock(m_worker->m_lock);
+		if (m_worker->m_frameGeneration != m_renderJob) return; // the window changed
+	}
+	m_drawFrame = true;
+	Refresh(false);
+}
+
+NkDigTimerGraphWorker::NkDigTimerGraphWorker(NkDigTimerGraph* graph)
+	: wxThread(wxTHREAD_JOINABLE)
+	, m_graph(graph)
+	, m_generation(0)
+	, m_stop(false)
+	, m_running(false)
+	, m_pending(false)
+	, m_jobGeneration(0)
+	, m_frameGeneration(0)
+	, m_adcBits(8)
+{
+	m_event = CreateEvent(NULL, FALSE, FALSE, NULL);
+}
+
+NkDigTimerGraphWorker::~NkDigTimerGraphWorker()
+{
+	Stop();
+	if (m_event) CloseHandle(m_event);
+}
+
+bool NkDigTimerGraphWorker::Start()
+{
+	m_running = m_event && (Create() == wxTHREAD_NO_ERROR) && (Run() == wxTHREAD_NO_ERROR);
+	return m_running;
+}
+
+void NkDigTimerGraphWorker::Stop()
+{
+	if (!m_running) return;
+	++m_generation;
+	m_stop = true;
+	SetEvent(m_event);
+	Wait();
+	m_running = false;
+}
+
+// the readers are changed when the worker does not trace
+void NkDigTimerGraphWorker::SetFile(HANDLE file, size_t lastsample, long adcBits, size_t dataOffset)
+{
+	Cancel();
+	wxCriticalSectionLocker lock(m_readerLock);
+	m_adcBits = adcBits;
+	if (m_adcBits != 8) m_readerWord.SetFile(file, lastsample, dataOffset);
+	else m_readerByte.SetFile(file, lastsample, dataOffset);
+}
+
+void NkDigTimerGraphWorker::SetLastSample(size_t lastsample)
+{
+	Cancel();
+	wxCriticalSectionLocker lock(m_readerLock);
+	if (m_adcBits != 8) m_readerWord.SetLastSample(lastsample);
+	else m_readerByte.SetLastSample(lastsample);
+}
+
+void NkDigTimerGraphWorker::SetIndex(const scopeIndex& index)
+{
+	Cancel();
+	wxCriticalSectionLocker lock(m_readerLock);
+	if (m_adcBits != 8) m_readerWord.SetIndex(index);
+	else m_readerByte.SetIndex(index);
+}
+
+void NkDigTimerGraphWorker::SetChunks(const scopeChunkIndex& chunks)
+{
+	Cancel();
+	wxCriticalSectionLocker lock(m_readerLock);
+	if (m_adcBits != 8) m_readerWord.SetChunks(chunks);
+	else m_readerByte.SetChunks(chunks);
+}
+
+// posts the window of trace; returns its job, see OnFrame
+size_t NkDigTimerGraphWorker::Render(const NkDigTimerGraph::CTrace& trace)
+{
+	wxCriticalSectionLocker lock(m_lock);
+	m_job = trace;
+	m_jobLines = *trace.lines;
+	m_jobGeneration = ++m_generation;
+	m_pending = true;
+	SetEvent(m_event);
+	return m_jobGeneration;
+}
+
+void NkDigTimerGraphWorker::Cancel()
+{
+	wxCriticalSectionLocker lock(m_lock);
+	++m_generation;
+	m_pending = false;
+}
+
+void NkDigTimerGraphWorker::PaintFrame(HDC hdc, size_t job)
+{
+	wxCriticalSectionLocker lock(m_lock);
+	if ((m_frameGeneration != job) || m_frame.counts.empty()) return;
+	PolyPolyline(hdc, &m_frame.points[0], &m_frame.counts[0], DWORD(m_frame.counts.size()));
+}
+
+void* NkDigTimerGraphWorker::Entry()
+{
+	while (!m_stop)
+	{
+		WaitForSingleObject(m_event, 100);
+		NkDigTimerGraph::CTrace trace;
+		NkDigTimerGraph::CPinLines lines;
+		size_t job;
+		{
+			wxCriticalSectionLocker lock(m_lock);
+			if (!m_pending) continue;
+			m_pending = false;
+			trace = m_job;
+			lines = m_jobLines;
+			job = m_jobGeneration;
+		}
+		trace.lines = &lines;
+		NkDigTimerGraph::CPolySink sink;
+		bool done;
+		{
+			wxCriticalSectionLocker lock(m_readerLock);
+			if (m_adcBits != 8) done = RenderImpl<word>(m_readerWord, trace, sink, job);
+			else done = RenderImpl<byte>(m_readerByte, trace, sink, job);
+		}
+		if (!done) continue;
+		sink.Trim();
+		{
+			wxCriticalSectionLocker lock(m_lock);
+			if (job != m_generation) continue;
+			std::swap(m_frame, sink);
+			m_frameGeneration = job;
+		}
+		m_graph->CallAfter(&NkDigTimerGraph::OnFrame);
+	}
+	return NULL;
+}
+
+template <typename T>
+bool NkDigTimerGraphWorker::RenderImpl(scopeReader<T>& reader, NkDigTimerGraph::CTrace& trace, NkDigTimerGraph::CPolySink& sink, size_t job)
+{
+	if (reader.m_index.size() || reader.IsChunked())
+	{
+		trace.current = NkDigTimerGraph::Rewind(reader, *trace.lines, trace.first, trace.current);
+	}
+	else
+	{
+		// without seek index: read from the start, the lines get their state on the way
+		reader.Reset();
+		trace.lines->reset();
+	}
+	return NkDigTimerGraph::Trace(reader, trace, sink, &m_generation, job);
+}
@@ -10,6 +10,7 @@ typedef void (wxEvtHandler::* NkDigTimerGraphEventFunction)(NkDigTimerGraphEvent
  	wx__DECLARE_EVT1(NKDIGTIMERGRAPHEVENT, id, NkDigTimerGraphEventHandler(func))
 
 class NkDigTimerGraph;
+struct SItems;
 
 class NkDigTimerGraphEvent : public wxCommandEvent
 {
@@ -40,11 +41,12 @@ public:
 #define US_PER_DAY (24ULL * US_PER_HOUR)
 
 class frameMain;
+class NkDigTimerGraphWorker;
 
 class NkDigTimerGraph : public wxPanel
 {
 public:
-    NkDigTimerGraph() { }
+    NkDigTimerGraph() : m_worker(NULL) { }
 
     NkDigTimerGraph(wxWindow* parent,
         wxWindowID winid = wxID_ANY,
@@ -56,6 +58,8 @@ public:
         Create(parent, winid, pos, size, style, name);
     }
 
+    ~NkDigTimerGraph();
+
 	bool Create(wxWindow* parent,
 		wxWindowID winid,
 		const wxPoint& pos = wxDefaultPosition,
@@ -63,8 +67,11 @@ public:
 		long style = wxScrolledWindowStyle,
 		const wxString& name = wxASCII_STR(wxPanelNameStr));
 
-	void Init(frameMain* main, HANDLE file, size_t lastsample, long adcBits);
+	void Init(frameMain* main, HANDLE file, size_t lastsample, long adcBits, size_t dataOffset = 0, SItems* pins = NULL);
 	void SetLastSample(size_t lastsample);
+	void SetIndex(const scopeIndex& index);
+	void SetChunks(const scopeChunkIndex& chunks);
+	void SetLod(const scopeLod* lod);
 	void Reset();
 	void Start(bool on);
 	void SetPeriod(size_t period, bool keep_center);
@@ -74,9 +81,13 @@ public:
 	enum ETriggerPolarity{ triggerDown, triggerUp};
 	void SetTriggerPolarity(ETriggerPolarity polarity);
 	void SetTriggerChannel(size_t channel);
+	void SetTrigger(scopeTrigger* trigger);
 	enum ETriggerMode { modeAuto, modeNormal, modeSingle};
 	void SetTriggerMode(ETriggerMode mode);
 	void Move(double amount);
+	void GoTo(size_t timestamp);
+	void ScanEdges(scopeEdges& edges, size_t channel);
+	template <typename T> void ScanEdgesImpl(scopeReader<T>& reader, scopeEdges& edges, size_t channel);
 	void WindTo(size_t first);
 	void WindBack(size_t first);
 	template <typename T> void WindBackImpl(size_t first, scopeReader<T> & m_reader);
@@ -85,8 +96,13 @@ public:
 	void OnSize(wxSizeEvent& event);
 	void OnPaint(wxPaintEvent& WXUNUSED(evt));
 	template <typename T> void OnPaintImpl(scopeReader<T> & m_reader);
+	bool PaintLod(HDC hdc, long adcScale);
+	bool Scrolling() const;
+	void ScrollGraph(wxDC& dc, int pixels);
+	void DrawScrollScale(HDC hdc);
 	void OnTimer(wxTimerEvent& event);
 	template <typename T> void OnTimerImpl(scopeReader<T>& m_reader);
+	void OnFrame();
 
 	enum { NOT_INITIALIZED = 0xFFFF };
 
@@ -113,7 +129,65 @@ public:
 		}
 	};
 
+	// the state of tracing the samples of a window: of the graph for the live recording,
+	// a copy for the render worker
+	class CTrace
+	{
+	public:
+		CPinLines* lines;
+		size_t     first;
+		size_t     last;
+		size_t     current;
+		double     hscale;   // pixels per timestamp unit
+		int        left;     // of the graph area
+		long       adcScale;
+		size_t     until;    // stop reading after this timestamp, 0: read all samples
+	};
+
+	class CGdiSink
+	{
+	public:
+		HDC hdc;
+		void MoveTo(int x, int y) { MoveToEx(hdc, x, y, NULL); }
+		void LineTo(int x, int y) { ::LineTo(hdc, x, y); }
+	};
+
+	// the traced lines of the render worker, drawn by PolyPolyline
+	class CPolySink
+	{
+	public:
+		std::vector<POINT> points;
+		std::vector<DWORD> counts;
+		void MoveTo(int x, int y)
+		{
+			Trim();
+			POINT p = { x, y };
+			points.push_back(p);
+			counts.push_back(1);
+		}
+		void LineTo(int x, int y)
+		{
+			if (counts.empty()) counts.push_back(0);
+			POINT p = { x, y };
+			points.push_back(p);
+			++counts.back();
+		}
+		// drop a last polyline without segment
+		void Trim()
+		{
+			if (counts.size() && (counts.back() < 2))
+			{
+				points.resize(points.size() - counts.back());
+				counts.pop_back();
+			}
+		}
+	};
+
+	template <typename T, typename S> static bool Trace(scopeReader<T>& reader, CTrace& trace, S& sink, const std::atomic<size_t>* generation = NULL, size_t job = 0);
+	template <typename T> static size_t Rewind(scopeReader<T>& reader, CPinLines& lines, size_t first, size_t current);
+
 	frameMain*     m_main;
+	SItems*        m_pins;    // the channels: the pins of m_main or of a recording of several devices
 	wxSize         m_wndSize;
     wxBitmap       m_bitmap;
 	wxRect         m_graph;
@@ -133,6 +207,7 @@ public:
 	bool             m_armed; // waiting for a trigger
 	bool             m_triggered; // trigger seen
 	size_t           m_triggerChannel;
+	scopeTrigger*    m_trigger; // compound trigger: replaces the trigger channel when set
 	ETriggerMode     m_triggerMode;
 	size_t           m_triggerDelay;
 	size_t           m_triggerTimeout;
@@ -140,12 +215,63 @@ public:
 	bool             m_drawGrid;
 	CPinLines        m_lines;
 
+	// live mode without trigger: the graph scrolls with the data (see ScrollGraph)
+	int              m_scrollBy;    // pixels to shift at the next paint
+	size_t           m_scrolled;    // pixels shifted since the last full redraw
+	size_t           m_scrollFirst; // m_first at the last full redraw: the grid lines are at m_period / 10 from it
+	size_t           m_origin;      // first timestamp of the recording: the scale counts from it
+
 	long              m_adcBits;
 	scopeReader<byte> m_readerByte;
 	scopeReader<word> m_readerWord;
+	const scopeLod*   m_lod;        // pyramid of a finished recording (owned by the scope panel)
+	bool              m_lodPainted; // the current range is painted from the pyramid
+	NkDigTimerGraphWorker* m_worker; // traces the windows of a recording that is not live
+	size_t            m_renderJob;  // of the current window
+	bool              m_drawFrame;  // the worker finished m_renderJob
 
 private:
     wxDECLARE_EVENT_TABLE();
 
 };
 
+// traces the samples of a window off the GUI thread, so a window of a large recording does
+// not block the user interface. the graph posts the trace state of a window with Render;
+// the worker reads the samples with its own reader into polylines and calls OnFrame on the
+// GUI thread, which draws them with PaintFrame. a new window cancels the running job.
+class NkDigTimerGraphWorker : public wxThread
+{
+public:
+	NkDigTimerGraphWorker(NkDigTimerGraph* graph);
+	~NkDigTimerGraphWorker();
+
+	bool Start();
+	void Stop();
+	void SetFile(HANDLE file, size_t lastsample, long adcBits, size_t dataOffset);
+	void SetLastSample(size_t lastsample);
+	void SetIndex(const scopeIndex& index);
+	void SetChunks(const scopeChunkIndex& chunks);
+	size_t Render(const NkDigTimerGraph::CTrace& trace);
+	void Cancel();
+	void PaintFrame(HDC hdc, size_t job);
+	void* Entry();
+	template <typename T> bool RenderImpl(scopeReader<T>& reader, NkDigTimerGraph::CTrace& trace, NkDigTimerGraph::CPolySink& sink, size_t job);
+
+	NkDigTimerGraph*    m_graph;
+	HANDLE              m_event;      // set when a job is posted
+	std::atomic<size_t> m_generation; // of the last job: a running job of another generation stops
+	std::atomic<bool>   m_stop;
+	bool                m_running;
+	wxCriticalSection   m_lock;       // the job and the frame
+	bool                m_pending;
+	NkDigTimerGraph::CTrace    m_job;
+	NkDigTimerGraph::CPinLines m_jobLines;
+	size_t              m_jobGeneration;
+	NkDigTimerGraph::CPolySink m_frame;
+	size_t              m_frameGeneration;
+	wxCriticalSection   m_readerLock; // the readers: held while tracing
+	long                m_adcBits;
+	scopeReader<byte>   m_readerByte;
+	scopeReader<word>   m_readerWord;
+};
+
@@ -0,0 +1,218 @@
+#pragma once
+
+// allocation-free tokenizer of the lines of the device, used instead of regular expressions:
+//   state changes (pushed or polled):  'p <pin> <state>' and 't <task> <state>'
+//   field definitions of 'dpin ?' and 'dtask ?':
+//     '  <name>: [lower to higher]'  a range
+//     '  <name>: (a|b|c)'            an enum
+//     '  <name>: text [size]'        a string
+//     '  <name>: <mode> [lower to higher] (a|b) <mode> ...'  a range or enum per mode
+//   item definitions: tab separated values, optionally between quotes
+// the tokens point into the line; only the values that are kept are copied.
+
+// a range of the line, not terminated
+struct deviceToken
+{
+	const wchar_t* p;
+	size_t         n;
+
+	wxString str() const { return wxString(p, n); }
+
+	// without the surrounding white space
+	deviceToken Trim() const
+	{
+		deviceToken t = *this;
+		while (t.n && iswspace(t.p[0])) { ++t.p; --t.n; }
+		while (t.n && iswspace(t.p[t.n - 1])) --t.n;
+		return t;
+	}
+
+	// the text between the first and the last quote
+	bool Quoted(deviceToken& inner) const
+	{
+		const wchar_t* first = wmemchr(p, L'\'', n);
+		if (!first) return false;
+		const wchar_t* last = p + n - 1;
+		while (*last != L'\'') --last;
+		if (last == first) return false;
+		inner.p = first + 1;
+		inner.n = last - first - 1;
+		return true;
+	}
+};
+
+class deviceTokenizer
+{
+public:
+	deviceTokenizer(const wchar_t* line)
+	: m_p(line)
+	, m_end(line + wcslen(line))
+	, m_split(true)
+	{}
+
+	deviceTokenizer(const wchar_t* begin, const wchar_t* end)
+	: m_p(begin)
+	, m_end(end)
+	, m_split(true)
+	{}
+
+	bool End() const { return m_p >= m_end; }
+	wchar_t Peek() const { return (m_p < m_end) ? *m_p : 0; }
+
+	// true when at least one space is skipped
+	bool Spaces()
+	{
+		const wchar_t* p = m_p;
+		while ((m_p < m_end) && (*m_p == L' ')) ++m_p;
+		return m_p != p;
+	}
+
+	bool Char(wchar_t c)
+	{
+		if ((m_p >= m_end) || (*m_p != c)) return false;
+		++m_p;
+		return true;
+	}
+
+	bool Word(const wchar_t* word)
+	{
+		const wchar_t* p = m_p;
+		for (; *word; ++word, ++p)
+		{
+			if ((p >= m_end) || (*p != *word)) return false;
+		}
+		m_p = p;
+		return true;
+	}
+
+	// decimal digits
+	bool Unsigned(uint64_t& value)
+	{
+		const wchar_t* p = m_p;
+		uint64_t v = 0;
+		while ((p < m_end) && (*p >= L'0') && (*p <= L'9')) v = v * 10 + (*p++ - L'0');
+		if (p == m_p) return false;
+		value = v;
+		m_p = p;
+		return true;
+	}
+
+	// decimal digits with an optional minus sign
+	bool Number(int64_t& value)
+	{
+		const wchar_t* p = m_p;
+		bool negative = Char(L'-');
+		uint64_t v;
+		if (!Unsigned(v))
+		{
+			m_p = p;
+			return false;
+		}
+		value = negative ? -int64_t(v) : int64_t(v);
+		return true;
+	}
+
+	// the text up to the first c, which is skipped. the position does not change without c.
+	bool Until(wchar_t c, deviceToken& token)
+	{
+		const wchar_t* p = m_p;
+		while ((p < m_end) && (*p != c)) ++p;
+		if (p >= m_end) return false;
+		token.p = m_p;
+		token.n = p - m_p;
+		m_p = p + 1;
+		return true;
+	}
+
+	// the text up to the last c of the line, which is skipped
+	bool UntilLast(wchar_t c, deviceToken& token)
+	{
+		const wchar_t* p = m_end;
+		while ((p > m_p) && (p[-1] != c)) --p;
+		if (p == m_p) return false;
+		token.p = m_p;
+		token.n = p - 1 - m_p;
+		m_p = p;
+		return true;
+	}
+
+	// moves to the next c, skipping it
+	bool Find(wchar_t c)
+	{
+		const wchar_t* p = m_p;
+		while ((p < m_end) && (*p != c)) ++p;
+		if (p >= m_end) return false;
+		m_p = p + 1;
+		return true;
+	}
+
+	// the next of the fields separated by c, as wxSplit: a line ending with c has an empty last field
+	bool Split(wchar_t c, deviceToken& token)
+	{
+		if (!m_split) return false;
+		if (!Until(c, token))
+		{
+			token.p = m_p;
+			token.n = m_end - m_p;
+			m_p = m_end;
+			m_split = false;
+		}
+		return true;
+	}
+
+	// '[lower to higher]'
+	bool Range(int64_t& lower, int64_t& higher)
+	{
+		deviceTokenizer t = *this;
+		int64_t l;
+		uint64_t h;
+		if (!t.Char(L'[') || !t.Number(l) || !t.Spaces() || !t.Word(L"to") || !t.Spaces() || !t.Unsigned(h) || !t.Char(L']')) return false;
+		lower = l;
+		higher = int64_t(h);
+		*this = t;
+		return true;
+	}
+
+	// '(a|b|c)': the text up to the last ')'
+	bool Enum(deviceToken& values)
+	{
+		deviceTokenizer t = *this;
+		if (!t.Char(L'(') || !t.UntilLast(L')', values) || !values.n) return false;
+		*this = t;
+		return true;
+	}
+
+	const wchar_t* m_p;
+	const wchar_t* m_end;
+	bool           m_split; // Split has fields left
+};
+
+// the first '<kind> <index> <state>' in the line: 'p' for a pin, 't' for a task. the index starts at 1.
+inline bool deviceParseState(const wchar_t* line, wchar_t kind, size_t& index, int64_t& state)
+{
+	deviceTokenizer t(line);
+	while (t.Find(kind))
+	{
+		deviceTokenizer s = t;
+		uint64_t i;
+		uint64_t v;
+		if (s.Char(L' ') && s.Unsigned(i) && s.Char(L' ') && s.Unsigned(v))
+		{
+			index = size_t(i);
+			state = int64_t(v);
+			return true;
+		}
+	}
+	return false;
+}
+
+// the values of an enum separated by '|'
+inline void deviceSplit(const deviceToken& token, wxArrayString& values)
+{
+	deviceTokenizer t(token.p, token.p + token.n);
+	deviceToken value;
+	while (t.Split(L'|', value))
+	{
+		values.push_back(value.str());
+	}
+}
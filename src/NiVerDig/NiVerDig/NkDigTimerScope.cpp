@@ -1,9 +1,15 @@
 #include "framework.h"
+#include <compressapi.h>
+#pragma comment(lib, "Cabinet.lib")
+#include "../nkbef/nkbef.h"
+#include "../nkbef/nkbefMeasure.h"
 
 class panelScope;
 wxString FormatPeriod(size_t period);
 size_t GetPeriod(long index);
 size_t FindPeriod(size_t timer);
+wxString FormatDuration(size_t duration);
+bool ParseDuration(const wxString& text, size_t& duration);
 
 #define SYNC_CHANNEL -1   // -1: data entry for sync
 #define SYNC_END     0xFF // -1: end of scope mode
@@ -84,6 +90,17 @@ size_t GetCurrentFileTime()
 	return ull;
 }
 
+// for the clock synchronisation: GetSystemTime has a resolution of 1 ms or worse
+size_t GetPreciseFileTime()
+{
+	FILETIME ft;
+	GetSystemTimePreciseAsFileTime(&ft);
+	size_t ull;
+	((unsigned long*)&ull)[0] = ft.dwLowDateTime;
+	((unsigned long*)&ull)[1] = ft.dwHighDateTime;
+	return ull;
+}
+
 wxString FormatLocalFileTime(size_t t)
 {
 	FILETIME ft;
@@ -118,6 +135,34 @@ wxString LogFormatLocalFileTimeUs(size_t t)
 	return wxString::Format(wxT("%04d-%02d-%02d %02d:%02d:%02d.%06lld"), st.wYear, st.wMonth, st.wDay, st.wHour, st.wMinute, st.wSecond, us);
 }
 
+// returns the compressed size or 0 when the data does not fit in packed_size
+size_t ScopeCompress(const void* raw, size_t raw_size, void* packed, size_t packed_size)
+{
+	COMPRESSOR_HANDLE compressor = NULL;
+	if (!CreateCompressor(COMPRESS_ALGORITHM_XPRESS | COMPRESS_RAW, NULL, &compressor)) return 0;
+	SIZE_T size = 0;
+	BOOL ok = Compress(compressor, raw, raw_size, packed, packed_size, &size);
+	CloseCompressor(compressor);
+	return ok ? size : 0;
+}
+
+// the portable decoder of the nkbef reader, so the viewer and the nkbef tool read the same data
+bool ScopeDecompress(const void* packed, size_t packed_size, void* raw, size_t raw_size)
+{
+	return nkbefXpressDecompress((const unsigned char*)packed, packed_size, (unsigned char*)raw, raw_size);
+}
+
+// another NiVerDig that records with the one of the main window, see panelScope::OpenDevices
+struct scopeDevice
+{
+	wxString   name;    // the port
+	NKCOMPORT* port;
+	SItems     pins;
+	size_t     channel; // of its first pin in the recording
+	scopeClock clock;   // device to host time
+	threadScopeBase* thread;
+};
+
 class panelScope : public formScope, public nkDigTimPanel
 {
 public:
@@ -131,8 +176,15 @@ public:
 	, m_format(FORMAT_BINARY)
 	, m_mode(mode) 
 	, m_lastsample(0)
+	, m_dataBits(8)
+	, m_dataOffset(0)
+	, m_startTime(0)
 	, m_data(INVALID_HANDLE_VALUE)
 	, m_isTempData(true)
+	, m_find(scopeEdges::findNextEdge)
+	, m_findWidth(10000) // 1 ms
+	, m_findFirst(0)
+	, m_findTime(SCOPE_EDGE_NONE)
 	{
 		m_data_name[0] = 0;
 		if (m_mode == MODE_VIEW)
@@ -141,14 +193,15 @@ public:
 			m_tool->EnableTool(ID_TOOLADCRES, false);
 		}
 		if (m_mode == MODE_RECORD) m_save = true;
+		m_profilePrefix.Format(wxT("%s/Scope/"), m_main->m_portName);
+		if (m_mode != MODE_VIEW) OpenDevices();
 		OpenDataFile(file);
 
-		if (m_main->m_pins.items.size() && (m_main->m_pins.items[0].values.size() > 1))
+		if (Pins().items.size() && (Pins().items[0].values.size() > 1))
 		{
-			m_tool->SetToolLabel(ID_TOOLCHANNEL, m_main->m_pins.items[0].values[1]);
+			m_tool->SetToolLabel(ID_TOOLCHANNEL, Pins().items[0].values[1]);
 		}
 
-		m_profilePrefix.Format(wxT("%s/Scope/"), m_main->m_portName);
 		if (m_mode == MODE_RECORD)
 		{
 			m_main->m_profile->Read(m_profilePrefix + wxT("AdcRes"), &m_adcResolution);
@@ -161,14 +214,22 @@ public:
 		m_tool->ToggleTool(ID_TOOLTRIGGER, m_graph->m_triggerOn);
 		long channel = 0;
 		m_main->m_profile->Read(m_profilePrefix + wxT("Channel"), &channel);
-		if (channel < m_main->m_pins.items.size())
+		if (channel < Pins().items.size())
 		{
 			m_graph->SetTriggerChannel(channel);
-			if (m_main->m_pins.items[channel].values.size() > 1)
+			if (Pins().items[channel].values.size() > 1)
 			{
-				m_tool->SetToolLabel(ID_TOOLCHANNEL, m_main->m_pins.items[channel].values[1]);
+				m_tool->SetToolLabel(ID_TOOLCHANNEL, Pins().items[channel].values[1]);
 			}
 		}
+		wxString expression;
+		m_main->m_profile->Read(m_profilePrefix + wxT("TriggerExpression"), &expression);
+		wxString error;
+		if (expression.length() && m_trigger.Compile(expression, Pins(), error))
+		{
+			SetTriggerExpression();
+		}
+		m_graph->SetTrigger(&m_trigger);
 		m_main->m_profile->Read(m_profilePrefix + wxT("Polarity"), (long*)&m_graph->m_triggerPolarity);
 		m_tool->SetToolBitmap(ID_TOOLPOLARITY, wxBitmap(m_graph->m_triggerPolarity ? wxT("res/TriggerUp.png"): wxT("res/TriggerDown.png"), wxBITMAP_TYPE_PNG));
 		m_tool->SetToolShortHelp(ID_TOOLPOLARITY, m_graph->m_triggerPolarity ? wxT("trigger up"): wxT("trigger down"));
@@ -176,6 +237,8 @@ public:
 		m_tool->SetToolLabel(ID_TOOLMODE, m_graph->m_triggerMode == 0 ? wxT("Auto") : m_graph->m_triggerMode == 1 ? wxT("Normal"): wxT("Single"));
 
 		m_main->m_profile->Read(wxT("Format"), (long*)&m_format);
+		long width = (long)m_findWidth;
+		if (m_main->m_profile->Read(m_profilePrefix + wxT("FindWidth"), &width) && (width > 0)) m_findWidth = width;
 
 		m_tool->Realize();
 
@@ -198,6 +261,65 @@ public:
 	~panelScope()
 	{
 		CloseDataFile();
+		for (auto& device : m_devices)
+		{
+			NkComPort_Close(&device.port);
+		}
+	}
+
+	// the pins of the recording
+	SItems& Pins()
+	{
+		return m_devices.size() ? m_devicePins : m_main->m_pins;
+	}
+
+	// the other devices to record from: the ports in the profile entry <port>/Scope/Devices, separated by ';'.
+	// the samples of all devices are mapped to host time and merged into one file (see scopeMerge).
+	void OpenDevices()
+	{
+		wxString list;
+		if (!m_main->m_profile->Read(m_profilePrefix + wxT("Devices"), &list)) return;
+		size_t channels = m_main->m_pins.items.size();
+		wxStringTokenizer ports(list, wxT(";, "), wxTOKEN_STRTOK);
+		while (ports.HasMoreTokens())
+		{
+			scopeDevice device;
+			device.name = ports.GetNextToken();
+			if (device.name == m_main->m_portName) continue;
+			device.port = m_main->OpenDevice(device.name, device.pins);
+			if (!device.port)
+			{
+				m_main->SetStatus(wxT("could not open ") + device.name);
+				continue;
+			}
+			// the channel is a char and the tick events use its bitwise not
+			if (channels + device.pins.items.size() > 128)
+			{
+				m_main->SetStatus(wxString::Format(wxT("%s not recorded: more than 128 channels"), device.name));
+				NkComPort_Close(&device.port);
+				continue;
+			}
+			device.channel = channels;
+			device.thread = NULL;
+			channels += device.pins.items.size();
+			m_devices.push_back(device);
+		}
+	}
+
+	// the pins of the main window followed by those of the devices, prefixed with their port
+	void MergePins()
+	{
+		m_devicePins = m_main->m_pins;
+		for (auto& device : m_devices)
+		{
+			device.channel = m_devicePins.items.size();
+			for (const SItem& pin : device.pins.items)
+			{
+				m_devicePins.items.push_back(pin);
+				SItem& item = m_devicePins.items.back();
+				if (item.values.size() > 1) item.values[1] = device.name + wxT(":") + item.values[1];
+			}
+		}
 	}
 
 	void OpenDataFile(wxString file)
@@ -206,6 +328,10 @@ public:
 		{
 			CloseDataFile();
 		}
+		m_clock.Reset(0);
+		m_edges.clear();
+		m_trigger.Restart();
+		m_findTime = SCOPE_EDGE_NONE;
 		if (m_mode != MODE_VIEW)
 		{
 			if(!m_save || !file.length())
@@ -226,10 +352,24 @@ public:
 			}
 			m_data = CreateFile(m_data_name, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_TEMPORARY, NULL);
 			m_lastsample = 0;
-			m_main->m_pins.dataBits = m_adcResolution ? m_main->m_adc_res : 8;
+			m_index.clear();
+			m_chunks.clear();
+			m_lod.clear();
+			if (m_devices.size()) MergePins();
+			m_dataBits = m_adcResolution ? m_main->m_adc_res : 8;
+			m_dataOffset = SCOPE_HEADER_SIZE;
+			m_startTime = GetCurrentFileTime();
+			if (m_data != INVALID_HANDLE_VALUE)
+			{
+				WriteFileHeader(m_data, 0);
+			}
 			if (!m_isTempData)
 			{
 				m_filename = m_data_name;
+				if (m_data != INVALID_HANDLE_VALUE)
+				{
+					m_journal.Create(m_data_name, m_data, PinInfo(), m_dataBits);
+				}
 			}
 		}
 		else
@@ -237,22 +377,33 @@ public:
 			wcscpy_s(m_data_name, _MAX_FNAME, file);
 			// if the file is blocked for writing, this is a recording in progress, so enable the timer to check for new data
 			m_data = CreateFile(m_data_name, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
-			m_tool->ToggleTool(ID_TOOLON, m_data == INVALID_HANDLE_VALUE);
+			bool recording = m_data == INVALID_HANDLE_VALUE;
+			m_tool->ToggleTool(ID_TOOLON, recording);
 			CloseHandle(m_data);
 			m_data = CreateFile(m_data_name, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
-			m_main->m_pins.LoadFromFile(m_data, m_lastsample);
-			m_adcResolution = m_main->m_pins.dataBits != 8;
-			m_tool->SetToolLabel(ID_TOOLADCRES, wxString::Format(wxT("%ld-bit"), m_main->m_pins.dataBits));
+			Pins().LoadFromFile(m_data, m_lastsample, &m_index, &m_chunks, &m_lod, &m_edges);
+			m_dataBits = Pins().dataBits;
+			m_dataOffset = Pins().dataOffset;
+			m_startTime = Pins().startTime;
+			// a file that is still growing ends at its size, not at the last checkpoint
+			if (recording) m_lastsample = 0;
+			m_adcResolution = m_dataBits != 8;
+			m_tool->SetToolLabel(ID_TOOLADCRES, wxString::Format(wxT("%ld-bit"), m_dataBits));
 		}
 		if (m_data == INVALID_HANDLE_VALUE)
 		{
 			wxMessageBox(wxString::Format(wxT("Error %s opening file %s"), wxSysErrorMsg(), m_data_name),wxMessageBoxCaptionStr, wxICON_ERROR | wxOK);
 		}
-		m_graph->Init(m_main,m_data,m_lastsample, m_main->m_pins.dataBits);
+		m_graph->Init(m_main,m_data,m_lastsample, m_dataBits, m_dataOffset, &Pins());
+		m_graph->SetIndex(m_index);
+		m_graph->SetChunks(m_chunks);
+		m_graph->SetLod(m_mode == MODE_VIEW ? &m_lod : NULL);
 	}
 
 	void CloseDataFile()
 	{
+		// a journal left behind here belongs to a recording that did not stop normally
+		m_journal.Close(false);
 		CloseHandle(m_data);
 		m_data = INVALID_HANDLE_VALUE;
 		if ((m_mode == MODE_RECORD) && m_isTempData)
@@ -290,8 +441,9 @@ public:
 		if (record)
 		{
 			m_graph->Reset();
-			size_t pos = 0;
+			m_writerStats.clear();
 			OpenDataFile(m_save && (m_format == FORMAT_BINARY) ? m_filename  : wxString(""));
+			size_t pos = m_dataOffset; // keep the header written by OpenDataFile
 			SetFilePointerEx(m_data, *(LARGE_INTEGER*)&pos, NULL, FILE_BEGIN);
 			SetEndOfFile(m_data);
 		}
@@ -313,6 +465,7 @@ public:
 		else
 		{
 			SetStatus(wxString(""));
+			m_graph->SetLod(&m_lod);
 			if (m_save && m_filename.length())
 			{
 				if (wcscmp(m_data_name, m_filename))
@@ -324,9 +477,19 @@ public:
 				{
 					SaveFileInfo(m_data, &m_lastsample);
 					m_graph->SetLastSample(m_lastsample);
+					m_graph->SetIndex(m_index);
 				}
 			}
-			m_main->SetStatus(wxT("scope mode stopped"));
+			m_journal.Close(true);
+			if (m_writerStats.stalls || m_writerStats.errors)
+			{
+				m_main->SetStatus(wxString::Format(wxT("scope mode stopped: the disk fell behind %lld times (max %lld MB queued, slowest write %lld ms), %lld write errors"),
+					(long long)m_writerStats.stalls, (long long)(m_writerStats.maxPending >> 20), (long long)m_writerStats.maxLatency, (long long)m_writerStats.errors));
+			}
+			else
+			{
+				m_main->SetStatus(wxT("scope mode stopped"));
+			}
 		}
 	}
 
@@ -389,6 +552,11 @@ public:
 	template <typename T>
 	void ZoomAll()
 	{
+		if (m_chunks.size())
+		{
+			SetRange(m_chunks.front().first, m_chunks.back().last);
+			return;
+		}
 		// read the first and the last timestamp in the file.
 		// to prevent interfering with the recording, duplicate the handle
 		size_t size = 0;
@@ -400,7 +568,8 @@ public:
 		{
 			GetFileSizeEx(m_data, (LARGE_INTEGER*)&size);
 		}
-		size_t count = size / sizeof(fileSample<T>);
+		size_t base = m_dataOffset;
+		size_t count = (size > base) ? (size - base) / sizeof(fileSample<T>) : 0;
 		if (count < 1) return;
 		HANDLE h = INVALID_HANDLE_VALUE;
 		DuplicateHandle(GetCurrentProcess(), m_data, GetCurrentProcess(), &h, GENERIC_READ, FALSE, 0);
@@ -409,28 +578,33 @@ public:
 		DWORD read;
 		while(1)
 		{ 
-			size_t pos = 0;
+			size_t pos = base;
 			SetFilePointerEx(h, *(LARGE_INTEGER*)&pos, NULL, FILE_BEGIN);
 			if (!ReadFile(h, &first, sizeof(first), &read, NULL) || (read != sizeof(first))) break;
 			if (count > 1)
 			{
-				pos = (count - 1) * sizeof(fileSample<T>);
+				pos = base + (count - 1) * sizeof(fileSample<T>);
 				SetFilePointerEx(h, *(LARGE_INTEGER*)&pos, NULL, FILE_BEGIN);
 				if (!ReadFile(h, &last, sizeof(last), &read, NULL) || (read != sizeof(first))) break;
 			}
-			size_t period = (last.timestamp - first.timestamp);
-			m_periodIndex = FindPeriod(period);
-			STimeRes* t = timeRes + m_periodIndex;
-			m_tool->SetToolLabel(ID_TOOLPERIOD, t->label);
-			m_graph->SetRange(first.timestamp, first.timestamp + t->period);
-			m_tool->ToggleTool(ID_TOOLARM, !m_graph->m_frozen);
-			m_tool->Realize();
+			SetRange(first.timestamp, last.timestamp);
 			break;
 		}
 
 		CloseHandle(h);
 	}
 
+	void SetRange(size_t first, size_t last)
+	{
+		size_t period = (last - first);
+		m_periodIndex = FindPeriod(period);
+		STimeRes* t = timeRes + m_periodIndex;
+		m_tool->SetToolLabel(ID_TOOLPERIOD, t->label);
+		m_graph->SetRange(first, first + t->period);
+		m_tool->ToggleTool(ID_TOOLARM, !m_graph->m_frozen);
+		m_tool->Realize();
+	}
+
 	virtual void m_toolRightOnToolClicked(wxCommandEvent& event) 
 	{ 
 		event.Skip(); 
@@ -447,6 +621,113 @@ public:
 		m_tool->Refresh();
 	}
 
+	virtual void m_toolFindOnToolClicked(wxCommandEvent& event)
+	{
+		event.Skip();
+		Find(m_find);
+	}
+
+	// jump to the next or previous edge, pulse or gap of the trigger channel.
+	// pulses are at the level of the trigger polarity: high for up, low for down.
+	void Find(scopeEdges::EFind what)
+	{
+		if (m_thread)
+		{
+			SetStatus(wxT("find is not available while recording"));
+			return;
+		}
+		size_t channel = m_graph->m_triggerChannel;
+		if (!m_edges.IsComplete(channel))
+		{
+			wxBusyCursor wait;
+			SetStatus(wxT("indexing the edges"));
+			m_graph->ScanEdges(m_edges, channel);
+		}
+		m_find = what;
+		// continue from the last find, or from the start of the window when it moved since
+		size_t from = m_graph->m_first;
+		if ((m_findTime != SCOPE_EDGE_NONE) && (m_findFirst == m_graph->m_first))
+		{
+			from = (what == scopeEdges::findPrevEdge) ? m_findTime : m_findTime + 1;
+		}
+		int level = (m_graph->m_triggerPolarity == NkDigTimerGraph::triggerUp) ? 1 : 0;
+		size_t timestamp = 0;
+		if (!m_edges.Find(channel, what, from, m_findWidth, level, timestamp))
+		{
+			SetStatus(wxT("not found"));
+			return;
+		}
+		SetStatus(wxString(""));
+		m_graph->GoTo(timestamp);
+		m_findTime = timestamp;
+		m_findFirst = m_graph->m_first;
+		m_tool->ToggleTool(ID_TOOLARM, false);
+		m_tool->Refresh();
+	}
+
+	virtual void m_toolMeasureOnToolClicked(wxCommandEvent& event)
+	{
+		event.Skip();
+		Measure();
+	}
+
+	// the pulses of the channels in the window and the latency from the edges of the trigger
+	// channel at the trigger polarity to those of the other channels, see nkbefMeasure
+	void Measure()
+	{
+		if (m_thread)
+		{
+			SetStatus(wxT("measure is not available while recording"));
+			return;
+		}
+		// the measured channels: the trigger and the digital ones
+		std::vector<SItem>& items = Pins().items;
+		size_t trigger = m_graph->m_triggerChannel;
+		std::vector<bool> channels(items.size(), false);
+		for (size_t i = 0; i < items.size(); ++i)
+		{
+			channels[i] = (i == trigger) || (items[i].type != SItem::eAdcPin);
+		}
+		// the reader decodes only the window and these channels of a compressed recording
+		wxBusyCursor wait;
+		nkbefFile file;
+		file.SetRange(m_graph->m_first > NKBEF_DISORDER ? m_graph->m_first - NKBEF_DISORDER : 0, m_graph->m_last + 2 * NKBEF_DISORDER);
+		file.SetChannels(channels);
+		if (!file.Open(m_data_name))
+		{
+			SetStatus(wxString::Format(wxT("could not open %s"), m_data_name));
+			return;
+		}
+		nkbefMeasure measure;
+		measure.m_first = m_graph->m_first;
+		measure.m_last = m_graph->m_last;
+		bool rising = m_graph->m_triggerPolarity == NkDigTimerGraph::triggerUp;
+		for (size_t i = 0; i < items.size(); ++i)
+		{
+			if ((i != trigger) && channels[i]) measure.AddLatency((long)trigger, rising, (long)i, rising);
+		}
+		measure.Run(file);
+		wxString report;
+		for (size_t i = 0; (i < items.size()) && (i < measure.m_channels.size()); ++i)
+		{
+			const nkbefChannelMeasure& c = measure.m_channels[i];
+			if (!channels[i] || !c.edges) continue;
+			report += wxString::Format(wxT("%s: %llu edges"), items[i].values.size() > 1 ? items[i].values[1] : wxString(), (unsigned long long)c.edges);
+			if (c.high.count) report += wxString::Format(wxT(", high %.1f us"), c.high.mean());
+			if (c.low.count) report += wxString::Format(wxT(", low %.1f us"), c.low.mean());
+			if (c.period.count) report += wxString::Format(wxT(", period %.1f us"), c.period.mean());
+			if (c.duty() >= 0.) report += wxString::Format(wxT(", duty %.1f %%"), 100. * c.duty());
+			for (const auto& l : measure.m_latencies)
+			{
+				if ((l.to != (long)i) || !l.latency.count) continue;
+				report += wxString::Format(wxT(", latency %.1f us (%llu-%llu)"), l.latency.mean(), (unsigned long long)l.latency.min, (unsigned long long)l.latency.max);
+			}
+			report += wxT("\n");
+		}
+		if (report.IsEmpty()) report = wxT("no edges in the window");
+		wxMessageBox(report, wxT("Measure"), wxOK | wxICON_INFORMATION, this);
+	}
+
 	virtual void m_toolSaveOnToolClicked(wxCommandEvent& event)
 	{
 		event.Skip();
@@ -466,7 +747,7 @@ public:
 		}
 
 		wxFileDialog dlg(this, wxT("Save NiVerDig Digital Timer Events Recording"), fn.GetPath(), fn.GetFullName(),
-			"Binary Event Format (*.nkbef)|*.nkbef|Text Event Format (*.nktef)|*.nktef|Relative Timing Text Event Format (*.nkref)|*.nkref", wxFD_SAVE /*| wxFD_OVERWRITE_PROMPT*/);
+			"Binary Event Format (*.nkbef)|*.nkbef|Text Event Format (*.nktef)|*.nktef|Relative Timing Text Event Format (*.nkref)|*.nkref|Compressed Event Format (*.nkcef)|*.nkcef|Compressed Event Format, per channel (*.nkcef)|*.nkcef", wxFD_SAVE /*| wxFD_OVERWRITE_PROMPT*/);
 		dlg.SetFilterIndex(m_format);
 		while (1)
 		{
@@ -519,7 +800,7 @@ public:
 	{ 
 		event.Skip(); 
 		wxFileDialog dlg(this, wxT("Open NiVerDig Digital Timer Events Recording"), wxEmptyString, wxEmptyString,
-			"NiVerDig Digital Events Recording Files (*.nkbef)|*.nkbef", wxFD_OPEN | wxFD_FILE_MUST_EXIST);
+			"NiVerDig Digital Events Recording Files (*.nkbef;*.nkcef)|*.nkbef;*.nkcef", wxFD_OPEN | wxFD_FILE_MUST_EXIST);
 		if (dlg.ShowModal() == wxID_CANCEL)
 		{
 			return;
@@ -544,36 +825,97 @@ public:
 		{
 			if (!m_thread) return;
 			NkComPort_WriteA(m_main->m_port,"s",1);
+			for (auto& device : m_devices)
+			{
+				NkComPort_WriteA(device.port, "s", 1);
+			}
 			for (int i = 0; m_thread->IsRunning() && (i < 300); ++i)
 			{
 				Sleep(1);
 			}
+			// the thread of the main window owns the merge: it is deleted last
+			for (auto& device : m_devices)
+			{
+				if (!device.thread) continue;
+				for (int i = 0; device.thread->IsRunning() && (i < 300); ++i)
+				{
+					Sleep(1);
+				}
+				device.thread->m_stop = true;
+				device.thread->Wait();
+				delete device.thread;
+				device.thread = NULL;
+			}
 			m_thread->m_stop = true;
 			m_thread->Wait();
 			delete m_thread;
 			m_thread = NULL;
+			m_edges.m_complete = true;
 
 			return;
 		}
 		else
 		{
 			if (m_thread) return;
-			if (m_adcResolution) m_thread = new threadScope<word>(this);
-			else m_thread = new threadScope<byte>(this);
+			if (m_adcResolution) CreateThreads<word>();
+			else CreateThreads<byte>();
 			m_thread->Create();
 			m_thread->SetPriority(100);
 			if(m_adcResolution) m_main->WriteLine(wxT("scope 16\n"));
 			else m_main->WriteLine(wxT("scope\n"));
 			wchar_t answer[64];
 			m_main->ReadLine(answer, 64, 100);
+			for (auto& device : m_devices)
+			{
+				device.thread->Create();
+				device.thread->SetPriority(100);
+				NkComPort_WriteLine(device.port, m_adcResolution ? wxT("scope 16\n") : wxT("scope\n"));
+				NkComPort_ReadLine(device.port, answer, 64, 100);
+			}
 			m_thread->Run();
+			for (auto& device : m_devices)
+			{
+				device.thread->Run();
+			}
+		}
+	}
+
+	// one thread per device: with more than one, each feeds a lane of the merge that writes the file
+	template <typename T>
+	void CreateThreads()
+	{
+		scopeMerge<T>* merge = NULL;
+		if (m_devices.size())
+		{
+			merge = new scopeMerge<T>(m_devices.size() + 1, m_data, &m_index, &m_lod, &m_edges, &m_trigger, &m_journal, &m_writerStats);
+		}
+		m_thread = new threadScope<T>(this, NULL, merge, 0);
+		for (size_t i = 0; i < m_devices.size(); ++i)
+		{
+			m_devices[i].thread = new threadScope<T>(this, &m_devices[i], merge, i + 1);
 		}
 	}
 
 	template <typename T>
 	void SaveFile()
 	{
-		if (m_format == FORMAT_BINARY)
+		if ((m_format == FORMAT_COMPRESSED) || (m_format == FORMAT_COLUMNS))
+		{
+			if (!SaveCompressed<T>())
+			{
+				m_main->SetStatus(wxString::Format(wxT("error saving file %s."), m_filename));
+				return;
+			}
+		}
+		else if ((m_format == FORMAT_BINARY) && m_chunks.size())
+		{
+			if (!SaveDecoded<T>())
+			{
+				m_main->SetStatus(wxString::Format(wxT("error saving file %s."), m_filename));
+				return;
+			}
+		}
+		else if (m_format == FORMAT_BINARY)
 		{
 			CopyFile(m_data_name, m_filename, FALSE);
 			// add the pin information
@@ -586,79 +928,181 @@ public:
 		}
 		else
 		{
-			std::vector<SItem>& pins = m_main->m_pins.items;
-			HANDLE h1 = INVALID_HANDLE_VALUE;
-			DuplicateHandle(GetCurrentProcess(), m_data, GetCurrentProcess(), &h1, GENERIC_READ, FALSE, 0);
-			HANDLE h2 = CreateFile(m_filename, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, 0, NULL);
-			if ((h1 != INVALID_HANDLE_VALUE) && (h2 != INVALID_HANDLE_VALUE))
+			// memory mapped and formatted in parallel by the exporter shared with the nkbef tool
+			std::vector<SItem>& pins = Pins().items;
+			std::vector<std::string> names;
+			for (size_t i = 0; i < pins.size(); ++i)
 			{
-				for (size_t i = 0; i < pins.size(); ++i)
-				{
-					if (pins[i].values.size() > 1)
-					{
-						wxString line = wxString::Format("pin\t%lld\t%S\n", i, pins[i].values[1]);
-						WriteFile(h2, (const char*)line, line.length() * sizeof(char), NULL, NULL);
-					}
-				}
-				wxString header = "time\tpin\tstate\n";
-				WriteFile(h2, (const char*)header, header.length() * sizeof(char), NULL, NULL);
-				SetFilePointer(h1, 0, NULL, FILE_BEGIN);
-				fileSample<T> sample;
-				DWORD read = 0;
-				wxString line;
-				if (ReadFile(h1, &sample, sizeof(sample), &read, NULL) && (read == sizeof(sample)))
-				{
-					size_t start = sample.timestamp;
-					do
-					{
-						size_t channel = sample.channel;
-						if(channel < pins.size())
-						{
-							if (m_format == FORMAT_TEXT_ABS)
-							{
-								line = wxString::Format("%ls\t%lld\t%hu\n", LogFormatLocalFileTimeUs(sample.timestamp), channel, sample.state);
-							}
-							else
-							{
-								line = wxString::Format("%lld\t%lld\t%hu\n", (sample.timestamp - start) / 10ULL, channel, sample.state);
-							}
-							WriteFile(h2, (const char*)line, line.length() * sizeof(char), NULL, NULL);
-						}
-					} while (ReadFile(h1, &sample, sizeof(sample), &read, NULL) && (read == sizeof(sample)));
-				}
+				names.push_back(pins[i].values.size() > 1 ? std::string(pins[i].values[1].ToUTF8()) : std::string());
 			}
-			if (h1 != INVALID_HANDLE_VALUE) CloseHandle(h1);
-			if (h2 != INVALID_HANDLE_VALUE) CloseHandle(h2);
-			if ((h1 == INVALID_HANDLE_VALUE) || (h2 == INVALID_HANDLE_VALUE))
+			wxBusyCursor wait;
+			nkbefFile file;
+			FILE* out = NULL;
+			bool ok = file.Open(m_data_name) && !_wfopen_s(&out, m_filename, L"wb");
+			if (ok)
+			{
+				// the samples of a compressed recording are those decoded by the reader
+				if (!file.m_compressed) file.SetBits(sizeof(T) == 1 ? 8 : 16);
+				if (m_lastsample && !file.m_compressed) file.m_lastsample = m_lastsample;
+				ok = nkbefExportText(file, names, out, m_format == FORMAT_TEXT_REL);
+			}
+			if (out && fclose(out)) ok = false;
+			if (!ok)
 			{
 				m_main->SetStatus(wxString::Format(wxT("error saving file %s."), m_filename));
 				return;
-
 			}
 		}
 		m_main->SetStatus(wxString::Format(wxT("file %s saved."),m_filename));
 		IncrementFileName(m_filename);
 	}
 
-	void SaveFileInfo(HANDLE h, size_t * last_sample)
+	// writes the samples in chunks of SCOPE_CHUNK_SAMPLES, interleaved or per channel, see NkDigTimerScope.h
+	template <typename T>
+	bool SaveCompressed()
 	{
-		SetFilePointer(h, 0, NULL, FILE_END);
-		size_t len = GetFilePointerEx(h);
-		if (last_sample) *last_sample = len;
-		std::vector<SItem>& pins = m_main->m_pins.items;
+		HANDLE h1 = INVALID_HANDLE_VALUE;
+		DuplicateHandle(GetCurrentProcess(), m_data, GetCurrentProcess(), &h1, GENERIC_READ, FALSE, 0);
+		HANDLE h2 = CreateFile(m_filename, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, 0, NULL);
+		bool ok = (h1 != INVALID_HANDLE_VALUE) && (h2 != INVALID_HANDLE_VALUE);
+		if (ok)
+		{
+			size_t end = m_lastsample;
+			if (!end) GetFileSizeEx(h1, (LARGE_INTEGER*)&end);
+			scopeSampleSource<T> source(h1, m_dataOffset, end, m_chunks);
+			scopeChunkFileHeader header = { "NKCEF", 1, sizeof(fileSample<T>) };
+			DWORD written = 0;
+			ok = WriteFile(h2, &header, sizeof(header), &written, NULL) != 0;
+			size_t pos = sizeof(header);
+			std::vector<fileSample<T> > samples;
+			std::vector<unsigned char> data;
+			scopeChunkIndex chunks;
+			for (size_t count = 0; ok && ((count = source.Read(samples)) != 0); )
+			{
+				scopeChunkHeader chunk;
+				ScopePackChunk<T>(&samples[0], count, m_format == FORMAT_COLUMNS, chunk, data);
+				scopeChunkEntry entry = { chunk.first, chunk.last, pos, count };
+				ok = WriteFile(h2, &chunk, sizeof(chunk), &written, NULL) && WriteFile(h2, &data[0], chunk.packedSize, &written, NULL);
+				pos += sizeof(chunk) + chunk.packedSize;
+				chunks.push_back(entry);
+			}
+			if (source.m_error) ok = false;
+			if (ok) SaveFileInfo(h2, NULL, &chunks);
+		}
+		if (h1 != INVALID_HANDLE_VALUE) CloseHandle(h1);
+		if (h2 != INVALID_HANDLE_VALUE) CloseHandle(h2);
+		return ok;
+	}
+
+	// writes the decoded samples of a compressed recording as a binary recording without header:
+	// its appendix holds the pins
+	template <typename T>
+	bool SaveDecoded()
+	{
+		HANDLE h1 = INVALID_HANDLE_VALUE;
+		DuplicateHandle(GetCurrentProcess(), m_data, GetCurrentProcess(), &h1, GENERIC_READ, FALSE, 0);
+		HANDLE h2 = CreateFile(m_filename, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, 0, NULL);
+		bool ok = (h1 != INVALID_HANDLE_VALUE) && (h2 != INVALID_HANDLE_VALUE);
+		if (ok)
+		{
+			wxBusyCursor wait;
+			scopeSampleSource<T> source(h1, 0, m_lastsample, m_chunks);
+			std::vector<fileSample<T> > samples;
+			DWORD written = 0;
+			for (size_t count = 0; ok && ((count = source.Read(samples)) != 0); )
+			{
+				ok = WriteFile(h2, &samples[0], DWORD(count * sizeof(fileSample<T>)), &written, NULL) != 0;
+			}
+			if (source.m_error) ok = false;
+			if (ok) SaveFileInfo(h2, NULL);
+		}
+		if (h1 != INVALID_HANDLE_VALUE) CloseHandle(h1);
+		if (h2 != INVALID_HANDLE_VALUE) CloseHandle(h2);
+		return ok;
+	}
+
+	// the pin and bits lines of the appendix
+	wxString PinInfo()
+	{
+		wxString info;
+		std::vector<SItem>& pins = Pins().items;
 		for (size_t i = 0; i < pins.size(); ++i)
 		{
 			SItem& pin = pins[i];
 			if (pin.values.size() > 1) // values[1] is the name
 			{
-				wxString line = wxString::Format(wxT("pin\t%lld\t%s\t%lld\n"), i, pin.values[1], pin.type);
-				WriteFile(h, (const wchar_t*)line, line.length() * sizeof(wchar_t), NULL, NULL);
+				info += wxString::Format(wxT("pin\t%lld\t%s\t%lld\n"), i, pin.values[1], pin.type);
 			}
 		}
-		wxString line = wxString::Format(wxT("bits\t%ld\n"), m_main->m_pins.dataBits);
-		WriteFile(h, (const wchar_t*)line, line.length() * sizeof(wchar_t), NULL, NULL);
+		info += wxString::Format(wxT("bits\t%ld\n"), m_dataBits);
+		return info;
+	}
+
+	void SaveFileInfo(HANDLE h, size_t * last_sample, const scopeChunkIndex * chunks = NULL)
+	{
+		SetFilePointer(h, 0, NULL, FILE_END);
+		size_t len = GetFilePointerEx(h);
+		if (last_sample) *last_sample = len;
+		wxString line = PinInfo();
+		// the binary blocks follow the terminated text in the order of their lines.
+		// the chunk table replaces the seek index of the uncompressed format.
+		std::vector<scopeLodEntry> lod;
+		m_lod.Flatten(lod);
+		std::vector<unsigned char> edges;
+		if (m_edges.m_complete) m_edges.Save(edges);
+		bool index = !chunks && m_index.size();
+		if (chunks) line += wxString::Format(wxT("chunks\t%lld\n"), chunks->size());
+		if (index) line += wxString::Format(wxT("index\t%lld\t%d\n"), m_index.size(), SCOPE_INDEX_STRIDE);
+		if (lod.size()) line += wxString::Format(wxT("lod\t%lld\t%d\t%lld\n"), lod.size(), SCOPE_LOD_SHIFT, m_lod.m_last);
+		if (edges.size()) line += wxString::Format(wxT("edges\t%lld\n"), edges.size());
+		line += m_clock.Info();
+		for (auto& device : m_devices)
+		{
+			// channels and clock correction of the other devices
+			line += wxString::Format(wxT("device\t%s\t%lld\t%lld\t%.3f\t%.1f\t%.1f\n"), device.name, device.channel, device.pins.items.size(),
+				device.clock.m_b * 1e6, device.clock.m_error * 1e6, device.clock.m_maxError * 1e6);
+		}
+		bool blocks = chunks || index || lod.size() || edges.size();
+		WriteFile(h, (const wchar_t*)line, (line.length() + (blocks ? 1 : 0)) * sizeof(wchar_t), NULL, NULL);
+		if (chunks && chunks->size()) WriteFile(h, &(*chunks)[0], DWORD(chunks->size() * sizeof(scopeChunkEntry)), NULL, NULL);
+		if (index) WriteFile(h, &m_index[0], DWORD(m_index.size() * sizeof(scopeIndexEntry)), NULL, NULL);
+		if (lod.size()) WriteFile(h, &lod[0], DWORD(lod.size() * sizeof(scopeLodEntry)), NULL, NULL);
+		if (edges.size()) WriteFile(h, &edges[0], DWORD(edges.size()), NULL, NULL);
 		// last number is the start of the pins section
 		WriteFile(h, &len, sizeof(size_t), NULL, NULL);
+		if (!chunks && m_dataOffset)
+		{
+			WriteFileHeader(h, SCOPE_HEADER_COMPLETE);
+		}
+	}
+
+	// writes the header of the binary format at the begin of the file, see NkDigTimerScope.h
+	bool WriteFileHeader(HANDLE h, unsigned long flags)
+	{
+		std::vector<SItem>& pins = Pins().items;
+		if (sizeof(scopeFileHeader) + pins.size() * sizeof(scopeFileChannel) > SCOPE_HEADER_SIZE) return false;
+		std::vector<unsigned char> buf(SCOPE_HEADER_SIZE, 0);
+		scopeFileHeader* header = (scopeFileHeader*)&buf[0];
+		strcpy_s(header->magic, sizeof(header->magic), "NKBEF");
+		header->version = SCOPE_HEADER_VERSION;
+		header->headerSize = SCOPE_HEADER_SIZE;
+		header->sampleSize = (m_dataBits == 8) ? sizeof(fileSample<byte>) : sizeof(fileSample<word>);
+		header->bits = m_dataBits;
+		header->channels = (unsigned long)pins.size();
+		header->flags = flags;
+		header->startTime = m_startTime;
+		scopeFileChannel* channels = (scopeFileChannel*)(header + 1);
+		for (size_t i = 0; i < pins.size(); ++i)
+		{
+			channels[i].type = pins[i].type;
+			if (pins[i].values.size() > 1) // values[1] is the name
+			{
+				wcsncpy_s(channels[i].name, pins[i].values[1].wc_str(), _TRUNCATE);
+			}
+		}
+		SetFilePointer(h, 0, NULL, FILE_BEGIN);
+		DWORD written = 0;
+		return WriteFile(h, &buf[0], SCOPE_HEADER_SIZE, &written, NULL) && (written == SCOPE_HEADER_SIZE);
 	}
 	
 	void IncrementFileName(wxString &filename)
@@ -697,15 +1141,32 @@ public:
 	wchar_t      m_data_name[_MAX_FNAME];
 	bool         m_isTempData;
 	threadScopeBase* m_thread;
+	std::vector<scopeDevice> m_devices; // the other devices of the recording
+	SItems       m_devicePins; // the pins of all devices, see MergePins
 	long         m_adcResolution;
 	long         m_periodIndex;
 	wxString     m_profilePrefix;
 	bool         m_save;
 	wxString     m_filename;
-	enum eFormat {FORMAT_BINARY, FORMAT_TEXT_ABS, FORMAT_TEXT_REL};
+	enum eFormat {FORMAT_BINARY, FORMAT_TEXT_ABS, FORMAT_TEXT_REL, FORMAT_COMPRESSED, FORMAT_COLUMNS};
 	eFormat      m_format;
 	enum EMODE   m_mode;
 	size_t       m_lastsample; // used in viewer mode: offset of last sample
+	long         m_dataBits;   // of the samples in m_data
+	size_t       m_dataOffset; // of the first sample in m_data: the size of its header
+	size_t       m_startTime;  // of the recording in m_data
+	scopeIndex   m_index;      // seek index: filled while recording, read from the appendix in viewer mode
+	scopeChunkIndex m_chunks;  // chunk table of a compressed recording in viewer mode
+	scopeLod     m_lod;        // level-of-detail pyramid: filled while recording, read from the appendix in viewer mode
+	scopeEdges   m_edges;      // edge index: filled while recording, read from the appendix or built per channel at the first find in viewer mode
+	scopeTrigger m_trigger;    // compound trigger: evaluated while recording, replaces the trigger channel when set
+	scopeJournal m_journal;    // checkpoints of a recording to a file, removed when the recording stops
+	scopeWriterStats m_writerStats; // backpressure of the writer thread of the recording
+	scopeClock   m_clock;      // device to host time of the recording
+	scopeEdges::EFind m_find;  // repeated by the find tool
+	size_t       m_findWidth;  // pulse or gap width of the find commands
+	size_t       m_findFirst;  // start of the window after the last find
+	size_t       m_findTime;   // edge found by the last find
 
 	wxDECLARE_EVENT_TABLE();
 	void OnDropDownToolbarAdcRes(wxAuiToolBarEvent& evt);
@@ -716,8 +1177,12 @@ public:
 	void OnPolarity(wxCommandEvent& event);
 	void OnDropDownToolbarChannel(wxAuiToolBarEvent& evt);
 	void OnChannel(wxCommandEvent& event);
+	void OnTriggerExpression(wxCommandEvent& event);
+	void SetTriggerExpression();
 	void OnDropDownToolbarMode(wxAuiToolBarEvent& evt);
 	void OnMode(wxCommandEvent& event);
+	void OnDropDownToolbarFind(wxAuiToolBarEvent& evt);
+	void OnFind(wxCommandEvent& event);
 };
 
 wxBEGIN_EVENT_TABLE(panelScope, formScope)
@@ -728,29 +1193,84 @@ EVT_MENU_RANGE(10000, 10026, panelScope::OnPeriod)
 EVT_AUITOOLBAR_TOOL_DROPDOWN(ID_TOOLPOLARITY, panelScope::OnDropDownToolbarPolarity)
 EVT_MENU_RANGE(20000, 20001, panelScope::OnPolarity)
 EVT_AUITOOLBAR_TOOL_DROPDOWN(ID_TOOLCHANNEL, panelScope::OnDropDownToolbarChannel)
-EVT_MENU_RANGE(30000, 30100, panelScope::OnChannel)
+EVT_MENU_RANGE(30000, 30127, panelScope::OnChannel)
+EVT_MENU(20014, panelScope::OnTriggerExpression)
 EVT_AUITOOLBAR_TOOL_DROPDOWN(ID_TOOLMODE, panelScope::OnDropDownToolbarMode)
 EVT_MENU_RANGE(20003, 20005, panelScope::OnMode)
+EVT_AUITOOLBAR_TOOL_DROPDOWN(ID_TOOLFIND, panelScope::OnDropDownToolbarFind)
+EVT_MENU_RANGE(20008, 20013, panelScope::OnFind)
 EVT_NKDIGTIMERGRAPHEVENT(wxID_ANY, panelScope::OnGraphDisarm)
 wxEND_EVENT_TABLE()
 
+// reorders the samples within delay and writes them to the file.
+// the pin interrupts and the timer events of the device arrive out of order, but within
+// the delay. the pending samples are kept in a min-heap on (timestamp, arrival), so a
+// sample costs O(log n) whatever the order. a sample is written when it is delay older
+// than the newest sample, or earlier when more than capacity samples are pending.
+// in a recording of several devices, the fifo of each device passes its samples to a lane
+// of the scopeMerge that writes the file.
 template <typename T>
-class fileSampleFifo : public std::vector<fileSample<T> >
+class fileSampleFifo
 {
 public:
-	typedef std::vector<fileSample<T> > base;
-	typedef base::iterator iterator;
-	typedef base::reverse_iterator riterator;
+	struct pending
+	{
+		size_t timestamp;
+		size_t sequence; // arrival: keeps the order of equal timestamps
+		char   channel;
+		T      state;
+		bool operator < (const pending& p) const
+		{
+			// std::push_heap keeps the largest on top
+			return (timestamp != p.timestamp) ? (timestamp > p.timestamp) : (sequence > p.sequence);
+		}
+	};
 
-	fileSampleFifo(HANDLE file, size_t delay)
-		: m_file(file)
+	fileSampleFifo(HANDLE file, size_t delay, scopeIndex* index = NULL, scopeLod* lod = NULL, scopeEdges* edges = NULL, scopeTrigger* trigger = NULL, scopeJournal* journal = NULL, scopeWriterStats* stats = NULL, size_t capacity = 65536)
+		: m_writer(new scopeWriter(file, sizeof(fileSample<T>), journal, stats))
+		, m_merge(NULL)
+		, m_lane(0)
 		, m_delay(delay)
 		, m_current(0)
+		, m_capacity(capacity)
+		, m_sequence(0)
+		, m_index(index)
+		, m_lod(lod)
+		, m_edges(edges)
+		, m_trigger(trigger)
+		, m_written(0)
+		, m_timestamp(0)
 	{
-		base::resize(2048);
-		m_first = base::end();
-		m_last = base::end();
-		m_count = 0;
+		m_heap.reserve(capacity);
+		m_out.reserve(4096);
+		// the samples are appended after the header
+		m_base = GetFilePointerEx(file);
+		m_writer->Start();
+	}
+
+	fileSampleFifo(scopeMerge<T>* merge, size_t lane, size_t delay, size_t capacity = 65536)
+		: m_writer(NULL)
+		, m_merge(merge)
+		, m_lane(lane)
+		, m_delay(delay)
+		, m_current(0)
+		, m_capacity(capacity)
+		, m_sequence(0)
+		, m_index(NULL)
+		, m_lod(NULL)
+		, m_edges(NULL)
+		, m_trigger(NULL)
+		, m_written(0)
+		, m_timestamp(0)
+		, m_base(0)
+	{
+		m_heap.reserve(capacity);
+		m_out.reserve(4096);
+	}
+
+	~fileSampleFifo()
+	{
+		delete m_writer;
 	}
 
 	void push(char channel, T state, size_t timestamp)
@@ -759,159 +1279,277 @@ public:
 //		OutputDebugString(wxString::Format(wxT("f %2d s %2u t %10lld\n"), channel, state, timestamp));
 #endif
 		// make room if full: write writes at least one
-		if ((m_count + 1) == base::size())
+		if (m_heap.size() >= m_capacity)
 		{
 			write(1);
 		}
-
-		// position of new sample
-		iterator new_last;
-		if (m_first == base::end())
-		{
-			new_last = m_first = base::begin();
-		}
-		else
-		{
-			new_last = last() + 1;
-			if (new_last == base::end()) new_last = base::begin();
-		}
-
-		// check out of order
-		iterator s = new_last;
-		while(1)
-		{
-			iterator p = s;
-			prev(p);
-			if (p == base::end()) break;
-			if (p->timestamp <= timestamp) break;
-			*s = *p; 
-			s = p;
-		}
-		s->channel = channel;
-		s->state = state;
-		s->timestamp = timestamp;
+		pending p = { timestamp, m_sequence++, channel, state };
+		m_heap.push_back(p);
+		std::push_heap(m_heap.begin(), m_heap.end());
 		if (timestamp > m_current)
 		{
 			m_current = timestamp;
 		}
-		m_last = new_last;
-		++m_count;
 	}
 
-	iterator first()
+	size_t size() const
+	{
+		return m_heap.size();
+	}
+
+	void write(size_t write_at_least_one)
 	{
-		return m_first;
+		// write all samples older than delay
+		m_out.clear();
+		while (m_heap.size())
+		{
+			const pending& p = m_heap.front();
+			if (((m_current - p.timestamp) < m_delay) && (m_out.size() >= write_at_least_one)) break;
+			fileSample<T> s;
+			s.channel = p.channel;
+			s.state = p.state;
+			s.timestamp = p.timestamp;
+			m_out.push_back(s);
+			std::pop_heap(m_heap.begin(), m_heap.end());
+			m_heap.pop_back();
+		}
+		if (m_merge)
+		{
+			// the lane sends no samples older than the delay any more
+			size_t watermark = (m_current > m_delay) ? m_current - m_delay : 0;
+			m_merge->Put(m_lane, m_out.size() ? &m_out[0] : NULL, m_out.size(), watermark);
+			return;
+		}
+		append(m_out.size() ? &m_out[0] : NULL, m_out.size());
+		// hand the samples to the writer thread at least every write (SYNC_TICK), so viewers see them
+		m_writer->Publish();
 	}
 
-	iterator last()
+	// write samples in order
+	void append(const fileSample<T>* s, size_t count)
 	{
-		return m_last;
+		if (!count) return;
+		AddToIndex(s, count);
+		m_writer->Write(s, sizeof(fileSample<T>) * count, m_timestamp);
 	}
 
-	void next(iterator& i)
+	void AddToIndex(const fileSample<T>* i, size_t count)
 	{
-		if (i == m_last)
+		// add an index entry for every SCOPE_INDEX_STRIDE-th sample written to the file
+		if (m_index)
 		{
-			i = end<T>();
+			for (size_t next = (m_written + SCOPE_INDEX_STRIDE - 1) / SCOPE_INDEX_STRIDE * SCOPE_INDEX_STRIDE; next < m_written + count; next += SCOPE_INDEX_STRIDE)
+			{
+				scopeIndexEntry entry = { i[next - m_written].timestamp, m_base + next * sizeof(fileSample<T>) };
+				m_index->push_back(entry);
+			}
 		}
-		else
+		if (m_lod)
 		{
-			++i;
-			if (i == end<T>())
+			for (size_t k = 0; k < count; ++k)
 			{
-				i = begin<T>();
+				m_lod->Add(i[k].channel, i[k].state, i[k].timestamp);
 			}
 		}
+		if (m_edges)
+		{
+			for (size_t k = 0; k < count; ++k)
+			{
+				m_edges->Add(i[k].channel, i[k].state, i[k].timestamp);
+			}
+		}
+		if (m_trigger) m_trigger->Process(i, count);
+		m_written += count;
+		if (i[count - 1].timestamp > m_timestamp) m_timestamp = i[count - 1].timestamp;
 	}
 
-	void prev(iterator& i)
+	std::vector<pending> m_heap;         // pending samples, oldest on top
+	std::vector<fileSample<T> > m_out;   // samples to write
+	scopeWriter* m_writer;   // NULL in a lane of a merge
+	scopeMerge<T>* m_merge;
+	size_t    m_lane;
+	size_t    m_delay;     // latency bound: in timestamp units
+	size_t    m_current;   // newest timestamp
+	size_t    m_capacity;  // maximum number of pending samples
+	size_t    m_sequence;  // number of samples pushed
+	scopeIndex* m_index;   // seek index of the written samples
+	scopeLod* m_lod;       // level-of-detail pyramid of the written samples
+	scopeEdges* m_edges;   // edge index of the written samples
+	scopeTrigger* m_trigger; // compound trigger evaluated on the written samples
+	size_t    m_written;   // number of samples written
+	size_t    m_timestamp; // highest timestamp written
+	size_t    m_base;      // file offset of the first sample
+};
+
+#define SCOPE_MERGE_BACKLOG (1024 * 1024) // samples: a lane with more pending does not wait for the others
+
+// k-way merge of the devices of a recording into one file. each device thread passes its
+// ordered samples (host time, see scopeClock) to its lane with a watermark: the lane sends
+// no older samples. the oldest pending sample is written when no lane can still send an
+// older one. a device that stops sending (its watermark does not advance) holds the others
+// back until SCOPE_MERGE_BACKLOG samples are pending.
+template <typename T>
+class scopeMerge
+{
+public:
+	struct lane
+	{
+		std::vector<fileSample<T> > samples;
+		size_t next;      // first sample not written
+		size_t watermark;
+		bool   ended;
+	};
+
+	scopeMerge(size_t lanes, HANDLE file, scopeIndex* index, scopeLod* lod, scopeEdges* edges, scopeTrigger* trigger, scopeJournal* journal, scopeWriterStats* stats)
+		: m_file(file, 0, index, lod, edges, trigger, journal, stats)
+		, m_lanes(lanes)
 	{
-		if (i == m_first)
+		for (auto& l : m_lanes)
 		{
-			i = base::end();
+			l.next = 0;
+			l.watermark = 0;
+			l.ended = false;
 		}
-		else
+		m_out.reserve(4096);
+	}
+
+	// called by the device threads
+	void Put(size_t index, const fileSample<T>* s, size_t count, size_t watermark)
+	{
+		wxCriticalSectionLocker lock(m_lock);
+		lane& l = m_lanes[index];
+		if (count)
 		{
-			if (i == base::begin())
-			{
-				i = base::end();
-			}
-			--i;
+			l.samples.insert(l.samples.end(), s, s + count);
+			if (s[count - 1].timestamp > watermark) watermark = s[count - 1].timestamp;
 		}
+		if (watermark > l.watermark) l.watermark = watermark;
+		Merge();
 	}
 
-	void write(size_t write_at_least_one)
+	// the device thread stopped: the others do not wait for it
+	void End(size_t index)
 	{
-		DWORD written;
-		if (!m_count) return;
-		// write all samples older than delay
-		iterator i1 = first();
-		iterator i2 = i1 + write_at_least_one; // always write one to make room
-		bool found_recent = false;
-		if (i1 != m_last)
+		wxCriticalSectionLocker lock(m_lock);
+		m_lanes[index].ended = true;
+		Merge();
+	}
+
+private:
+	void Merge()
+	{
+		m_out.clear();
+		while (1)
 		{
-			for (; (i2 != base::end()) && (i2 != m_last); ++i2)
+			// the lanes are few: scan them for the oldest pending sample
+			lane* oldest = NULL;
+			size_t bound = SIZE_MAX; // the oldest sample an empty lane can still send
+			bool backlog = false;
+			for (auto& l : m_lanes)
 			{
-				if ((m_current - i2->timestamp) < m_delay)
+				if (l.next < l.samples.size())
 				{
-					found_recent = true;
-					break;
+					if (!oldest || (l.samples[l.next].timestamp < oldest->samples[oldest->next].timestamp)) oldest = &l;
+					if (l.samples.size() - l.next > SCOPE_MERGE_BACKLOG) backlog = true;
+				}
+				else if (!l.ended && (l.watermark < bound))
+				{
+					bound = l.watermark;
 				}
 			}
+			if (!oldest) break;
+			if ((oldest->samples[oldest->next].timestamp > bound) && !backlog) break;
+			m_out.push_back(oldest->samples[oldest->next++]);
 		}
-		size_t count = i2 - i1;
-		if (count)
-		{
-			WriteFile(m_file, &*i1, sizeof(fileSample<T>) * count, &written, NULL);
-			//OutputDebugString(wxString::Format(wxT("written %ld\n"), written));
-			m_count -= count;
-			m_first = i2;
-			if (m_first == base::end()) m_first = base::begin();
-		}
-		if (m_count && !found_recent && (m_first > m_last))
+		for (auto& l : m_lanes)
 		{
-			// check the begin of the vector for older items
-			iterator i1 = base::begin();
-			iterator i2 = i1;
-			for (; i2 != m_last; ++i2)
+			if (l.next == l.samples.size())
 			{
-				if ((m_current - i2->timestamp) < m_delay)
-				{
-					break;
-				}
+				l.samples.clear();
+				l.next = 0;
 			}
-			count = i2 - i1;
-			if (count)
+			else if (l.next >= 65536)
 			{
-				WriteFile(m_file, &*i1, sizeof(fileSample<T>) * count, &written, NULL);
-				//OutputDebugString(wxString::Format(wxT("written %ld\n"), written));
-				m_count -= count;
-				m_first = i2;
-				if (m_first == base::end()) m_first = base::begin();
+				l.samples.erase(l.samples.begin(), l.samples.begin() + l.next);
+				l.next = 0;
 			}
 		}
+		m_file.append(m_out.size() ? &m_out[0] : NULL, m_out.size());
+		m_file.m_writer->Publish();
 	}
 
-	size_t    m_count;
-	iterator  m_first;
-	iterator  m_last;
-	HANDLE    m_file;
-	size_t    m_delay;
-	size_t    m_current;
+	wxCriticalSection m_lock;
+	fileSampleFifo<T> m_file; // writes in order: its heap is not used
+	std::vector<lane> m_lanes;
+	std::vector<fileSample<T> > m_out;
 };
 
+#ifdef SCOPE_BENCHMARK
+// cost per sample of fileSampleFifo (written to NUL) for samples in order and for bursts of
+// pin events that arrive in reverse order behind the timer events. prints to the debugger output.
+void ScopeBenchmarkFifo()
+{
+	HANDLE nul = CreateFile(wxT("NUL"), GENERIC_WRITE, 0, NULL, OPEN_EXISTING, 0, NULL);
+	const size_t count = 10000000;
+	const size_t burst = 256;
+	for (int reverse = 0; reverse < 2; ++reverse)
+	{
+		fileSampleFifo<byte> fifo(nul, 10000);
+		LARGE_INTEGER frequency, t0, t1;
+		QueryPerformanceFrequency(&frequency);
+		QueryPerformanceCounter(&t0);
+		for (size_t i = 0; i < count; ++i)
+		{
+			// 1 us apart within a burst of 256 us
+			size_t k = i % burst;
+			size_t timestamp = (i / burst) * burst * 10 + (reverse ? (burst - 1 - k) : k) * 10;
+			fifo.push(char(k & 15), byte(i & 1), timestamp);
+			if (k == burst - 1) fifo.write(0);
+		}
+		fifo.m_delay = 0;
+		fifo.write(0);
+		QueryPerformanceCounter(&t1);
+		double ns = double(t1.QuadPart - t0.QuadPart) * 1e9 / double(frequency.QuadPart) / double(count);
+		OutputDebugString(wxString::Format(wxT("fileSampleFifo %s: %.1f ns/sample\n"), reverse ? wxT("reversed bursts") : wxT("in order"), ns));
+	}
+	CloseHandle(nul);
+}
+#endif
+
+template <typename T>
+threadScope<T>::~threadScope()
+{
+	if (!m_device) delete m_merge;
+}
+
 template <typename T>
 void* threadScope<T>::Entry()
 {
-	NKCOMPORT* port = m_scope->m_main->m_port;
+	if (!m_merge)
+	{
+		fileSampleFifo<T> fileData(m_scope->m_data, 10000, &m_scope->m_index, &m_scope->m_lod, &m_scope->m_edges, &m_scope->m_trigger, &m_scope->m_journal, &m_scope->m_writerStats);
+		Acquire(fileData);
+		return NULL;
+	}
+	fileSampleFifo<T> fileData(m_merge, m_lane, 10000);
+	Acquire(fileData);
+	m_merge->End(m_lane);
+	return NULL;
+}
+
+template <typename T>
+void threadScope<T>::Acquire(fileSampleFifo<T>& fileData)
+{
+	NKCOMPORT* port = m_device ? m_device->port : m_scope->m_main->m_port;
+	// the channels of a device follow those of the devices before it
+	char first = m_device ? char(m_device->channel) : 0;
 
 	std::vector<T> states;
-	states.resize(m_scope->m_main->m_pins.items.size());
+	states.resize(m_device ? m_device->pins.items.size() : m_scope->m_main->m_pins.items.size());
 	for (auto& s : states) { s = -1; }
 
 	char serialData[sizeof(serialSample<T>) * 1024];
 	serialSample<T>* serSamples = (struct serialSample<T>*)serialData;
-	fileSampleFifo<T> fileData(m_scope->m_data,10000);
 
 	size_t offset = 0;
 
@@ -919,16 +1557,20 @@ void* threadScope<T>::Entry()
 	if ((read != sizeof(serialSample<T>)) || (serSamples[0].channel != SYNC_CHANNEL) || (serSamples[0].state != SYNC_TICK))
 	{
 		// to do warn scope that something went wrong
-		return NULL;
+		return;
 	}
-	size_t start = GetCurrentFileTime();
+	size_t start = GetPreciseFileTime();
 	unsigned long last_tick = serSamples[0].tick;
 	m_time = start - serSamples[0].tick * 10ULL;
+	// each device has its own clock: mapped to host time, the devices share one time base
+	scopeClock& clock = m_device ? m_device->clock : m_scope->m_clock;
+	clock.Reset(start);
 
 	while (!m_stop)
 	{
 		long read = NkComPort_ReadA(port, serialData + offset, sizeof(serialData) - offset, 0);
 		if (read <= 0) continue;
+		size_t received = GetPreciseFileTime();
 		read += offset;
 #ifdef _DEBUG
 /*
@@ -990,9 +1632,10 @@ void* threadScope<T>::Entry()
 				if (s->state == SYNC_TICK)
 				{
 					// tick to make the graph move: insert state for each pin
+					clock.Add(m_time + s->tick * 10ULL, received);
 					for (size_t i = 0; i < states.size(); ++i)
 					{
-						fileData.push(~i, states[i], m_time + s->tick * 10ULL); // use bitwise not channel to indicate this is a tick event
+						fileData.push(char(~(first + i)), states[i], clock.Map(m_time + s->tick * 10ULL)); // use bitwise not channel to indicate this is a tick event
 					}
 					fileData.write(0);
 					continue;
@@ -1002,14 +1645,14 @@ void* threadScope<T>::Entry()
 					// end of scope mode
 					fileData.m_delay = 0;
 					fileData.write(0);
-					return NULL;
+					return;
 				}
 			}
 			if(s->channel < states.size())
 			{
 				states[s->channel] = s->state;
 			}
-			fileData.push(s->channel, s->state, m_time + s->tick * 10ULL);
+			fileData.push((s->channel < 0) ? s->channel : char(first + s->channel), s->state, clock.Map(m_time + s->tick * 10ULL));
 		}
 		long remain = read % sizeof(serialSample<T>);
 		if (remain)
@@ -1018,8 +1661,6 @@ void* threadScope<T>::Entry()
 		}
 		offset = remain;
 	}
-
-	return NULL;
 }
 
 wxString FormatPeriod(size_t period)
@@ -1046,6 +1687,235 @@ size_t FindPeriod(size_t period)
 	return countof(timeRes) - 1;
 }
 
+wxString FormatDuration(size_t duration)
+{
+	// timestamps are in 100 ns
+	if (duration && !(duration % 10000000)) return wxString::Format(wxT("%llu s"), (unsigned long long)(duration / 10000000));
+	if (duration && !(duration % 10000)) return wxString::Format(wxT("%llu ms"), (unsigned long long)(duration / 10000));
+	if (duration && !(duration % 10)) return wxString::Format(wxT("%llu us"), (unsigned long long)(duration / 10));
+	return wxString::Format(wxT("%llu ns"), (unsigned long long)duration * 100);
+}
+
+// a number with an optional unit: ns, us, ms (default) or s
+bool ParseDuration(const wxString& text, size_t& duration)
+{
+	wxString value = text;
+	value.Trim(true).Trim(false);
+	double scale = 10000;
+	if (value.EndsWith(wxT("ns"), &value)) scale = 0.01;
+	else if (value.EndsWith(wxT("us"), &value)) scale = 10;
+	else if (value.EndsWith(wxT("ms"), &value)) scale = 10000;
+	else if (value.EndsWith(wxT("s"), &value)) scale = 10000000;
+	double number = 0;
+	if (!value.Trim(true).ToDouble(&number) || (number <= 0)) return false;
+	duration = size_t(number * scale + 0.5);
+	return duration != 0;
+}
+
+// recursive descent parser of a trigger expression into the postfix program, see scopeTrigger
+class scopeTriggerParser
+{
+public:
+	scopeTriggerParser(const wxString& text, const SItems& pins, std::vector<scopeTriggerOp>& program)
+	: m_text(text)
+	, m_pos(0)
+	, m_pins(pins)
+	, m_program(program)
+	, m_depth(0)
+	{}
+
+	bool Parse(wxString& error)
+	{
+		if (Expression())
+		{
+			Skip();
+			if (m_pos < m_text.length()) Fail(wxT("unexpected text"));
+			if (m_error.IsEmpty()) return true;
+		}
+		error = m_error;
+		return false;
+	}
+
+private:
+	bool Expression()
+	{
+		if (!Term()) return false;
+		while (Accept(wxT('|')))
+		{
+			Accept(wxT('|'));
+			if (!Term()) return false;
+			Emit(scopeTriggerOp::opOr);
+		}
+		return true;
+	}
+
+	bool Term()
+	{
+		if (!Factor()) return false;
+		while (Accept(wxT('&')))
+		{
+			Accept(wxT('&'));
+			if (!Factor()) return false;
+			Emit(scopeTriggerOp::opAnd);
+		}
+		return true;
+	}
+
+	bool Factor()
+	{
+		if (Accept(wxT('!')))
+		{
+			if (!Factor()) return false;
+			Emit(scopeTriggerOp::opNot);
+			return true;
+		}
+		if (Accept(wxT('(')))
+		{
+			return Expression() && Expect(wxT(')'));
+		}
+		return Condition();
+	}
+
+	bool Condition()
+	{
+		wxString name = Token().Lower();
+		if (!Expect(wxT('('))) return false;
+		if (name == wxT("after"))
+		{
+			size_t duration = 0;
+			if (!Expression() || !Expect(wxT(',')) || !Expression() || !Expect(wxT(',')) || !Duration(duration)) return false;
+			Emit(scopeTriggerOp::opAfter, 0, duration);
+			return Expect(wxT(')'));
+		}
+		size_t channel = 0;
+		if (!Pin(channel)) return false;
+		if ((name == wxT("pulse")) || (name == wxT("lowpulse")))
+		{
+			bool shorter = Accept(wxT('<'));
+			if (!shorter && !Accept(wxT('>'))) return Fail(wxT("expected < or >"));
+			size_t duration = 0;
+			if (!Duration(duration)) return false;
+			if (name == wxT("pulse")) Emit(shorter ? scopeTriggerOp::opShorter : scopeTriggerOp::opLonger, channel, duration);
+			else Emit(shorter ? scopeTriggerOp::opLowShorter : scopeTriggerOp::opLowLonger, channel, duration);
+		}
+		else if (name == wxT("high")) Emit(scopeTriggerOp::opHigh, channel);
+		else if (name == wxT("low")) Emit(scopeTriggerOp::opLow, channel);
+		else if (name == wxT("rise")) Emit(scopeTriggerOp::opRise, channel);
+		else if (name == wxT("fall")) Emit(scopeTriggerOp::opFall, channel);
+		else if (name == wxT("edge")) Emit(scopeTriggerOp::opEdge, channel);
+		else return Fail(wxT("unknown condition ") + name);
+		return Expect(wxT(')'));
+	}
+
+	// the name or the number of a pin
+	bool Pin(size_t& channel)
+	{
+		wxString pin = Token();
+		for (size_t i = 0; i < m_pins.items.size(); ++i)
+		{
+			if ((m_pins.items[i].values.size() > 1) && !m_pins.items[i].values[1].CmpNoCase(pin))
+			{
+				channel = i;
+				return true;
+			}
+		}
+		unsigned long number = 0;
+		if (pin.ToULong(&number) && (number < m_pins.items.size()) && (number < 128))
+		{
+			channel = number;
+			return true;
+		}
+		return Fail(wxT("unknown pin ") + pin);
+	}
+
+	bool Duration(size_t& duration)
+	{
+		Skip();
+		size_t start = m_pos;
+		while ((m_pos < m_text.length()) && (m_text[m_pos] != wxT(')')) && (m_text[m_pos] != wxT(','))) ++m_pos;
+		if (!ParseDuration(m_text.Mid(start, m_pos - start), duration)) return Fail(wxT("invalid time ") + m_text.Mid(start, m_pos - start));
+		return true;
+	}
+
+	wxString Token()
+	{
+		Skip();
+		size_t start = m_pos;
+		while ((m_pos < m_text.length()) && !wxIsspace(m_text[m_pos]) && !wxStrchr(wxT("()<>,&|!"), m_text[m_pos])) ++m_pos;
+		return m_text.Mid(start, m_pos - start);
+	}
+
+	void Skip()
+	{
+		while ((m_pos < m_text.length()) && wxIsspace(m_text[m_pos])) ++m_pos;
+	}
+
+	bool Accept(wxChar c)
+	{
+		Skip();
+		if ((m_pos >= m_text.length()) || (m_text[m_pos] != c)) return false;
+		++m_pos;
+		return true;
+	}
+
+	bool Expect(wxChar c)
+	{
+		if (Accept(c)) return true;
+		return Fail(wxString::Format(wxT("expected %c"), c));
+	}
+
+	bool Fail(const wxString& error)
+	{
+		if (m_error.IsEmpty()) m_error = wxString::Format(wxT("%s at %d"), error, (int)m_pos + 1);
+		return false;
+	}
+
+	void Emit(scopeTriggerOp::ECode code, size_t channel = 0, size_t duration = 0)
+	{
+		scopeTriggerOp op = { code, channel, duration };
+		m_program.push_back(op);
+		// the depth of the evaluation stack
+		if ((code == scopeTriggerOp::opAnd) || (code == scopeTriggerOp::opOr) || (code == scopeTriggerOp::opAfter)) --m_depth;
+		else if (code != scopeTriggerOp::opNot) ++m_depth;
+		if (m_depth > SCOPE_TRIGGER_STACK) Fail(wxT("expression too deep"));
+	}
+
+	const wxString&              m_text;
+	size_t                       m_pos;
+	const SItems&                m_pins;
+	std::vector<scopeTriggerOp>& m_program;
+	size_t                       m_depth;
+	wxString                     m_error;
+};
+
+bool scopeTrigger::Compile(const wxString& expression, const SItems& pins, wxString& error)
+{
+	std::vector<scopeTriggerOp> program;
+	scopeTriggerParser parser(expression, pins, program);
+	if (!parser.Parse(error)) return false;
+	wxCriticalSectionLocker lock(m_lock);
+	m_program.swap(program);
+	m_used.assign(128, false);
+	for (auto& op : m_program)
+	{
+		if (op.code < scopeTriggerOp::opAfter) m_used[op.channel] = true;
+	}
+	m_expression = expression;
+	Reset();
+	m_set = true;
+	return true;
+}
+
+void scopeTrigger::Clear()
+{
+	wxCriticalSectionLocker lock(m_lock);
+	m_set = false;
+	m_program.clear();
+	m_used.clear();
+	m_expression.clear();
+	Reset();
+}
+
 size_t GetPeriod(long index)
 {
 	if ((index >= 0) && (index < countof(timeRes)))
@@ -1199,7 +2069,7 @@ void panelScope::OnDropDownToolbarChannel(wxAuiToolBarEvent& evt)
 	// create the popup menu
 	wxMenu menuPopup;
 
-	std::vector<SItem>& items = m_main->m_pins.items;
+	std::vector<SItem>& items = Pins().items;
 	for (size_t i = 0; i < items.size(); ++i)
 	{
 		if (items[i].values.size() > 1)
@@ -1207,6 +2077,8 @@ void panelScope::OnDropDownToolbarChannel(wxAuiToolBarEvent& evt)
 			menuPopup.Append(new wxMenuItem(&menuPopup, 30000 + i, items[i].values[1]));
 		}
 	}
+	menuPopup.AppendSeparator();
+	menuPopup.Append(new wxMenuItem(&menuPopup, 20014, wxT("expression...")));
 
 	// line up our menu with the button
 	wxRect rect = tb->GetToolRect(evt.GetId());
@@ -1222,14 +2094,39 @@ void panelScope::OnDropDownToolbarChannel(wxAuiToolBarEvent& evt)
 void panelScope::OnChannel(wxCommandEvent& event)
 {
 	size_t channel = event.GetId() - 30000;
-	if (channel >= m_main->m_pins.items.size()) return;
+	if (channel >= Pins().items.size()) return;
 
-	m_tool->SetToolLabel(ID_TOOLCHANNEL,m_main->m_pins.items[channel].values[1]);
+	m_trigger.Clear();
+	m_main->m_profile->Write(m_profilePrefix + wxT("TriggerExpression"), wxString());
+	m_tool->SetToolLabel(ID_TOOLCHANNEL,Pins().items[channel].values[1]);
+	m_tool->SetToolShortHelp(ID_TOOLCHANNEL, wxT("trigger channel"));
 	m_tool->Realize();
 	m_graph->SetTriggerChannel(channel);
 	m_main->m_profile->Write(m_profilePrefix + wxT("Channel"), channel);
 }
 
+void panelScope::OnTriggerExpression(wxCommandEvent& event)
+{
+	wxString expression = wxGetTextFromUser(wxT("trigger expression, e.g. rise(1) & high(2) | pulse(3 < 10us) | after(fall(1), rise(2), 5ms):"), wxT("Trigger"), m_trigger.Expression(), this);
+	if (!expression.length()) return;
+	wxString error;
+	if (!m_trigger.Compile(expression, Pins(), error))
+	{
+		SetStatus(wxT("invalid trigger expression: ") + error);
+		return;
+	}
+	m_main->m_profile->Write(m_profilePrefix + wxT("TriggerExpression"), expression);
+	SetTriggerExpression();
+	m_tool->Realize();
+	SetStatus(wxString(""));
+}
+
+void panelScope::SetTriggerExpression()
+{
+	m_tool->SetToolLabel(ID_TOOLCHANNEL, wxT("expression"));
+	m_tool->SetToolShortHelp(ID_TOOLCHANNEL, m_trigger.Expression());
+}
+
 void panelScope::OnDropDownToolbarMode(wxAuiToolBarEvent& evt)
 {
 	wxAuiToolBar* tb = static_cast<wxAuiToolBar*>(evt.GetEventObject());
@@ -1273,6 +2170,55 @@ void panelScope::OnMode(wxCommandEvent& event)
 	m_tool->Refresh();
 }
 
+void panelScope::OnDropDownToolbarFind(wxAuiToolBarEvent& evt)
+{
+	wxAuiToolBar* tb = static_cast<wxAuiToolBar*>(evt.GetEventObject());
+
+	tb->SetToolSticky(evt.GetId(), true);
+
+	// create the popup menu
+	wxMenu menuPopup;
+
+	wxString pulse = (m_graph->m_triggerPolarity == NkDigTimerGraph::triggerUp) ? wxT("high pulse") : wxT("low pulse");
+	wxString width = FormatDuration(m_findWidth);
+	menuPopup.Append(new wxMenuItem(&menuPopup, 20008, wxT("next edge")));
+	menuPopup.Append(new wxMenuItem(&menuPopup, 20009, wxT("previous edge")));
+	menuPopup.Append(new wxMenuItem(&menuPopup, 20010, wxString::Format(wxT("next %s shorter than %s"), pulse, width)));
+	menuPopup.Append(new wxMenuItem(&menuPopup, 20011, wxString::Format(wxT("next %s longer than %s"), pulse, width)));
+	menuPopup.Append(new wxMenuItem(&menuPopup, 20012, wxString::Format(wxT("next gap longer than %s"), width)));
+	menuPopup.AppendSeparator();
+	menuPopup.Append(new wxMenuItem(&menuPopup, 20013, wxT("width...")));
+
+	// line up our menu with the button
+	wxRect rect = tb->GetToolRect(evt.GetId());
+	wxPoint pt = tb->ClientToScreen(rect.GetBottomLeft());
+	pt = ScreenToClient(pt);
+
+	PopupMenu(&menuPopup, pt);
+
+	// make sure the button is "un-stuck"
+	tb->SetToolSticky(evt.GetId(), false);
+}
+
+void panelScope::OnFind(wxCommandEvent& event)
+{
+	if (event.GetId() == 20013)
+	{
+		wxString text = wxGetTextFromUser(wxT("pulse or gap width (ns, us, ms or s):"), wxT("Find"), FormatDuration(m_findWidth), this);
+		if (text.IsEmpty()) return;
+		size_t width = 0;
+		if (!ParseDuration(text, width))
+		{
+			SetStatus(wxT("invalid width: ") + text);
+			return;
+		}
+		m_findWidth = width;
+		m_main->m_profile->Write(m_profilePrefix + wxT("FindWidth"), (long)m_findWidth);
+		return;
+	}
+	Find(scopeEdges::EFind(event.GetId() - 20008));
+}
+
 wxPanel* CreateScopePanel(frameMain* parent, wxString file, EMODE mode)
 {
 	return new panelScope(parent, file, mode);
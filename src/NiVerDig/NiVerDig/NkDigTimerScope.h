@@ -2,6 +2,7 @@
 
 #include <wx/thread.h>
 #include <wx/msw/private.h>
+#include "../nkbef/nkbef.h"
 
 class panelScope;
 
@@ -23,6 +24,1450 @@ struct fileSample
 };
 #pragma pack(pop, r1)
 
+// sparse seek index in the file appendix: one entry every SCOPE_INDEX_STRIDE samples
+#define SCOPE_INDEX_STRIDE 4096
+
+// size of the file view of the reader on 32-bit hosts, see scopePages::MapView
+#define SCOPE_MAP_WINDOW (64 * 1024 * 1024)
+
+struct scopeIndexEntry
+{
+	size_t timestamp; // of the sample at offset
+	size_t offset;    // file offset of the sample
+};
+typedef std::vector<scopeIndexEntry> scopeIndex;
+
+// binary recording format (*.nkbef), also read by nkbef/nkbef.h:
+//   scopeFileHeader and the scopeFileChannel table, padded to headerSize
+//   samples: fileSample<T>
+//   appendix (see panelScope::SaveFileInfo)
+// the header is written when the recording starts, so a viewer can open a growing file at once.
+// SCOPE_HEADER_COMPLETE is set when the appendix is written. older recordings start with the samples.
+#define SCOPE_HEADER_SIZE     65536 // a multiple of the mapping granularity: the samples start on a page
+#define SCOPE_HEADER_VERSION  1
+#define SCOPE_HEADER_COMPLETE 1     // flag: the appendix is written
+#define SCOPE_HEADER_NAME     32
+
+#pragma pack(push, r1, 1)
+struct scopeFileHeader
+{
+	char          magic[8];   // "NKBEF"
+	unsigned long version;    // SCOPE_HEADER_VERSION
+	unsigned long headerSize; // offset of the first sample
+	unsigned long sampleSize; // sizeof(fileSample<T>)
+	unsigned long bits;
+	unsigned long channels;   // entries in the channel table
+	unsigned long flags;
+	size_t        startTime;  // of the recording
+};
+
+struct scopeFileChannel
+{
+	long          type;       // SItem::EItemType
+	wchar_t       name[SCOPE_HEADER_NAME];
+};
+#pragma pack(pop, r1)
+
+// compressed (chunked) recording format (*.nkcef):
+//   scopeChunkFileHeader
+//   chunks: scopeChunkHeader followed by the packed samples
+//   appendix (as in *.nkbef) with a 'chunks' line and the scopeChunkEntry table
+// the samples of a chunk are encoded as:
+//   zigzag varint of the timestamp delta (the samples are not strictly sorted)
+//   token byte: 0..127: digital sample of channel (token >> 1) with state (token & 1)
+//               128   : followed by the channel byte and the zigzag varint of the state delta of that channel
+// the encoded chunk is compressed with XPRESS (when that makes it smaller)
+// a columnar chunk (SCOPE_CHUNK_COLUMNS) holds one column per channel, so a reader of a few channels
+// reads only their columns. rawSize is then the size of the scopeColumnHeader directory following the
+// chunk header; the columns follow the directory. a column holds per sample the zigzag varints of the
+// timestamp delta and the state delta, and is compressed on its own.
+#define SCOPE_CHUNK_SAMPLES 65536
+#define SCOPE_CHUNK_CACHE   4
+#define SCOPE_CHUNK_MAGIC   0x4B4E4843 // 'CHNK'
+#define SCOPE_CHUNK_PACKED  1          // flag: data is compressed
+#define SCOPE_CHUNK_COLUMNS 2          // flag: one column per channel
+
+#pragma pack(push, r1, 1)
+struct scopeChunkFileHeader
+{
+	char          magic[8];   // "NKCEF"
+	unsigned long version;    // 1
+	unsigned long sampleSize; // sizeof(fileSample<T>)
+};
+
+struct scopeChunkHeader
+{
+	unsigned long magic;      // SCOPE_CHUNK_MAGIC
+	unsigned long count;      // number of samples
+	size_t        first;      // lowest timestamp
+	size_t        last;       // highest timestamp
+	unsigned long rawSize;    // size of the encoded samples
+	unsigned long packedSize; // size of the data following the header
+	unsigned long flags;
+};
+
+struct scopeColumnHeader
+{
+	char          channel;    // as in fileSample: ~i for the tick events of channel i
+	unsigned long count;      // number of samples
+	unsigned long rawSize;    // size of the encoded samples
+	unsigned long packedSize; // size of the column data
+	unsigned long flags;      // SCOPE_CHUNK_PACKED
+};
+#pragma pack(pop, r1)
+
+struct scopeChunkEntry
+{
+	size_t first;  // lowest timestamp in the chunk
+	size_t last;   // highest timestamp in the chunk
+	size_t offset; // file offset of the scopeChunkHeader
+	size_t count;  // number of samples
+};
+typedef std::vector<scopeChunkEntry> scopeChunkIndex;
+
+// level-of-detail pyramid: per channel and per level, the samples summarized in buckets
+// of 2^(SCOPE_LOD_SHIFT + level) timestamp units. only buckets holding samples are stored.
+// memory is bounded by the number of entries of all channels: when they exceed SCOPE_LOD_ENTRIES
+// the lowest level is dropped. a level holds at most about half the entries of the one below, so
+// this about halves them. one busy channel (a bucket per 26 ms at level 0, 145 MB per day for all
+// levels) keeps level 0 for about 7 hours, level 1 for 15 hours and level 2 for 30 hours.
+// a view finer than the lowest level draws the samples.
+#define SCOPE_LOD_SHIFT   18     // level 0: 2^18 * 100 ns = 26 ms
+#define SCOPE_LOD_LEVELS  20     // top level: 2^37 * 100 ns = 3.8 hours
+#define SCOPE_LOD_UNKNOWN 0xFFFF
+#define SCOPE_LOD_ENTRIES (2 * 1024 * 1024) // 46 MB, up to twice that with the spare capacity of the vectors
+
+#pragma pack(push, r1, 1)
+struct scopeLodEntry
+{
+	size_t         bucket;  // timestamp >> (SCOPE_LOD_SHIFT + level)
+	unsigned long  edges;   // number of state changes in the bucket
+	unsigned short before;  // state at the start of the bucket
+	unsigned short min;
+	unsigned short max;
+	unsigned short last;    // state at the end of the bucket
+	unsigned char  channel;
+	unsigned char  level;
+};
+#pragma pack(pop, r1)
+
+class scopeLod
+{
+public:
+	scopeLod()
+	: m_last(0)
+	, m_lowest(0)
+	, m_count(0)
+	{}
+
+	void clear()
+	{
+		m_levels.clear();
+		m_state.clear();
+		m_last = 0;
+		m_lowest = 0;
+		m_count = 0;
+	}
+
+	bool empty() const { return m_levels.empty(); }
+
+	// tick events (channel ~i) only provide the initial state of a channel
+	void Add(char channel, unsigned short state, size_t timestamp)
+	{
+		bool tick = channel < 0;
+		size_t c = (unsigned char)(tick ? ~channel : channel);
+		if (c >= m_state.size()) m_state.resize(c + 1, SCOPE_LOD_UNKNOWN);
+		unsigned short before = m_state[c];
+		if (tick && (before != SCOPE_LOD_UNKNOWN)) return;
+		if (before == SCOPE_LOD_UNKNOWN) before = state;
+		m_state[c] = state;
+		if (timestamp > m_last) m_last = timestamp;
+		if (m_levels.size() != SCOPE_LOD_LEVELS) m_levels.resize(SCOPE_LOD_LEVELS);
+		for (unsigned char level = (unsigned char)m_lowest; level < SCOPE_LOD_LEVELS; ++level)
+		{
+			std::vector<std::vector<scopeLodEntry> >& channels = m_levels[level];
+			if (c >= channels.size()) channels.resize(c + 1);
+			std::vector<scopeLodEntry>& entries = channels[c];
+			size_t bucket = timestamp >> (SCOPE_LOD_SHIFT + level);
+			if (entries.empty() || (entries.back().bucket < bucket))
+			{
+				scopeLodEntry e = { bucket, state != before, before, before < state ? before : state, before > state ? before : state, state, (unsigned char)c, level };
+				entries.push_back(e);
+				++m_count;
+			}
+			else
+			{
+				// a late sample of an older bucket is added to the last one
+				scopeLodEntry& e = entries.back();
+				if (state != e.last) ++e.edges;
+				if (state < e.min) e.min = state;
+				if (state > e.max) e.max = state;
+				e.last = state;
+			}
+		}
+		if ((m_count > SCOPE_LOD_ENTRIES) && (m_lowest + 1 < SCOPE_LOD_LEVELS)) Drop();
+	}
+
+	// free the lowest level
+	void Drop()
+	{
+		for (auto& entries : m_levels[m_lowest]) m_count -= entries.size();
+		std::vector<std::vector<scopeLodEntry> >().swap(m_levels[m_lowest]);
+		++m_lowest;
+	}
+
+	const std::vector<scopeLodEntry>* Entries(size_t level, size_t channel) const
+	{
+		if ((level >= m_levels.size()) || (channel >= m_levels[level].size())) return NULL;
+		return &m_levels[level][channel];
+	}
+
+	void Flatten(std::vector<scopeLodEntry>& entries) const
+	{
+		entries.clear();
+		for (auto& channels : m_levels)
+		{
+			for (auto& e : channels)
+			{
+				entries.insert(entries.end(), e.begin(), e.end());
+			}
+		}
+	}
+
+	void Load(const std::vector<scopeLodEntry>& entries, size_t last)
+	{
+		clear();
+		m_last = last;
+		if (entries.empty()) return;
+		m_levels.resize(SCOPE_LOD_LEVELS);
+		m_lowest = SCOPE_LOD_LEVELS - 1;
+		for (auto& e : entries)
+		{
+			if (e.level >= SCOPE_LOD_LEVELS) continue;
+			std::vector<std::vector<scopeLodEntry> >& channels = m_levels[e.level];
+			if (e.channel >= channels.size()) channels.resize(e.channel + 1);
+			channels[e.channel].push_back(e);
+			if (e.level < m_lowest) m_lowest = e.level;
+			++m_count;
+		}
+	}
+
+	std::vector<std::vector<std::vector<scopeLodEntry> > > m_levels; // [level][channel]
+	std::vector<unsigned short> m_state; // last state per channel
+	size_t m_last;                        // highest timestamp
+	size_t m_lowest;                      // lowest stored level: the ones below are dropped
+	size_t m_count;                       // number of entries
+};
+
+// crash recovery: while recording, a journal next to the data file holds the pin information
+// and, every SCOPE_CHECKPOINT_INTERVAL ms, a checkpoint of the samples flushed to disk.
+// the checkpoints alternate between two slots, so a torn write leaves the previous one intact.
+//   journal: scopeCheckpoint[2] followed by the UTF-16 pin information (as in the appendix)
+#define SCOPE_CHECKPOINT_INTERVAL 5000
+#define SCOPE_CHECKPOINT_MAGIC    0x4B504843 // 'CHPK'
+#define SCOPE_CHECKPOINT_DISORDER 10000      // samples are sorted within the delay of the fifo (1 ms)
+#define SCOPE_CHECKPOINT_GAP      (600ULL * 10000000ULL) // samples more than 10 minutes apart are not plausible
+
+#pragma pack(push, r1, 1)
+struct scopeCheckpoint
+{
+	unsigned long magic;      // SCOPE_CHECKPOINT_MAGIC
+	unsigned long sequence;   // the slot is sequence & 1
+	size_t        lastsample; // file offset after the last flushed sample
+	size_t        count;      // number of flushed samples
+	size_t        timestamp;  // of the last flushed sample
+	unsigned long bits;
+	unsigned long infoHash;   // of the pin information
+	unsigned long checksum;   // of the fields above
+};
+#pragma pack(pop, r1)
+
+inline unsigned long ScopeHash(const void* data, size_t size)
+{
+	// FNV-1a
+	unsigned long hash = 2166136261UL;
+	for (const unsigned char* p = (const unsigned char*)data; p < (const unsigned char*)data + size; ++p)
+	{
+		hash = (hash ^ *p) * 16777619UL;
+	}
+	return hash;
+}
+
+class scopeJournal
+{
+public:
+	scopeJournal()
+	: m_file(INVALID_HANDLE_VALUE)
+	, m_data(INVALID_HANDLE_VALUE)
+	, m_infoHash(0)
+	, m_bits(8)
+	, m_sequence(0)
+	, m_tick(0)
+	{}
+
+	~scopeJournal()
+	{
+		Close(false);
+	}
+
+	static wxString Name(const wxString& data_name)
+	{
+		return data_name + wxT(".nkjournal");
+	}
+
+	bool Create(const wxString& data_name, HANDLE data, const wxString& info, long bits)
+	{
+		Close(false);
+		m_name = Name(data_name);
+		m_file = CreateFile(m_name, GENERIC_WRITE, FILE_SHARE_READ, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+		if (m_file == INVALID_HANDLE_VALUE) return false;
+		m_data = data;
+		m_bits = bits;
+		m_sequence = 0;
+		m_tick = 0;
+		m_infoHash = ScopeHash((const wchar_t*)info, info.length() * sizeof(wchar_t));
+		scopeCheckpoint slots[2];
+		memset(slots, 0, sizeof(slots));
+		DWORD written = 0;
+		WriteFile(m_file, slots, sizeof(slots), &written, NULL);
+		WriteFile(m_file, (const wchar_t*)info, DWORD(info.length() * sizeof(wchar_t)), &written, NULL);
+		return true;
+	}
+
+	// called by the recording thread after writing samples
+	void Checkpoint(size_t lastsample, size_t count, size_t timestamp)
+	{
+		if (m_file == INVALID_HANDLE_VALUE) return;
+		ULONGLONG tick = GetTickCount64();
+		if ((tick - m_tick) < SCOPE_CHECKPOINT_INTERVAL) return;
+		m_tick = tick;
+		// the samples must be on disk before the checkpoint claims them
+		FlushFileBuffers(m_data);
+		scopeCheckpoint cp = { SCOPE_CHECKPOINT_MAGIC, ++m_sequence, lastsample, count, timestamp, (unsigned long)m_bits, m_infoHash, 0 };
+		cp.checksum = ScopeHash(&cp, offsetof(scopeCheckpoint, checksum));
+		OVERLAPPED ov = { 0 };
+		ov.Offset = (m_sequence & 1) * sizeof(scopeCheckpoint);
+		DWORD written = 0;
+		WriteFile(m_file, &cp, sizeof(cp), &written, &ov);
+		FlushFileBuffers(m_file);
+	}
+
+	// remove: the recording is complete
+	void Close(bool remove)
+	{
+		if (m_file == INVALID_HANDLE_VALUE) return;
+		CloseHandle(m_file);
+		m_file = INVALID_HANDLE_VALUE;
+		m_data = INVALID_HANDLE_VALUE;
+		if (remove) DeleteFile(m_name);
+	}
+
+	// find the end of the consistent samples of an interrupted recording: start at the last
+	// valid checkpoint and accept the samples written after it as long as they are plausible.
+	// base: the offset of the first sample
+	static bool Recover(const wxString& data_name, HANDLE data, size_t base, size_t& lastsample, long& bits, wxString& info)
+	{
+		HANDLE h = CreateFile(Name(data_name), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+		if (h == INVALID_HANDLE_VALUE) return false;
+		LARGE_INTEGER len;
+		GetFileSizeEx(h, &len);
+		scopeCheckpoint slots[2];
+		DWORD read = 0;
+		std::vector<wchar_t> text;
+		if (len.QuadPart > sizeof(slots) && (len.QuadPart < sizeof(slots) + 65536))
+		{
+			text.resize(size_t(len.QuadPart - sizeof(slots)) / sizeof(wchar_t) + 1);
+			if (!ReadFile(h, slots, sizeof(slots), &read, NULL) || (read != sizeof(slots))) text.clear();
+			else if (!ReadFile(h, &text[0], DWORD(len.QuadPart - sizeof(slots)), &read, NULL)) text.clear();
+		}
+		CloseHandle(h);
+		if (text.empty()) return false;
+		text.back() = 0;
+		info = wxString(&text[0]);
+		unsigned long infoHash = ScopeHash((const wchar_t*)info, info.length() * sizeof(wchar_t));
+		scopeCheckpoint* cp = NULL;
+		for (auto& slot : slots)
+		{
+			if ((slot.magic != SCOPE_CHECKPOINT_MAGIC) || (slot.infoHash != infoHash)) continue;
+			if (slot.checksum != ScopeHash(&slot, offsetof(scopeCheckpoint, checksum))) continue;
+			if (!cp || (slot.sequence > cp->sequence)) cp = &slot;
+		}
+		scopeCheckpoint none = { SCOPE_CHECKPOINT_MAGIC, 0, base, 0, 0, 8, infoHash, 0 };
+		if (!cp)
+		{
+			// crashed before the first checkpoint: the bits are in the information
+			none.bits = info.Find(wxT("bits\t16")) != wxNOT_FOUND ? 16 : 8;
+			cp = &none;
+		}
+		bits = cp->bits;
+		size_t sampleSize = (bits == 8) ? sizeof(fileSample<byte>) : sizeof(fileSample<word>);
+		LARGE_INTEGER size;
+		GetFileSizeEx(data, &size);
+		if ((cp->lastsample < base) || (cp->lastsample > size_t(size.QuadPart))) return false;
+		// scan the samples written after the checkpoint
+		size_t end = cp->lastsample;
+		size_t timestamp = cp->timestamp;
+		std::vector<unsigned char> buf(sampleSize * 4096);
+		LARGE_INTEGER pos;
+		pos.QuadPart = end;
+		SetFilePointerEx(data, pos, NULL, FILE_BEGIN);
+		bool plausible = true;
+		while (plausible && ReadFile(data, &buf[0], DWORD(buf.size()), &read, NULL) && (read >= sampleSize))
+		{
+			for (size_t i = 0; i + sampleSize <= read; i += sampleSize)
+			{
+				size_t t;
+				memcpy(&t, &buf[i + sampleSize - sizeof(size_t)], sizeof(t));
+				if (timestamp && ((t + SCOPE_CHECKPOINT_DISORDER < timestamp) || (t > timestamp + SCOPE_CHECKPOINT_GAP)))
+				{
+					plausible = false;
+					break;
+				}
+				if (t > timestamp) timestamp = t;
+				end += sampleSize;
+			}
+		}
+		lastsample = end;
+		return true;
+	}
+
+	wxString      m_name;
+	HANDLE        m_file;
+	HANDLE        m_data;
+	unsigned long m_infoHash;
+	long          m_bits;
+	unsigned long m_sequence;
+	ULONGLONG     m_tick;
+};
+
+// maps the time of the device (its ticks) to host time. the crystal of the device runs
+// some ppm off, so a fixed offset drifts by seconds per day. every SYNC_TICK gives a pair
+// of device time and host receive time. the receive time is late by the serial latency,
+// so per SCOPE_CLOCK_WINDOW ticks only the pair with the smallest offset is kept (the lower
+// envelope). a least squares fit with exponential forgetting of these pairs gives the
+// rate and the offset of the device clock. the mapping follows the fit by changing its
+// rate only, so the timestamps stay continuous and monotonic.
+#define SCOPE_CLOCK_WINDOW   10      // ticks: 1 s
+#define SCOPE_CLOCK_MEMORY   600.    // windows: time constant of the fit
+#define SCOPE_CLOCK_CONVERGE 60.     // s to correct the offset to the fit
+#define SCOPE_CLOCK_MAX_RATE 0.001   // 1000 ppm
+
+class scopeClock
+{
+public:
+	scopeClock()
+	{
+		Reset(0);
+	}
+
+	void Reset(size_t start)
+	{
+		m_device0 = m_host0 = start;
+		m_anchorDevice = m_anchorHost = start;
+		m_rate = 0.;
+		m_a = m_b = 0.;
+		m_sw = m_sx = m_sy = m_sxx = m_sxy = 0.;
+		m_windows = 0;
+		m_ticks = 0;
+		m_minX = m_minY = 0.;
+		m_error = m_maxError = 0.;
+	}
+
+	// device: uncorrected time of a SYNC_TICK, host: the time it was received
+	void Add(size_t device, size_t host)
+	{
+		// seconds since the start
+		double x = double((long long)(device - m_device0)) * 1e-7;
+		double y = double((long long)(host - m_host0)) * 1e-7 - x;
+		if (!m_ticks || (y < m_minY))
+		{
+			m_minX = x;
+			m_minY = y;
+		}
+		if (++m_ticks < SCOPE_CLOCK_WINDOW) return;
+		m_ticks = 0;
+		Fit(m_minX, m_minY);
+		// keep the mapping continuous at this tick and aim it at the fit
+		size_t now = Map(device);
+		double mapped = double((long long)(now - m_host0)) * 1e-7 - x;
+		double rate = m_b + (m_a + m_b * x - mapped) / SCOPE_CLOCK_CONVERGE;
+		m_rate = (rate > SCOPE_CLOCK_MAX_RATE) ? SCOPE_CLOCK_MAX_RATE : (rate < -SCOPE_CLOCK_MAX_RATE) ? -SCOPE_CLOCK_MAX_RATE : rate;
+		m_anchorDevice = device;
+		m_anchorHost = now;
+	}
+
+	size_t Map(size_t device) const
+	{
+		long long d = (long long)(device - m_anchorDevice);
+		return m_anchorHost + d + (long long)(double(d) * m_rate);
+	}
+
+	// the appendix line: correction of the device clock (ppm), rms and maximum error of the fit (us), number of windows
+	wxString Info() const
+	{
+		if (m_windows < 2) return wxString();
+		return wxString::Format(wxT("clock\t%.3f\t%.1f\t%.1f\t%lld\n"), m_b * 1e6, m_error * 1e6, m_maxError * 1e6, m_windows);
+	}
+
+	size_t m_device0;      // device and host time of the first SYNC_TICK
+	size_t m_host0;
+	size_t m_anchorDevice; // the mapping: host = anchorHost + (device - anchorDevice) * (1 + rate)
+	size_t m_anchorHost;
+	double m_rate;
+	double m_a;            // fit of the offset (s) to the device time (s): a + b * x
+	double m_b;
+	double m_error;        // rms and maximum residual of the windows to the fit before them (s)
+	double m_maxError;
+	size_t m_windows;
+
+private:
+	void Fit(double x, double y)
+	{
+		double f = 1. - 1. / SCOPE_CLOCK_MEMORY;
+		if (m_windows >= 2)
+		{
+			double r = y - (m_a + m_b * x);
+			m_error = sqrt(m_error * m_error * f + r * r * (1. - f));
+			if (fabs(r) > m_maxError) m_maxError = fabs(r);
+		}
+		m_sw = m_sw * f + 1.;
+		m_sx = m_sx * f + x;
+		m_sy = m_sy * f + y;
+		m_sxx = m_sxx * f + x * x;
+		m_sxy = m_sxy * f + x * y;
+		++m_windows;
+		double d = m_sw * m_sxx - m_sx * m_sx;
+		if ((m_windows < 2) || (d <= 0.))
+		{
+			m_a = y;
+			m_b = 0.;
+			return;
+		}
+		m_b = (m_sw * m_sxy - m_sx * m_sy) / d;
+		m_a = (m_sy - m_b * m_sx) / m_sw;
+	}
+
+	double m_sw, m_sx, m_sy, m_sxx, m_sxy;
+	size_t m_ticks;        // in the current window
+	double m_minX;         // the pair of the current window with the smallest offset
+	double m_minY;
+};
+
+// asynchronous writer of the recording: the acquisition thread copies the samples into a
+// buffer and hands it to the writer thread through a lock-free single-producer ring, so
+// draining the serial port never waits for the disk. when all buffers are queued, the
+// buffer of the acquisition thread grows instead (a stall in scopeWriterStats).
+#define SCOPE_WRITER_BUFFERS 16
+#define SCOPE_WRITER_BUFFER  (1024 * 1024)
+
+struct scopeWriterStats
+{
+	std::atomic<size_t> written;    // bytes written to the file
+	std::atomic<size_t> pending;    // bytes queued for the writer thread
+	std::atomic<size_t> maxPending;
+	std::atomic<size_t> stalls;     // times all buffers were queued
+	std::atomic<size_t> maxLatency; // of a write, in ms
+	std::atomic<size_t> errors;     // failed writes
+
+	scopeWriterStats()
+	{
+		clear();
+	}
+
+	void clear()
+	{
+		written = 0;
+		pending = 0;
+		maxPending = 0;
+		stalls = 0;
+		maxLatency = 0;
+		errors = 0;
+	}
+};
+
+class scopeWriter : public wxThread
+{
+public:
+	struct slot
+	{
+		std::vector<unsigned char> data;
+		size_t timestamp; // highest timestamp in data
+	};
+
+	scopeWriter(HANDLE file, size_t sampleSize, scopeJournal* journal = NULL, scopeWriterStats* stats = NULL)
+	: wxThread(wxTHREAD_JOINABLE)
+	, m_file(file)
+	, m_sampleSize(sampleSize)
+	, m_journal(journal)
+	, m_stats(stats ? stats : &m_ownStats)
+	, m_head(0)
+	, m_tail(0)
+	, m_stop(false)
+	, m_running(false)
+	, m_full(false)
+	, m_written(0)
+	{
+		for (auto& s : m_slots)
+		{
+			s.data.reserve(SCOPE_WRITER_BUFFER);
+			s.timestamp = 0;
+		}
+		m_base = GetFilePointerEx(file);
+		m_event = CreateEvent(NULL, FALSE, FALSE, NULL);
+	}
+
+	~scopeWriter()
+	{
+		Stop();
+		if (m_event) CloseHandle(m_event);
+	}
+
+	bool Start()
+	{
+		m_running = m_event && (Create() == wxTHREAD_NO_ERROR) && (Run() == wxTHREAD_NO_ERROR);
+		return m_running;
+	}
+
+	// called by the acquisition thread
+	void Write(const void* data, size_t size, size_t timestamp)
+	{
+		slot& s = m_slots[m_head.load(std::memory_order_relaxed) % SCOPE_WRITER_BUFFERS];
+		s.data.insert(s.data.end(), (const unsigned char*)data, (const unsigned char*)data + size);
+		if (timestamp > s.timestamp) s.timestamp = timestamp;
+		if (s.data.size() >= SCOPE_WRITER_BUFFER) Publish();
+	}
+
+	// queue the buffer of the acquisition thread; returns false when all buffers are queued
+	bool Publish()
+	{
+		size_t head = m_head.load(std::memory_order_relaxed);
+		slot& s = m_slots[head % SCOPE_WRITER_BUFFERS];
+		if (s.data.empty()) return true;
+		if (!m_running)
+		{
+			// no writer thread: write synchronously
+			WriteSlot(s);
+			return true;
+		}
+		if (head + 1 - m_tail.load(std::memory_order_acquire) >= SCOPE_WRITER_BUFFERS)
+		{
+			if (!m_full) ++m_stats->stalls;
+			m_full = true;
+			return false;
+		}
+		m_full = false;
+		size_t pending = (m_stats->pending += s.data.size());
+		if (pending > m_stats->maxPending) m_stats->maxPending = pending;
+		m_head.store(head + 1, std::memory_order_release);
+		SetEvent(m_event);
+		return true;
+	}
+
+	// write the remaining samples and wait for the writer thread
+	void Stop()
+	{
+		if (!m_running)
+		{
+			Publish();
+			return;
+		}
+		while (!Publish())
+		{
+			Sleep(1);
+		}
+		m_stop = true;
+		SetEvent(m_event);
+		Wait();
+		m_running = false;
+	}
+
+	void* Entry()
+	{
+		while (1)
+		{
+			// read m_stop first: when it is set, the last buffer is published
+			bool stop = m_stop;
+			size_t tail = m_tail.load(std::memory_order_relaxed);
+			if (tail == m_head.load(std::memory_order_acquire))
+			{
+				if (stop) break;
+				WaitForSingleObject(m_event, 100);
+				continue;
+			}
+			slot& s = m_slots[tail % SCOPE_WRITER_BUFFERS];
+			m_stats->pending -= s.data.size();
+			WriteSlot(s);
+			m_tail.store(tail + 1, std::memory_order_release);
+		}
+		return NULL;
+	}
+
+	void WriteSlot(slot& s)
+	{
+		ULONGLONG start = GetTickCount64();
+		DWORD written = 0;
+		if (!WriteFile(m_file, &s.data[0], DWORD(s.data.size()), &written, NULL) || (written != s.data.size()))
+		{
+			++m_stats->errors;
+		}
+		size_t latency = size_t(GetTickCount64() - start);
+		if (latency > m_stats->maxLatency) m_stats->maxLatency = latency;
+		m_written += written;
+		m_stats->written += written;
+		// the checkpoint claims only samples that reached the file
+		if (m_journal) m_journal->Checkpoint(m_base + m_written, m_written / m_sampleSize, s.timestamp);
+		s.data.clear();
+		s.timestamp = 0;
+	}
+
+	HANDLE            m_file;
+	size_t            m_sampleSize;
+	scopeJournal*     m_journal;
+	scopeWriterStats* m_stats;
+	scopeWriterStats  m_ownStats;
+	slot              m_slots[SCOPE_WRITER_BUFFERS];
+	std::atomic<size_t> m_head;  // slot filled by the acquisition thread
+	std::atomic<size_t> m_tail;  // slot written by the writer thread
+	std::atomic<bool> m_stop;
+	bool              m_running;
+	bool              m_full;    // the last Publish found all buffers queued
+	HANDLE            m_event;   // set when a buffer is queued
+	size_t            m_base;    // file offset of the first sample
+	size_t            m_written; // bytes written by the writer thread
+};
+
+size_t ScopeCompress(const void* raw, size_t raw_size, void* packed, size_t packed_size);
+bool ScopeDecompress(const void* packed, size_t packed_size, void* raw, size_t raw_size);
+
+inline void ScopePutVarint(std::vector<unsigned char>& out, unsigned long long value)
+{
+	while (value >= 0x80)
+	{
+		out.push_back((unsigned char)(value | 0x80));
+		value >>= 7;
+	}
+	out.push_back((unsigned char)value);
+}
+
+inline bool ScopeGetVarint(const unsigned char*& p, const unsigned char* end, unsigned long long& value)
+{
+	value = 0;
+	for (int shift = 0; (p < end) && (shift < 64); shift += 7)
+	{
+		unsigned char c = *p++;
+		value |= (unsigned long long)(c & 0x7F) << shift;
+		if (!(c & 0x80)) return true;
+	}
+	return false;
+}
+
+inline unsigned long long ScopeZigZag(long long value) { return ((unsigned long long)value << 1) ^ (unsigned long long)(value >> 63); }
+inline long long ScopeUnZigZag(unsigned long long value) { return (long long)(value >> 1) ^ -(long long)(value & 1); }
+
+template <typename T>
+void ScopeEncodeSamples(const fileSample<T>* samples, size_t count, std::vector<unsigned char>& out)
+{
+	T states[256] = { 0 };
+	size_t timestamp = 0;
+	for (const fileSample<T>* s = samples; s < samples + count; ++s)
+	{
+		ScopePutVarint(out, ScopeZigZag((long long)(s->timestamp - timestamp)));
+		timestamp = s->timestamp;
+		unsigned char channel = (unsigned char)s->channel;
+		if ((channel < 64) && (s->state <= 1))
+		{
+			out.push_back((unsigned char)((channel << 1) | s->state));
+		}
+		else
+		{
+			out.push_back(0x80);
+			out.push_back(channel);
+			ScopePutVarint(out, ScopeZigZag((long long)s->state - (long long)states[channel]));
+		}
+		states[channel] = s->state;
+	}
+}
+
+template <typename T>
+bool ScopeDecodeSamples(const unsigned char* p, size_t size, size_t count, std::vector<fileSample<T> >& samples)
+{
+	const unsigned char* end = p + size;
+	T states[256] = { 0 };
+	size_t timestamp = 0;
+	samples.resize(count);
+	for (size_t i = 0; i < count; ++i)
+	{
+		unsigned long long value;
+		if (!ScopeGetVarint(p, end, value) || (p >= end)) return false;
+		timestamp += (size_t)ScopeUnZigZag(value);
+		fileSample<T>& s = samples[i];
+		s.timestamp = timestamp;
+		unsigned char token = *p++;
+		if (token < 0x80)
+		{
+			s.channel = (char)(token >> 1);
+			s.state = token & 1;
+		}
+		else
+		{
+			if (p >= end) return false;
+			unsigned char channel = *p++;
+			if (!ScopeGetVarint(p, end, value)) return false;
+			s.channel = (char)channel;
+			s.state = (T)((long long)states[channel] + ScopeUnZigZag(value));
+		}
+		states[(unsigned char)s.channel] = s.state;
+	}
+	return true;
+}
+
+// channel selection of a filtered reader: empty selects all channels, tick events follow their channel
+inline bool ScopeSelected(const std::vector<bool>& channels, char channel)
+{
+	if (channels.empty()) return true;
+	size_t c = (unsigned char)(channel < 0 ? ~channel : channel);
+	return (c < channels.size()) && channels[c];
+}
+
+template <typename T>
+void ScopeEncodeColumn(const std::vector<fileSample<T> >& samples, std::vector<unsigned char>& out)
+{
+	size_t timestamp = 0;
+	T state = 0;
+	for (auto& s : samples)
+	{
+		ScopePutVarint(out, ScopeZigZag((long long)(s.timestamp - timestamp)));
+		ScopePutVarint(out, ScopeZigZag((long long)s.state - (long long)state));
+		timestamp = s.timestamp;
+		state = s.state;
+	}
+}
+
+template <typename T>
+bool ScopeDecodeColumn(const unsigned char* p, size_t size, size_t count, char channel, std::vector<fileSample<T> >& samples)
+{
+	const unsigned char* end = p + size;
+	size_t timestamp = 0;
+	T state = 0;
+	for (size_t i = 0; i < count; ++i)
+	{
+		unsigned long long dt, ds;
+		if (!ScopeGetVarint(p, end, dt) || !ScopeGetVarint(p, end, ds)) return false;
+		timestamp += (size_t)ScopeUnZigZag(dt);
+		state = (T)((long long)state + ScopeUnZigZag(ds));
+		fileSample<T> s;
+		s.channel = channel;
+		s.state = state;
+		s.timestamp = timestamp;
+		samples.push_back(s);
+	}
+	return true;
+}
+
+// compress raw into data when that makes it smaller, otherwise copy it; returns the flags
+inline unsigned long ScopePack(const std::vector<unsigned char>& raw, std::vector<unsigned char>& data)
+{
+	size_t pos = data.size();
+	data.resize(pos + raw.size());
+	size_t size = raw.size() ? ScopeCompress(&raw[0], raw.size(), &data[pos], raw.size()) : 0;
+	if (size)
+	{
+		data.resize(pos + size);
+		return SCOPE_CHUNK_PACKED;
+	}
+	if (raw.size()) memcpy(&data[pos], &raw[0], raw.size());
+	return 0;
+}
+
+// encode and compress the samples of one chunk into data, interleaved or per channel
+template <typename T>
+void ScopePackChunk(const fileSample<T>* samples, size_t count, bool columns, scopeChunkHeader& header, std::vector<unsigned char>& data)
+{
+	header.magic = SCOPE_CHUNK_MAGIC;
+	header.count = (unsigned long)count;
+	header.first = header.last = count ? samples[0].timestamp : 0;
+	for (size_t i = 1; i < count; ++i)
+	{
+		if (samples[i].timestamp < header.first) header.first = samples[i].timestamp;
+		if (samples[i].timestamp > header.last) header.last = samples[i].timestamp;
+	}
+	data.clear();
+	std::vector<unsigned char> raw;
+	if (!columns)
+	{
+		ScopeEncodeSamples<T>(samples, count, raw);
+		header.rawSize = (unsigned long)raw.size();
+		header.flags = ScopePack(raw, data);
+		header.packedSize = (unsigned long)data.size();
+		return;
+	}
+	std::vector<std::vector<fileSample<T> > > channels(256);
+	for (size_t i = 0; i < count; ++i)
+	{
+		channels[(unsigned char)samples[i].channel].push_back(samples[i]);
+	}
+	std::vector<scopeColumnHeader> directory;
+	std::vector<unsigned char> column_data;
+	for (size_t c = 0; c < channels.size(); ++c)
+	{
+		if (channels[c].empty()) continue;
+		raw.clear();
+		ScopeEncodeColumn<T>(channels[c], raw);
+		size_t pos = column_data.size();
+		scopeColumnHeader column = { (char)c, (unsigned long)channels[c].size(), (unsigned long)raw.size(), 0, 0 };
+		column.flags = ScopePack(raw, column_data);
+		column.packedSize = (unsigned long)(column_data.size() - pos);
+		directory.push_back(column);
+	}
+	header.rawSize = (unsigned long)(directory.size() * sizeof(scopeColumnHeader));
+	header.flags = SCOPE_CHUNK_COLUMNS;
+	data.resize(header.rawSize);
+	if (header.rawSize) memcpy(&data[0], &directory[0], header.rawSize);
+	data.insert(data.end(), column_data.begin(), column_data.end());
+	header.packedSize = (unsigned long)data.size();
+}
+
+// edge index: per channel the times of the edges (the changes of the level state != 0), so the
+// navigation commands find the next edge, pulse or gap without reading the samples.
+// the times are stored as varint deltas in blocks of SCOPE_EDGE_BLOCK edges. a block holds the
+// time of its first edge and the shortest and longest interval per level that starts in it.
+// a segment tree over the complete blocks finds the first block with a matching interval,
+// so a search is O(log n) plus the decoding of two blocks.
+// the index of a complete recording is saved in the appendix (an 'edges' line with the size of
+// the block): per channel a scopeEdgeHeader, its blocks and its deltas. the tree is rebuilt on load.
+#define SCOPE_EDGE_BLOCK 256
+#define SCOPE_EDGE_NONE  ((size_t)-1)
+
+#pragma pack(push, r1, 1)
+struct scopeEdgeHeader
+{
+	unsigned char channel;
+	char          first;  // level before the first edge
+	char          level;  // level after the last edge
+	size_t        count;  // edges
+	size_t        last;   // time of the last edge
+	size_t        blocks; // number of scopeEdgeBlock entries
+	size_t        data;   // size of the deltas
+};
+#pragma pack(pop, r1)
+
+struct scopeEdgeSpan
+{
+	size_t min[2]; // shortest interval at level 0 and 1, SCOPE_EDGE_NONE if none
+	size_t max[2]; // longest interval at level 0 and 1
+
+	void clear()
+	{
+		min[0] = min[1] = SCOPE_EDGE_NONE;
+		max[0] = max[1] = 0;
+	}
+
+	void add(size_t width, int level)
+	{
+		if (width < min[level]) min[level] = width;
+		if (width > max[level]) max[level] = width;
+	}
+
+	void add(const scopeEdgeSpan& span)
+	{
+		for (int level = 0; level < 2; ++level)
+		{
+			if (span.min[level] < min[level]) min[level] = span.min[level];
+			if (span.max[level] > max[level]) max[level] = span.max[level];
+		}
+	}
+};
+
+struct scopeEdgeBlock
+{
+	size_t        timestamp; // of the first edge of the block
+	size_t        offset;    // in data: the delta of the second edge
+	scopeEdgeSpan span;      // of the intervals that start in the block
+};
+
+class scopeEdges
+{
+public:
+	enum EFind { findNextEdge, findPrevEdge, findShorter, findLonger, findGap };
+
+	struct channel
+	{
+		channel() : size(0), count(0), last(0), first(0), level(-1) {}
+		std::vector<unsigned char>  data;   // the deltas of the edges that do not start a block
+		std::vector<scopeEdgeBlock> blocks;
+		std::vector<scopeEdgeSpan>  tree;   // node 1 is the root, complete block b is leaf size + b
+		size_t size;   // leaves of the tree
+		size_t count;  // edges
+		size_t last;   // time of the last edge
+		char   first;  // level before the first edge
+		char   level;  // current level, -1: unknown
+	};
+
+	scopeEdges()
+	: m_complete(false)
+	{}
+
+	void clear()
+	{
+		m_channels.clear();
+		m_scanned.clear();
+		m_complete = false;
+	}
+
+	// all edges of the channel are added: by the recording or by a scan of its samples
+	bool IsComplete(size_t channel) const
+	{
+		return m_complete || ((channel < m_scanned.size()) && m_scanned[channel]);
+	}
+
+	// before a scan of the samples of the channel
+	void Restart(size_t channel)
+	{
+		if (channel >= m_channels.size()) m_channels.resize(channel + 1);
+		m_channels[channel] = scopeEdges::channel();
+	}
+
+	void SetComplete(size_t channel)
+	{
+		if (channel >= m_scanned.size()) m_scanned.resize(channel + 1, false);
+		m_scanned[channel] = true;
+	}
+
+	// tick events (channel ~i) only provide the initial level of a channel
+	void Add(char channel, unsigned short state, size_t timestamp)
+	{
+		bool tick = channel < 0;
+		size_t c = (unsigned char)(tick ? ~channel : channel);
+		if (c >= m_channels.size()) m_channels.resize(c + 1);
+		scopeEdges::channel& e = m_channels[c];
+		char level = state != 0;
+		if (e.level < 0)
+		{
+			e.first = e.level = level;
+			return;
+		}
+		if (tick || (level == e.level)) return;
+		e.level = level;
+		// the samples are sorted within the delay of the fifo
+		if (timestamp < e.last) timestamp = e.last;
+		if (e.count)
+		{
+			// the interval since the previous edge, at the level before this one
+			e.blocks[(e.count - 1) / SCOPE_EDGE_BLOCK].span.add(timestamp - e.last, !level);
+		}
+		if (e.count % SCOPE_EDGE_BLOCK == 0)
+		{
+			// the previous block is complete: its last interval ends here
+			if (e.blocks.size()) Complete(e, e.blocks.size() - 1);
+			scopeEdgeBlock block = { timestamp, e.data.size() };
+			block.span.clear();
+			e.blocks.push_back(block);
+		}
+		else
+		{
+			ScopePutVarint(e.data, timestamp - e.last);
+		}
+		e.last = timestamp;
+		++e.count;
+	}
+
+	// findNextEdge: the first edge at or after from; findPrevEdge: the last edge before from.
+	// the other searches return the start of the first interval that starts at or after from:
+	// findShorter and findLonger: a pulse at level shorter or longer than width,
+	// findGap: an interval at either level longer than width.
+	bool Find(size_t channel, EFind what, size_t from, size_t width, int level, size_t& timestamp) const
+	{
+		if (channel >= m_channels.size()) return false;
+		const scopeEdges::channel& e = m_channels[channel];
+		size_t i = Lower(e, from);
+		switch (what)
+		{
+		case findNextEdge:
+			if (i >= e.count) return false;
+			timestamp = Time(e, i);
+			return true;
+		case findPrevEdge:
+			if (!i) return false;
+			timestamp = Time(e, i - 1);
+			return true;
+		default:
+			break;
+		}
+		if (i >= e.count) return false;
+		size_t b = i / SCOPE_EDGE_BLOCK;
+		if (Scan(e, b, i, what, width, level, timestamp)) return true;
+		// the complete blocks are in the tree, the last block is not
+		size_t next = Search(e, 1, 0, e.size, b + 1, what, width, level);
+		if (next == SCOPE_EDGE_NONE) next = e.blocks.size() - 1;
+		if (next <= b) return false;
+		return Scan(e, next, next * SCOPE_EDGE_BLOCK, what, width, level, timestamp);
+	}
+
+	bool empty() const { return m_channels.empty(); }
+
+	// the appendix block of the channels with a known level
+	void Save(std::vector<unsigned char>& out) const
+	{
+		out.clear();
+		for (size_t c = 0; c < m_channels.size(); ++c)
+		{
+			const scopeEdges::channel& e = m_channels[c];
+			if (e.level < 0) continue;
+			scopeEdgeHeader header = { (unsigned char)c, e.first, e.level, e.count, e.last, e.blocks.size(), e.data.size() };
+			const unsigned char* p = (const unsigned char*)&header;
+			out.insert(out.end(), p, p + sizeof(header));
+			p = (const unsigned char*)e.blocks.data();
+			out.insert(out.end(), p, p + e.blocks.size() * sizeof(scopeEdgeBlock));
+			out.insert(out.end(), e.data.begin(), e.data.end());
+		}
+	}
+
+	// returns false, and leaves the index empty, when the block is not consistent
+	bool Load(const std::vector<unsigned char>& in)
+	{
+		clear();
+		for (size_t pos = 0; pos < in.size(); )
+		{
+			scopeEdgeHeader header;
+			if (in.size() - pos < sizeof(header)) break;
+			memcpy(&header, &in[pos], sizeof(header));
+			pos += sizeof(header);
+			size_t rest = in.size() - pos;
+			if ((header.blocks != (header.count + SCOPE_EDGE_BLOCK - 1) / SCOPE_EDGE_BLOCK) || (header.blocks > rest / sizeof(scopeEdgeBlock))) break;
+			if (header.data > rest - header.blocks * sizeof(scopeEdgeBlock)) break;
+			if (header.channel >= m_channels.size()) m_channels.resize(header.channel + 1);
+			scopeEdges::channel& e = m_channels[header.channel];
+			e.first = header.first;
+			e.level = header.level;
+			e.count = header.count;
+			e.last = header.last;
+			e.blocks.resize(header.blocks);
+			if (header.blocks) memcpy(&e.blocks[0], &in[pos], header.blocks * sizeof(scopeEdgeBlock));
+			pos += header.blocks * sizeof(scopeEdgeBlock);
+			e.data.assign(in.begin() + pos, in.begin() + pos + header.data);
+			pos += header.data;
+			for (auto& block : e.blocks)
+			{
+				if (block.offset > e.data.size()) return Fail();
+			}
+			// all blocks but the last are complete
+			for (size_t b = 0; b + 1 < e.blocks.size(); ++b) Complete(e, b);
+			if (pos == in.size())
+			{
+				m_complete = true;
+				return true;
+			}
+		}
+		return Fail();
+	}
+
+	std::vector<channel> m_channels;
+	std::vector<bool> m_scanned; // channels of which all samples are added by a scan
+	bool m_complete; // all samples of the recording are added
+
+private:
+	bool Fail()
+	{
+		clear();
+		return false;
+	}
+
+	static void Combine(scopeEdgeSpan& node, const scopeEdgeSpan& left, const scopeEdgeSpan& right)
+	{
+		node = left;
+		node.add(right);
+	}
+
+	static void Complete(channel& e, size_t b)
+	{
+		if (b >= e.size)
+		{
+			// grow the tree and rebuild it from the blocks
+			size_t size = e.size ? e.size : 64;
+			while (b >= size) size *= 2;
+			scopeEdgeSpan none;
+			none.clear();
+			e.tree.assign(2 * size, none);
+			e.size = size;
+			for (size_t k = 0; k < b; ++k) e.tree[size + k] = e.blocks[k].span;
+			for (size_t k = size - 1; k > 0; --k) Combine(e.tree[k], e.tree[2 * k], e.tree[2 * k + 1]);
+		}
+		size_t k = e.size + b;
+		e.tree[k] = e.blocks[b].span;
+		for (k /= 2; k > 0; k /= 2) Combine(e.tree[k], e.tree[2 * k], e.tree[2 * k + 1]);
+	}
+
+	static bool Match(const scopeEdgeSpan& span, EFind what, size_t width, int level)
+	{
+		switch (what)
+		{
+		case findShorter: return span.min[level] < width;
+		case findLonger:  return span.max[level] > width;
+		case findGap:     return (span.max[0] > width) || (span.max[1] > width);
+		default:          return false;
+		}
+	}
+
+	// the first complete block from 'from' with a matching interval: descend into the
+	// leftmost matching subtree of node, which covers the blocks [lo, hi)
+	static size_t Search(const channel& e, size_t node, size_t lo, size_t hi, size_t from, EFind what, size_t width, int level)
+	{
+		if (!e.size || (hi <= from) || !Match(e.tree[node], what, width, level)) return SCOPE_EDGE_NONE;
+		if (node >= e.size) return lo;
+		size_t mid = (lo + hi) / 2;
+		size_t found = Search(e, 2 * node, lo, mid, from, what, width, level);
+		if (found != SCOPE_EDGE_NONE) return found;
+		return Search(e, 2 * node + 1, mid, hi, from, what, width, level);
+	}
+
+	// the times of the edges of block b, followed by the first edge of the next block
+	static void Decode(const channel& e, size_t b, std::vector<size_t>& times)
+	{
+		times.clear();
+		size_t t = e.blocks[b].timestamp;
+		times.push_back(t);
+		size_t count = e.count - b * SCOPE_EDGE_BLOCK;
+		if (count > SCOPE_EDGE_BLOCK) count = SCOPE_EDGE_BLOCK;
+		const unsigned char* p = e.data.data() + e.blocks[b].offset;
+		const unsigned char* end = e.data.data() + e.data.size();
+		unsigned long long delta;
+		for (size_t k = 1; (k < count) && ScopeGetVarint(p, end, delta); ++k)
+		{
+			t += (size_t)delta;
+			times.push_back(t);
+		}
+		if (b + 1 < e.blocks.size()) times.push_back(e.blocks[b + 1].timestamp);
+	}
+
+	static size_t Time(const channel& e, size_t i)
+	{
+		std::vector<size_t> times;
+		Decode(e, i / SCOPE_EDGE_BLOCK, times);
+		return times[i % SCOPE_EDGE_BLOCK];
+	}
+
+	// the index of the first edge at or after timestamp
+	static size_t Lower(const channel& e, size_t timestamp)
+	{
+		std::vector<scopeEdgeBlock>::const_iterator i = std::lower_bound(e.blocks.begin(), e.blocks.end(), timestamp,
+			[](const scopeEdgeBlock& block, size_t t) { return block.timestamp < t; });
+		if (i == e.blocks.begin()) return 0;
+		size_t b = (i - e.blocks.begin()) - 1;
+		std::vector<size_t> times;
+		Decode(e, b, times);
+		size_t k = std::lower_bound(times.begin(), times.end(), timestamp) - times.begin();
+		return b * SCOPE_EDGE_BLOCK + k;
+	}
+
+	// the intervals of block b that start at edge i or later
+	static bool Scan(const channel& e, size_t b, size_t i, EFind what, size_t width, int level, size_t& timestamp)
+	{
+		std::vector<size_t> times;
+		Decode(e, b, times);
+		for (size_t k = i - b * SCOPE_EDGE_BLOCK; k + 1 < times.size(); ++k)
+		{
+			// the level after edge k: the edges alternate from the level before the first edge
+			int after = e.first ^ 1 ^ ((b * SCOPE_EDGE_BLOCK + k) & 1);
+			scopeEdgeSpan span;
+			span.clear();
+			span.add(times[k + 1] - times[k], after);
+			if (Match(span, what, width, level))
+			{
+				timestamp = times[k];
+				return true;
+			}
+		}
+		return false;
+	}
+};
+
+// compound trigger: an expression compiled into a program that the recording thread evaluates
+// on the samples as they are written, so the graph only has to look up the trigger times.
+//   expression := term { '|' term }
+//   term       := factor { '&' factor }
+//   factor     := '!' factor | '(' expression ')' | condition
+//   condition  := high(pin) | low(pin)                         the level of a pin
+//              |  rise(pin) | fall(pin) | edge(pin)            an edge of a pin
+//              |  pulse(pin < time) | pulse(pin > time)        the end of a high pulse shorter or longer than time
+//              |  lowpulse(pin < time) | lowpulse(pin > time)  the end of a low pulse
+//              |  after(a, b, time)                            b at most time after a (a and b are expressions)
+// pin: the name or the number of a pin. time: a number with unit ns, us, ms (default) or s.
+// the program is evaluated at the samples of the pins it uses. the trigger fires when the
+// expression becomes true, or when it is true at an edge.
+#define SCOPE_TRIGGER_FIRES 64 // the most recent trigger times
+#define SCOPE_TRIGGER_STACK 32
+
+struct SItems;
+
+struct scopeTriggerOp
+{
+	enum ECode { opHigh, opLow, opRise, opFall, opEdge, opShorter, opLonger, opLowShorter, opLowLonger, opAfter, opAnd, opOr, opNot };
+	ECode  code;
+	size_t channel;
+	size_t duration; // in timestamp units
+};
+
+class scopeTrigger
+{
+public:
+	scopeTrigger()
+	: m_set(false)
+	, m_fired(0)
+	{
+		Reset();
+	}
+
+	// on the GUI thread: replaces the program of the recording thread
+	bool Compile(const wxString& expression, const SItems& pins, wxString& error);
+	void Clear();
+	bool IsSet() const { return m_set; }
+	// at the start of a recording: forgets the levels and the trigger times
+	void Restart()
+	{
+		wxCriticalSectionLocker lock(m_lock);
+		Reset();
+		m_fired = 0;
+	}
+	wxString Expression() const { return m_expression; }
+
+	// the first trigger after timestamp, 0 if none.
+	// without lock: the recording thread reuses the slot of the oldest trigger, so that one is
+	// skipped, and the slots it reused while they were read are discarded
+	size_t Next(size_t after) const
+	{
+		size_t fired = m_fired.load(std::memory_order_acquire);
+		size_t first = (fired >= SCOPE_TRIGGER_FIRES) ? fired - SCOPE_TRIGGER_FIRES + 1 : 0;
+		size_t times[SCOPE_TRIGGER_FIRES];
+		for (size_t i = first; i < fired; ++i)
+		{
+			times[i - first] = m_fires[i % SCOPE_TRIGGER_FIRES].load(std::memory_order_relaxed);
+		}
+		std::atomic_thread_fence(std::memory_order_acquire);
+		size_t now = m_fired.load(std::memory_order_relaxed);
+		if (now < fired) return 0; // restarted
+		size_t valid = (now >= SCOPE_TRIGGER_FIRES) ? now - SCOPE_TRIGGER_FIRES + 1 : 0;
+		size_t next = 0;
+		for (size_t i = (first > valid) ? first : valid; i < fired; ++i)
+		{
+			size_t t = times[i - first];
+			if ((t > after) && (!next || (t < next))) next = t;
+		}
+		return next;
+	}
+
+	// on the recording thread: the samples in the order they are written
+	template <typename T>
+	void Process(const fileSample<T>* samples, size_t count)
+	{
+		if (!m_set) return;
+		wxCriticalSectionLocker lock(m_lock);
+		for (size_t k = 0; k < count; ++k)
+		{
+			Sample(samples[k].channel, samples[k].state, samples[k].timestamp);
+		}
+	}
+
+private:
+	void Reset()
+	{
+		m_level.assign(128, -1);
+		m_rise.assign(128, 0);
+		m_fall.assign(128, 0);
+		m_after.assign(m_program.size(), 0);
+		m_edge = 0;
+		m_edgeChannel = 0;
+		m_value = false;
+	}
+
+	void Sample(char channel, unsigned short state, size_t timestamp)
+	{
+		bool tick = channel < 0;
+		size_t c = (unsigned char)(tick ? ~channel : channel);
+		if ((c >= m_used.size()) || !m_used[c]) return;
+		char level = state != 0;
+		if (tick)
+		{
+			// tick events only provide the initial level
+			if (m_level[c] < 0) m_level[c] = level;
+			return;
+		}
+		m_edge = 0;
+		if ((m_level[c] >= 0) && (level != m_level[c]))
+		{
+			m_edge = level ? 1 : -1;
+			if (level) m_rise[c] = timestamp;
+			else m_fall[c] = timestamp;
+		}
+		m_level[c] = level;
+		m_edgeChannel = c;
+		bool event = false;
+		bool value = Evaluate(timestamp, event);
+		if (value && (!m_value || event))
+		{
+			// a reader that sees the new time in the slot also sees the count of the previous trigger
+			size_t fired = m_fired.load(std::memory_order_relaxed);
+			m_fires[fired % SCOPE_TRIGGER_FIRES].store(timestamp, std::memory_order_release);
+			m_fired.store(fired + 1, std::memory_order_release);
+		}
+		m_value = value;
+	}
+
+	bool Evaluate(size_t timestamp, bool& event)
+	{
+		bool stack[SCOPE_TRIGGER_STACK];
+		size_t n = 0;
+		for (size_t i = 0; i < m_program.size(); ++i)
+		{
+			const scopeTriggerOp& op = m_program[i];
+			// the pulse of an edge: the rise and fall times are already those of this edge
+			bool rise = (op.channel == m_edgeChannel) && (m_edge > 0);
+			bool fall = (op.channel == m_edgeChannel) && (m_edge < 0);
+			bool r = false;
+			switch (op.code)
+			{
+			case scopeTriggerOp::opHigh:       r = m_level[op.channel] == 1; break;
+			case scopeTriggerOp::opLow:        r = m_level[op.channel] == 0; break;
+			case scopeTriggerOp::opRise:       r = rise; event |= r; break;
+			case scopeTriggerOp::opFall:       r = fall; event |= r; break;
+			case scopeTriggerOp::opEdge:       r = rise || fall; event |= r; break;
+			case scopeTriggerOp::opShorter:    r = fall && m_rise[op.channel] && (timestamp - m_rise[op.channel] < op.duration); event |= r; break;
+			case scopeTriggerOp::opLonger:     r = fall && m_rise[op.channel] && (timestamp - m_rise[op.channel] > op.duration); event |= r; break;
+			case scopeTriggerOp::opLowShorter: r = rise && m_fall[op.channel] && (timestamp - m_fall[op.channel] < op.duration); event |= r; break;
+			case scopeTriggerOp::opLowLonger:  r = rise && m_fall[op.channel] && (timestamp - m_fall[op.channel] > op.duration); event |= r; break;
+			case scopeTriggerOp::opAfter:
+			{
+				bool b = stack[--n];
+				bool a = stack[--n];
+				if (a) m_after[i] = timestamp;
+				r = b && m_after[i] && (timestamp - m_after[i] <= op.duration);
+				event |= r;
+				break;
+			}
+			case scopeTriggerOp::opAnd: r = stack[n - 2] && stack[n - 1]; n -= 2; break;
+			case scopeTriggerOp::opOr:  r = stack[n - 2] || stack[n - 1]; n -= 2; break;
+			case scopeTriggerOp::opNot: r = !stack[--n]; break;
+			}
+			stack[n++] = r;
+		}
+		return n && stack[n - 1];
+	}
+
+	wxCriticalSection           m_lock;    // the program and its state
+	std::vector<scopeTriggerOp> m_program; // postfix
+	std::vector<bool>           m_used;    // per channel: used by the program
+	std::vector<char>           m_level;   // per channel: -1 unknown
+	std::vector<size_t>         m_rise;    // per channel: the last rising edge
+	std::vector<size_t>         m_fall;
+	std::vector<size_t>         m_after;   // per opAfter: the last time its first operand was true
+	int                         m_edge;    // at the current sample: 1 rising, -1 falling
+	size_t                      m_edgeChannel;
+	bool                        m_value;   // at the previous sample
+	wxString                    m_expression;
+	std::atomic<bool>           m_set;
+	std::atomic<size_t>         m_fires[SCOPE_TRIGGER_FIRES]; // trigger i is in slot i % SCOPE_TRIGGER_FIRES
+	std::atomic<size_t>         m_fired;   // number of triggers
+};
+
 class threadScopeBase : public wxThread
 {
 public:
@@ -39,18 +1484,33 @@ public:
 	volatile bool    m_stop;
 };
 
+struct scopeDevice;
+template <typename T> class fileSampleFifo;
+template <typename T> class scopeMerge;
+
 template <typename T> 
 class threadScope : public threadScopeBase
 {
 public:
-	threadScope(panelScope * scope)
+	// device and merge: a lane of a recording of several devices, see panelScope::OpenDevices.
+	// the thread of the main window (device NULL) owns the merge.
+	threadScope(panelScope * scope, scopeDevice* device = NULL, scopeMerge<T>* merge = NULL, size_t lane = 0)
 	: m_scope(scope)
+	, m_device(device)
+	, m_merge(merge)
+	, m_lane(lane)
 	{
 	}
 
+	~threadScope();
+
 	void* Entry();
+	void Acquire(fileSampleFifo<T>& fileData);
 
 	panelScope* m_scope;
+	scopeDevice* m_device;
+	scopeMerge<T>* m_merge;
+	size_t m_lane;
 };
 
 template <typename T>
@@ -59,13 +1519,13 @@ struct scopePages
 	scopePages()
 	: m_file(INVALID_HANDLE_VALUE)
 	, m_filesize(0)
-	, m_map(NULL)
 	, m_mem(NULL)
 	, m_offset(0)
 	, m_size(0)
 	, m_begin(NULL)
 	, m_end(NULL)
 	, m_lastsample(0)
+	, m_base(0)
 	{}
 
 	~scopePages()
@@ -73,7 +1533,7 @@ struct scopePages
 		SetFile(INVALID_HANDLE_VALUE,0);
 	}
 
-	void SetFile(HANDLE file, size_t lastsample)
+	void SetFile(HANDLE file, size_t lastsample, size_t base = 0)
 	{
 		if (m_file != INVALID_HANDLE_VALUE)
 		{
@@ -85,6 +1545,7 @@ struct scopePages
 		m_begin = NULL;
 		m_end = NULL;
 		m_lastsample = lastsample;
+		m_base = base;
 	}
 
 	void SetLastSample(size_t lastsample)
@@ -92,27 +1553,24 @@ struct scopePages
 		m_lastsample = lastsample;
 	}
 
+	// releases the view, so the file can be truncated
 	void Unmap()
 	{
-		if (m_mem)
-		{
-			UnmapViewOfFile(m_mem);
-			m_mem = NULL;
-			m_begin = NULL;
-			m_end = NULL;
-			m_size = 0;
-		}
-		if (m_map)
-		{
-			CloseHandle(m_map);
-			m_map = NULL;
-		}
+		m_view.Unmap();
+		m_mem = NULL;
+		m_begin = NULL;
+		m_end = NULL;
+		m_size = 0;
 	}
 
+	// the pages are windows in a persistent view: moving within the view is pointer arithmetic
 	fileSample<T>* Map(size_t page, size_t count)
 	{
 		if (count < 1) count = 1;
-		Unmap();
+		m_mem = NULL;
+		m_begin = NULL;
+		m_end = NULL;
+		m_size = 0;
 		if (m_lastsample)
 		{
 			m_filesize = m_lastsample;
@@ -121,22 +1579,49 @@ struct scopePages
 		{
 			GetFileSizeEx(m_file, (LARGE_INTEGER*)&m_filesize);
 		}
-		m_offset = m_mapPageSize * page;
+		// the pages are counted from the first sample
+		m_offset = m_base + m_mapPageSize * page;
 		if (m_offset >= m_filesize) return NULL;
-		m_size = m_mapPageSize * (count + 1); // allocate one page more to handle non-aligned samples
-		if ((m_offset + m_size) > m_filesize) m_size = m_filesize - m_offset;
-		m_map = CreateFileMapping(m_file, NULL, PAGE_READONLY, 0, 0, NULL);
-		if (!m_map) return NULL;
-		m_mem = MapViewOfFile(m_map, FILE_MAP_READ, ((DWORD*)&m_offset)[1], ((DWORD*)&m_offset)[0], m_size);
-		if (!m_mem) return NULL;
-		size_t index_first = (m_offset + sizeof(fileSample<T>)  - 1) / sizeof(fileSample<T>);
-		size_t offset_first = index_first * sizeof(fileSample<T>) - m_offset;
+		size_t size = m_mapPageSize * (count + 1); // one page more to handle non-aligned samples
+		if ((m_offset + size) > m_filesize) size = m_filesize - m_offset;
+		if (!m_view.Contains(m_offset, size) && !MapView(size)) return NULL;
+		m_size = size;
+		m_mem = (void*)m_view.At(m_offset);
+		size_t data_offset = m_offset - m_base;
+		size_t index_first = (data_offset + sizeof(fileSample<T>)  - 1) / sizeof(fileSample<T>);
+		size_t offset_first = index_first * sizeof(fileSample<T>) - data_offset;
 		m_begin = (fileSample<T>*)((unsigned char*)m_mem + offset_first);
-		size_t index_last = (m_offset + m_size) / sizeof(fileSample<T>);
+		size_t index_last = (data_offset + m_size) / sizeof(fileSample<T>);
 		m_end = m_begin + (index_last - index_first);
 		return m_begin;
 	}
 
+	// 64-bit: map the whole file, a growing file is mapped again up to its new size.
+	// 32-bit: map a window of SCOPE_MAP_WINDOW around the requested pages.
+	bool MapView(size_t size)
+	{
+		size_t begin = 0;
+		size_t end = m_filesize;
+		if (sizeof(void*) < 8)
+		{
+			if (m_offset > SCOPE_MAP_WINDOW / 2) begin = (m_offset - SCOPE_MAP_WINDOW / 2) / m_mapPageSize * m_mapPageSize;
+			if (end - begin > SCOPE_MAP_WINDOW) end = begin + SCOPE_MAP_WINDOW;
+			if (end < m_offset + size) end = m_offset + size;
+		}
+		if (!m_view.Map(m_file, begin, end - begin)) return false;
+		// the graph jumps through the file: no read ahead
+		m_view.Advise(nkbefMap::ADVICE_RANDOM);
+		return true;
+	}
+
+	fileSample<T>* MapOffset(size_t offset)
+	{
+		if ((offset < m_base) || !Map((offset - m_base) / m_mapPageSize, 10)) return NULL;
+		fileSample<T>* sample = (fileSample<T>*)((unsigned char*)m_mem + (offset - m_offset));
+		if (sample >= m_end) return NULL;
+		return sample;
+	}
+
 	fileSample<T> * MapNext(size_t count)
 	{
 		if (count < 2) count = 2;
@@ -155,7 +1640,7 @@ struct scopePages
 			return NULL; // no more data available
 		}
 		size_t next_offset = m_offset + ((unsigned char*)m_end - (unsigned char*)m_mem);
-		size_t next_page = next_offset / m_mapPageSize;
+		size_t next_page = (next_offset - m_base) / m_mapPageSize;
 		if (!Map(next_page, count)) return NULL; // mapping failed ???
 		next_offset -= m_offset;
 		return (fileSample<T>*)((unsigned char*)m_mem + next_offset);
@@ -164,10 +1649,10 @@ struct scopePages
 	fileSample<T>* MapPrev(size_t count)
 	{
 		if (count < 2) count = 2;
-		if (m_offset == 0LL) return NULL;
+		if (m_offset <= m_base) return NULL;
 		size_t move_back = (m_mapPageSize * (count - 1));
-		if (move_back > m_offset) move_back = m_offset;
-		size_t next_offset = m_offset - move_back;
+		if (move_back > m_offset - m_base) move_back = m_offset - m_base;
+		size_t next_offset = m_offset - m_base - move_back;
 		size_t next_page = next_offset / m_mapPageSize;
 		size_t sample = m_offset + ((unsigned char*)m_begin - (unsigned char*)m_mem);
 		if (!Map(next_page, count)) return NULL; // mapping failed ???
@@ -177,14 +1662,273 @@ struct scopePages
 
 	HANDLE m_file;
 	size_t m_filesize;
-	HANDLE m_map;
-	void* m_mem;
+	nkbefMap m_view;     // persistent view of the file
+	void* m_mem;         // m_offset in the view
 	size_t m_offset;
 	size_t m_size;
 	fileSample<T>* m_begin;
 	fileSample<T>* m_end;
 	static DWORD m_mapPageSize;
 	size_t m_lastsample;
+	size_t m_base;       // offset of the first sample: the size of the header
+};
+
+// reads the chunks of a compressed recording on demand and keeps the last used ones decoded
+template <typename T>
+struct scopeChunks
+{
+	struct chunk
+	{
+		size_t index;
+		std::vector<fileSample<T> > samples;
+	};
+
+	scopeChunks()
+	: m_file(INVALID_HANDLE_VALUE)
+	, m_current(0)
+	, m_begin(NULL)
+	, m_end(NULL)
+	{}
+
+	void SetFile(HANDLE file)
+	{
+		m_file = file;
+		m_table.clear();
+		m_cache.clear();
+		Unmap();
+	}
+
+	void SetTable(const scopeChunkIndex& table)
+	{
+		m_table = table;
+		m_cache.clear();
+		Unmap();
+	}
+
+	void SetChannels(const std::vector<bool>& channels)
+	{
+		m_channels = channels;
+		m_cache.clear();
+		Unmap();
+	}
+
+	void Unmap()
+	{
+		m_current = 0;
+		m_begin = NULL;
+		m_end = NULL;
+	}
+
+	// drop the least recently used chunk, but never the mapped one: the reader points into its samples
+	void Evict()
+	{
+		for (typename std::list<chunk>::iterator c = m_cache.end(); c != m_cache.begin(); )
+		{
+			--c;
+			if (!m_begin || (c->index != m_current))
+			{
+				m_cache.erase(c);
+				return;
+			}
+		}
+	}
+
+	// returns NULL on a read error or when the chunk holds none of the selected channels
+	fileSample<T>* Load(size_t index)
+	{
+		if (index >= m_table.size()) return NULL;
+		typename std::list<chunk>::iterator c = m_cache.begin();
+		for (; c != m_cache.end(); ++c)
+		{
+			if (c->index == index) break;
+		}
+		if (c != m_cache.end())
+		{
+			m_cache.splice(m_cache.begin(), m_cache, c);
+		}
+		else
+		{
+			if (m_cache.size() >= SCOPE_CHUNK_CACHE) Evict();
+			m_cache.push_front(chunk());
+			m_cache.front().index = index;
+			if (!Read(m_table[index], m_cache.front().samples))
+			{
+				m_cache.pop_front();
+				return NULL;
+			}
+		}
+		std::vector<fileSample<T> >& samples = m_cache.front().samples;
+		if (!samples.size()) return NULL;
+		m_current = index;
+		m_begin = &samples[0];
+		m_end = m_begin + samples.size();
+		return m_begin;
+	}
+
+	bool ReadAt(size_t offset, void* data, size_t size)
+	{
+		OVERLAPPED ov = { 0 };
+		ov.Offset = ((DWORD*)&offset)[0];
+		ov.OffsetHigh = ((DWORD*)&offset)[1];
+		DWORD read = 0;
+		return !size || (ReadFile(m_file, data, DWORD(size), &read, &ov) && (read == size));
+	}
+
+	// read the data at offset and decompress it into m_raw
+	const unsigned char* Unpack(size_t offset, size_t packed_size, size_t raw_size, unsigned long flags)
+	{
+		m_packed.resize(packed_size + 1);
+		if (!ReadAt(offset, &m_packed[0], packed_size)) return NULL;
+		if (!(flags & SCOPE_CHUNK_PACKED)) return &m_packed[0];
+		m_raw.resize(raw_size + 1);
+		if (!ScopeDecompress(&m_packed[0], packed_size, &m_raw[0], raw_size)) return NULL;
+		return &m_raw[0];
+	}
+
+	bool Read(const scopeChunkEntry& entry, std::vector<fileSample<T> >& samples)
+	{
+		scopeChunkHeader header;
+		if (!ReadAt(entry.offset, &header, sizeof(header))) return false;
+		if ((header.magic != SCOPE_CHUNK_MAGIC) || (header.count != entry.count)) return false;
+		size_t offset = entry.offset + sizeof(header);
+		if (header.flags & SCOPE_CHUNK_COLUMNS)
+		{
+			// read only the columns of the selected channels
+			std::vector<scopeColumnHeader> directory(header.rawSize / sizeof(scopeColumnHeader));
+			if (directory.empty() || !ReadAt(offset, &directory[0], header.rawSize)) return false;
+			offset += header.rawSize;
+			samples.clear();
+			for (auto& column : directory)
+			{
+				if (ScopeSelected(m_channels, column.channel))
+				{
+					const unsigned char* p = Unpack(offset, column.packedSize, column.rawSize, column.flags);
+					if (!p || !ScopeDecodeColumn<T>(p, column.rawSize, column.count, column.channel, samples)) return false;
+				}
+				offset += column.packedSize;
+			}
+			std::stable_sort(samples.begin(), samples.end(),
+				[](const fileSample<T>& a, const fileSample<T>& b) { return a.timestamp < b.timestamp; });
+			return true;
+		}
+		const unsigned char* p = Unpack(offset, header.packedSize, header.rawSize, header.flags);
+		size_t size = (header.flags & SCOPE_CHUNK_PACKED) ? header.rawSize : header.packedSize;
+		if (!p || !ScopeDecodeSamples<T>(p, size, header.count, samples)) return false;
+		if (!m_channels.empty())
+		{
+			const std::vector<bool>& channels = m_channels;
+			samples.erase(std::remove_if(samples.begin(), samples.end(),
+				[&channels](const fileSample<T>& s) { return !ScopeSelected(channels, s.channel); }), samples.end());
+		}
+		return true;
+	}
+
+	// map the first chunk that can hold samples at or after first
+	fileSample<T>* Find(size_t first)
+	{
+		scopeChunkIndex::iterator i = std::upper_bound(m_table.begin(), m_table.end(), first,
+			[](size_t t, const scopeChunkEntry& e) { return t < e.first; });
+		if (i != m_table.begin()) --i;
+		while ((i != m_table.begin()) && ((i - 1)->last >= first)) --i;
+		for (size_t index = i - m_table.begin(); index < m_table.size(); ++index)
+		{
+			if (Load(index)) return m_begin;
+		}
+		return NULL;
+	}
+
+	// chunks without samples of the selected channels are skipped
+	fileSample<T>* MapNext()
+	{
+		for (size_t index = m_begin ? m_current + 1 : 0; index < m_table.size(); ++index)
+		{
+			if (Load(index)) return m_begin;
+		}
+		return NULL;
+	}
+
+	fileSample<T>* MapPrev()
+	{
+		if (!m_begin) return NULL;
+		for (size_t index = m_current; index-- > 0; )
+		{
+			if (Load(index)) return m_end - 1;
+		}
+		return NULL;
+	}
+
+	HANDLE m_file;
+	scopeChunkIndex m_table;
+	std::vector<bool> m_channels; // selected channels, empty for all
+	std::list<chunk> m_cache;   // most recently used first
+	std::vector<unsigned char> m_packed;
+	std::vector<unsigned char> m_raw;
+	size_t m_current;           // index of the mapped chunk
+	fileSample<T>* m_begin;
+	fileSample<T>* m_end;
+};
+
+// sequential reader of all samples of a saved recording, to save it in another format:
+// the samples of an uncompressed recording are read from the file, the chunks of a
+// compressed one are decoded by scopeChunks
+template <typename T>
+struct scopeSampleSource
+{
+	scopeSampleSource(HANDLE file, size_t base, size_t end, const scopeChunkIndex& chunks)
+	: m_file(file)
+	, m_offset(base)
+	, m_end(end)
+	, m_next(0)
+	, m_error(false)
+	{
+		if (chunks.size())
+		{
+			m_chunks.SetFile(file);
+			m_chunks.SetTable(chunks);
+		}
+		else
+		{
+			SetFilePointerEx(file, *(LARGE_INTEGER*)&base, NULL, FILE_BEGIN);
+		}
+	}
+
+	// returns the number of samples read into samples: 0 at the end or on an error (m_error)
+	size_t Read(std::vector<fileSample<T> >& samples)
+	{
+		if (m_chunks.m_table.size())
+		{
+			if (m_next >= m_chunks.m_table.size()) return 0;
+			// without channel selection a chunk only fails to load on a read or decode error
+			fileSample<T>* begin = m_chunks.Load(m_next++);
+			if (!begin)
+			{
+				m_error = true;
+				return 0;
+			}
+			samples.assign(begin, m_chunks.m_end);
+			return samples.size();
+		}
+		if (m_offset + sizeof(fileSample<T>) > m_end) return 0;
+		size_t count = (m_end - m_offset) / sizeof(fileSample<T>);
+		if (count > SCOPE_CHUNK_SAMPLES) count = SCOPE_CHUNK_SAMPLES;
+		samples.resize(count);
+		DWORD size = DWORD(count * sizeof(fileSample<T>));
+		DWORD read = 0;
+		if (!ReadFile(m_file, &samples[0], size, &read, NULL) || (read != size))
+		{
+			m_error = true;
+			return 0;
+		}
+		m_offset += size;
+		return count;
+	}
+
+	HANDLE         m_file;
+	scopeChunks<T> m_chunks;
+	size_t         m_offset;
+	size_t         m_end;
+	size_t         m_next;  // next chunk
+	bool           m_error;
 };
 
 template <typename T>
@@ -202,8 +1946,15 @@ public:
 		Reset();
 	}
 
-	void SetFile(HANDLE file, size_t lastsample) { m_file = file; m_pages.SetFile(file, lastsample); m_sample = NULL; }
+	void SetFile(HANDLE file, size_t lastsample, size_t base = 0) { m_file = file; m_pages.SetFile(file, lastsample, base); m_chunks.SetFile(file); m_sample = NULL; m_index.clear(); }
 	void SetLastSample(size_t lastsample) { m_pages.SetLastSample(lastsample); }
+	void SetIndex(const scopeIndex& index) { m_index = index; }
+	void SetChunks(const scopeChunkIndex& chunks) { m_chunks.SetTable(chunks); m_sample = NULL; }
+	// iterate only the samples of the selected channels (empty: all channels)
+	void SetChannels(const std::vector<bool>& channels) { m_channels = channels; m_chunks.SetChannels(channels); m_sample = NULL; m_pages.Unmap(); }
+	bool IsChunked() { return m_chunks.m_table.size() != 0; }
+	fileSample<T>* Begin() { return IsChunked() ? m_chunks.m_begin : m_pages.m_begin; }
+	fileSample<T>* End() { return IsChunked() ? m_chunks.m_end : m_pages.m_end; }
 	fileSample<T>* First(size_t first);
 	void Reset();
 	fileSample<T>* Next();
@@ -212,4 +1963,7 @@ public:
 	HANDLE         m_file;
 	scopePages<T>  m_pages;
 	fileSample<T>* m_sample;   // pointer to current sample
+	scopeIndex     m_index;    // seek index of a saved recording (empty while recording)
+	scopeChunks<T> m_chunks;   // decoded chunks of a compressed recording
+	std::vector<bool> m_channels; // channel filter
 };
@@ -59,6 +59,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <math.h>
 #include <share.h>
 #include <tchar.h>
 
@@ -67,6 +68,8 @@
 #include <set>
 #include <vector>
 #include <list>
+#include <algorithm>
+#include <atomic>
 
 #ifndef countof
 #define countof(A) (sizeof(A)/sizeof((A)[0]))
@@ -100,6 +103,7 @@ inline size_t wxGetFileLength(HANDLE file)
 enum EMODE { MODE_CONTROL, MODE_VIEW, MODE_RECORD};
 #include "NkDigTimerGraph.h"
 #include "NkDigTimer.h"
+#include "NkDigTimerParse.h"
 #include "NkDigTimerUpload.h"
 
 void GetAllPortsInfo(std::map<wxString, wxString>& ports);
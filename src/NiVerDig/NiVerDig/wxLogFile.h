@@ -1,17 +1,53 @@
 #pragma once
 
+class wxLogFile;
+
+// drains the queue of the log file into the file
+class wxLogFileWriter : public wxThread
+{
+public:
+	wxLogFileWriter(wxLogFile* log)
+	: wxThread(wxTHREAD_JOINABLE)
+	, m_log(log)
+	{}
+	void* Entry();
+	wxLogFile* m_log;
+};
+
+// log of the serial communication. Log only queues the line with its time: a background
+// thread writes the queue into the buffered file and flushes it every m_period ms.
 class wxLogFile
 {
 public:
+	struct entry
+	{
+		std::atomic<entry*> next;
+		LONGLONG            time; // us since Open
+		long                send; // 1: sent, 0: received, -1: note
+		wxString            text;
+	};
+
 	wxLogFile()
 	: m_file(NULL)
+	, m_writer(NULL)
+	, m_event(NULL)
+	, m_period(50)
+	, m_head(&m_stub)
+	, m_tail(&m_stub)
+	, m_queued(0)
+	, m_written(0)
+	, m_flushed(0)
+	, m_stop(false)
 	{
 		m_name[0] = 0;
+		m_stub.next = NULL;
+		m_event = CreateEvent(NULL, FALSE, FALSE, NULL);
 		Open();
 	}
 	~wxLogFile()
 	{
 		Close();
+		if (m_event) CloseHandle(m_event);
 	}
 	
 	bool Open()
@@ -20,48 +56,180 @@ public:
 		GetTempPath(_MAX_FNAME, m_name);
 		GetTempFileName(m_name, L"nkdt", 0, m_name);
 		m_file = _wfsopen(m_name,  L"wt", _SH_DENYWR);
-		return m_file != NULL;
+		if (!m_file) return false;
+		setvbuf(m_file, NULL, _IOFBF, 1 << 20);
+		QueryPerformanceFrequency(&m_frequency);
+		QueryPerformanceCounter(&m_start);
+		m_stop = false;
+		m_writer = new wxLogFileWriter(this);
+		if (!m_event || (m_writer->Create() != wxTHREAD_NO_ERROR) || (m_writer->Run() != wxTHREAD_NO_ERROR))
+		{
+			// no writer thread: Log writes synchronously
+			delete m_writer;
+			m_writer = NULL;
+		}
+		return true;
 	}
 
 	void Close()
 	{
 		if (!m_file) return;
+		if (m_writer)
+		{
+			m_stop = true;
+			SetEvent(m_event);
+			m_writer->Wait();
+			delete m_writer;
+			m_writer = NULL;
+		}
+		Write();
 		fclose(m_file);
 		m_file = NULL;
 		DeleteFile(m_name);
 	}
 
+	// called by any thread: no file access when the writer thread runs
 	int  Log(const wchar_t* line, long send)
 	{
-		if(send != -1) fwprintf(m_file, send ? L"> " : L"< ");
-		int r = fwprintf(m_file, L"%s", line);
-		fflush(m_file);
+		if (!m_file) return 0;
+		LARGE_INTEGER now;
+		QueryPerformanceCounter(&now);
+		entry* e = new entry;
+		e->next.store(NULL, std::memory_order_relaxed);
+		e->time = (now.QuadPart - m_start.QuadPart) * 1000000 / m_frequency.QuadPart;
+		e->send = send;
+		e->text = line;
+		int r = int(e->text.length());
+		Push(e);
+		++m_queued;
+		if (!m_writer)
+		{
+			Write();
+			fflush(m_file);
+		}
 		return r;
 	}
 
-	FILE*   m_file;
-	wchar_t m_name[_MAX_FNAME];
+	// waits until all lines logged so far are in the file, e.g. before copying it
+	void Flush()
+	{
+		if (!m_writer) return;
+		size_t queued = m_queued;
+		while (m_flushed < queued)
+		{
+			SetEvent(m_event);
+			Sleep(1);
+		}
+	}
+
+	// the writer thread
+	void Drain()
+	{
+		while (1)
+		{
+			// read m_stop first: the lines logged before Close are written by Close
+			bool stop = m_stop;
+			if (Write())
+			{
+				fflush(m_file);
+				m_flushed = m_written;
+			}
+			if (stop) break;
+			WaitForSingleObject(m_event, m_period);
+		}
+	}
+
+	// writes the queued lines; returns their count
+	size_t Write()
+	{
+		size_t count = 0;
+		while (entry* e = Pop())
+		{
+			fwprintf(m_file, L"%llu.%06llu ", e->time / 1000000, e->time % 1000000);
+			if (e->send != -1) fwprintf(m_file, e->send ? L"> " : L"< ");
+			fwprintf(m_file, L"%s", e->text.wc_str());
+			delete e;
+			++count;
+		}
+		m_written += count;
+		return count;
+	}
+
+	// lock free queue with many producers and one consumer (Vyukov): the producers
+	// swap the head, the consumer follows the next pointers from the tail
+	void Push(entry* e)
+	{
+		entry* prev = m_head.exchange(e, std::memory_order_acq_rel);
+		prev->next.store(e, std::memory_order_release);
+	}
+
+	entry* Pop()
+	{
+		entry* tail = m_tail;
+		entry* next = tail->next.load(std::memory_order_acquire);
+		if (tail == &m_stub)
+		{
+			if (!next) return NULL;
+			m_tail = tail = next;
+			next = next->next.load(std::memory_order_acquire);
+		}
+		if (next)
+		{
+			m_tail = next;
+			return tail;
+		}
+		// tail is the last entry unless a producer is between its exchange and store
+		if (tail != m_head.load(std::memory_order_acquire)) return NULL;
+		m_stub.next.store(NULL, std::memory_order_relaxed);
+		Push(&m_stub);
+		next = tail->next.load(std::memory_order_acquire);
+		if (!next) return NULL;
+		m_tail = next;
+		return tail;
+	}
+
+	FILE*               m_file;
+	wchar_t             m_name[_MAX_FNAME];
+	wxLogFileWriter*    m_writer;
+	HANDLE              m_event;   // wakes the writer thread
+	DWORD               m_period;  // ms between the flushes of the writer thread
+	LARGE_INTEGER       m_frequency;
+	LARGE_INTEGER       m_start;   // of Open
+	entry               m_stub;
+	std::atomic<entry*> m_head;    // last entry pushed
+	entry*              m_tail;    // next entry to pop, owned by the writer
+	std::atomic<size_t> m_queued;  // lines logged
+	std::atomic<size_t> m_written; // lines written
+	std::atomic<size_t> m_flushed; // lines flushed to the file
+	std::atomic<bool>   m_stop;
 };
 
+inline void* wxLogFileWriter::Entry()
+{
+	m_log->Drain();
+	return NULL;
+}
+
+// line index of the growing log file for the console: the offsets of the line ends are kept
+// in memory and the text around the lines shown last is cached, so scrolling reads no file.
 class wxIndexTextFile
 {
 public:
 	wxIndexTextFile(const wxString & file)
 		: m_file(INVALID_HANDLE_VALUE)
-		, m_index(INVALID_HANDLE_VALUE)
 		, m_file_len(0)
 		, m_line_count(0)
+		, m_block_begin(0)
+		, m_text_begin(0)
+		, m_text_end(0)
 	{
-		GetTempPath(_MAX_FNAME, m_index_name);
-		GetTempFileName(m_index_name, L"nkdt", 0, m_index_name);
-		m_index = CreateFile(m_index_name, GENERIC_READ| GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_TEMPORARY, NULL);
+		m_chunk.resize(1 << 16);
 		Open(file);
 	}
 
 	~wxIndexTextFile()
 	{
-		CloseHandle(m_index);
-		DeleteFile(m_index_name);
+		Close();
 	}
 
 	bool Open(const wxString& file)
@@ -77,75 +245,83 @@ public:
 		CloseHandle(m_file);
 		m_file = INVALID_HANDLE_VALUE;
 		m_line_count = m_file_len = 0;
-		SetFilePointer(m_index, 0, 0, FILE_BEGIN);
-		SetEndOfFile(m_index);
+		m_lines.clear();
+		m_block.clear();
+		m_block_begin = 0;
+		m_text.clear();
+		m_text_begin = m_text_end = 0;
 	}
 
+	// indexes the lines appended since the last call
 	bool Update()
 	{
 		size_t l = 0;
 		GetFileSizeEx(m_file, (LARGE_INTEGER*) &l);
 		if (l <= m_file_len) return false;
-		BYTE data[1024];
+		SetFilePointerEx(m_file, *(LARGE_INTEGER*)(&m_file_len), NULL, FILE_BEGIN);
 		while (m_file_len < l)
 		{
 			DWORD read = 0;
-			ReadFile(m_file, &data, 1024, &read, NULL);
+			ReadFile(m_file, &m_chunk[0], DWORD(m_chunk.size()), &read, NULL);
 			if (!read) break;
-			for (DWORD i = 0; i < read; ++i)
+			const char* begin = &m_chunk[0];
+			const char* end = begin + read;
+			for (const char* p = begin; (p = (const char*)memchr(p, '\n', end - p)) != NULL; )
 			{
-				if (data[i] == '\n')
-				{
-					DWORD written = 0;
-					size_t line_end = m_file_len + i + 1;
-					WriteFile(m_index, &line_end, sizeof(size_t), &written, NULL);
-					++m_line_count;
-				}
+				++p;
+				m_lines.push_back(m_file_len + (p - begin));
 			}
 			m_file_len += read;
 		}
+		m_line_count = m_lines.size();
 		return true;
 	}
 
 	wxString GetText(size_t begin_line, size_t end_line)
 	{
-		DWORD read = 0;
+		if (!m_line_count) return wxEmptyString;
 		if (end_line >= m_line_count) end_line = m_line_count - 1;
 		if (begin_line >= end_line) return wxEmptyString;
-		size_t begin_offset = 0;
-		if (begin_line != 0)
-		{
-			--begin_line;
-			begin_line *= sizeof(size_t);
-			SetFilePointerEx(m_index, *(LARGE_INTEGER*)(&begin_line), NULL, FILE_BEGIN);
-			ReadFile(m_index, &begin_offset, sizeof(size_t), &read, NULL);
-		}
-		size_t end_offset = 0;
-		if (end_line == (m_line_count * sizeof(size_t)))
-		{
-			end_offset = m_file_len;
-		}
-		else
+		size_t begin_offset = begin_line ? m_lines[begin_line - 1] : 0;
+		size_t end_offset = m_lines[end_line];
+		if (end_offset <= begin_offset) return wxEmptyString;
+		// complete lines do not change: the same range gives the same text
+		if ((begin_offset == m_text_begin) && (end_offset == m_text_end)) return m_text;
+		const char* data = Read(begin_offset, end_offset);
+		if (!data) return wxEmptyString;
+		m_text = wxString(data, end_offset - begin_offset);
+		m_text_begin = begin_offset;
+		m_text_end = end_offset;
+		return m_text;
+	}
+
+	// the text from begin to end, read with a margin on both sides when it is not in the block
+	const char* Read(size_t begin, size_t end)
+	{
+		if ((begin < m_block_begin) || (end > m_block_begin + m_block.size()))
 		{
-			end_line *= sizeof(size_t);
-			SetFilePointerEx(m_index, *(LARGE_INTEGER*)(&end_line), NULL, FILE_BEGIN);
-			ReadFile(m_index, &end_offset, sizeof(size_t), &read, NULL);
+			const size_t margin = 1 << 16;
+			size_t block_begin = (begin > margin) ? begin - margin : 0;
+			size_t block_end = (end + margin < m_file_len) ? end + margin : m_file_len;
+			m_block.resize(block_end - block_begin);
+			m_block_begin = block_begin;
+			DWORD read = 0;
+			SetFilePointerEx(m_file, *(LARGE_INTEGER*)(&block_begin), NULL, FILE_BEGIN);
+			ReadFile(m_file, &m_block[0], DWORD(m_block.size()), &read, NULL);
+			m_block.resize(read);
+			if (end > m_block_begin + m_block.size()) return NULL;
 		}
-		SetFilePointer(m_index, 0, NULL, FILE_END);
-		if (end_offset <= begin_offset) return wxEmptyString;
-		size_t count = end_offset - begin_offset;
-		char* data = (char*)malloc(count+1);
-		SetFilePointerEx(m_file, *(LARGE_INTEGER*)(&begin_offset), NULL, FILE_BEGIN);
-		ReadFile(m_file, data, count, &read, NULL);
-		data[count] = 0;
-		wxString str(data);
-		free(data);
-		return str;
+		return &m_block[begin - m_block_begin];
 	}
 
 	HANDLE m_file;
-	HANDLE m_index;
-	wchar_t m_index_name[_MAX_FNAME];
 	size_t m_file_len;
 	size_t m_line_count;
+	std::vector<size_t> m_lines; // file offset of the end of each line
+	std::vector<char> m_chunk;   // read buffer of Update
+	std::vector<char> m_block;   // text of the file read last
+	size_t m_block_begin;        // file offset of m_block
+	wxString m_text;             // text returned last
+	size_t m_text_begin;         // file offsets of m_text
+	size_t m_text_end;
 };
\ No newline at end of file
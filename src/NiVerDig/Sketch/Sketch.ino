@@ -64,6 +64,8 @@ NiVerDig/Sketch:
   version 14/38: 26-08-2023: added support for the Uno R4
   version 15/39: 24-02-2024: added support for R4 ADC 14 bits
   version 16/40: 27-12-2024: added support for the Nano ESP32
+  version 17/41: 19-10-2026: added 'subscribe' command to push state changes instead of polling with '.'
+  version 18/42: 19-10-2026: added 'load' command to transfer the pin and task tables as one checksummed image
 */
 
 #include <limits.h>
@@ -134,7 +136,7 @@ ESP32Timer Timer1;
 // if you change the PINCOUNT, struct pin, TASKCOUNT, struct task: add isrs and increment MODEL (because the EEPROM layout changes)
 #define MODEL       3
 #define REVISION    2
-#define VERSION     39
+#define VERSION     42
 #define BAUD_RATE   500000 // for the uno and mega
 #define EOL "\r\n"
 #define BUTTON_PIN  8      // press the button during boot to set halt (1 second) or reset (5 seconds)
@@ -317,6 +319,8 @@ typedef const char * (*pf_get_item_name)(byte i);
 byte          in_setup  = 1;   // set during setup()
 byte          halt      = 0;   // stops all tasks
 unsigned long echo      = 0;   // echo serial input
+unsigned long subscribe = 0;   // push state changes: 0 = off, else minimal interval (ms) between reports
+unsigned long subscribe_tick = 0; // millis() of the last pushed report
 const char * const es   = "";  // empty string
 const char * const ss   = " "; // single space
 #if defined(DEBUG)
@@ -342,6 +346,7 @@ void print_free_memory(int line);
 const char * find_index_key(char key[MAX_KEY_SIZE], const char * keys, byte index);
 byte find_key_index(const char * keys, const char * key);
 void report_changes();
+void push_changes();
 
 // pin functions
 void store_pins();
@@ -473,6 +478,7 @@ void loop()
   check_input_pins();
   tick_tasks();
   check_finished_tasks();
+  if (subscribe) push_changes();
 #if defined(DEBUG)  
   if (verbose) report_changes2();
 #endif
@@ -2776,7 +2782,7 @@ inline void tick_task(byte ti)
 
 typedef void (*t_cmd_func) (byte cmd_index, byte argc, char**argv);
 typedef struct s_cmd_text {
-  const char     name[8];
+  const char     name[10];
   const char     description[32];
 } s_cmd_text;
 
@@ -2805,10 +2811,12 @@ const s_cmd_text cmd_text_table[] PROGMEM =
   {"stop",      "[<task> | !]: Stop Task"       },
   {"adc_res",   "return ADC Resolution"         },
   {".",         "Report state changes"          },
+  {"subscribe", "Push state changes (0,ms)"     },
   {"",          "Config"                        },
   {"dpin",      "Define Pins []"                },
   {"dtask",     "Define Tasks []"               },
   {"write",     "Save Tasks"                    },
+  {"load",      "[pin|task]: Pin/Task Image"    },
   {"scope",     "[16] [<chan-mask>]: Scope Mode"},
   {"echo",      "Echo (off,on)"                 },
   {"reset",     "Factory Reset"                 },
@@ -2834,24 +2842,27 @@ const s_cmd_info cmd_info_table[] =
   {cmd_stop,       FLAG_NOGUI},
   {cmd_adc_res,    FLAG_NOGUI},
   {cmd_report,     FLAG_NOGUI},
+  {cmd_set_var,    FLAG_NOGUI}, // set subscribe variable (index 10 is hard-coded in the table below
   {cmd_void,       FLAG_GROUP},
   {cmd_pins                  },
   {cmd_tasks                 },
   {cmd_write                 },
+  {cmd_load,       FLAG_NOGUI},
   {cmd_scope                 },
-  {cmd_set_var,    FLAG_NOGUI}, // set echo variable (index 14 is hard-coded in the table below
+  {cmd_set_var,    FLAG_NOGUI}, // set echo variable (index 17 is hard-coded in the table below
   {cmd_reset                 },
   {cmd_halt                  }
 #if defined(DEBUG)
-  ,{cmd_set_var               } // set verbose variable (index 17 is hard-coded in the table below
+  ,{cmd_set_var               } // set verbose variable (index 20 is hard-coded in the table below
 #endif
 };
 
 const s_cmd_var cmd_var_table[] = {
   // address, lower, higher, cmd_index
-  {&echo,      0, 1, 15},
+  {&subscribe, 0, 1000, 10},
+  {&echo,      0, 1, 17},
 #if defined(DEBUG)
-  {&verbose, 0, 3, 18}
+  {&verbose, 0, 3, 20}
 #endif
 };
 
@@ -2871,6 +2882,7 @@ void reset_vars()
 {
   halt              = 0;
   echo              = 0;
+  subscribe         = 0;
 #if defined(DEBUG)
   verbose           = DEFAULT_VERBOSE;    // verbose: send diagnostic output to serial port
 #endif
@@ -3121,6 +3133,206 @@ void cmd_write(byte cmd_index, byte argc, char**argv)
   Serial.print(F("tasks written." EOL));
 }
 
+// image transfer of the pin and task tables in the EEPROM record format (PINSIZE and TASKSIZE bytes).
+// 'load [pin|task]' prints the tables in the format that 'load' accepts:
+//   load <pinsize> <tasksize> <pin-count> <task-count> <checksum>
+//   followed by one line of hex digits per pin record and per task record
+// a record size of 0 leaves that table unchanged.
+#define LOADTIMEOUT 1000 // ms
+
+inline void update_checksum(unsigned int & s1, unsigned int & s2, byte b)
+{
+  // Fletcher-16
+  s1 = (s1 + b) % 255;
+  s2 = (s2 + s1) % 255;
+}
+
+void checksum_bytes(unsigned int & s1, unsigned int & s2, const void * vmemory, byte count)
+{
+  const byte * memory = (const byte *)vmemory;
+  for (; count; --count, ++memory) update_checksum(s1, s2, *memory);
+}
+
+void print_hex_bytes(const void * vmemory, byte count)
+{
+  const byte * memory = (const byte *)vmemory;
+  for (; count; --count, ++memory)
+  {
+    if (*memory < 0x10) Serial.print(F("0"));
+    Serial.print(*memory, HEX);
+  }
+  Serial.print(F(EOL));
+}
+
+// reads the next two hex digits from the serial port, white space between the bytes is skipped
+bool read_hex_byte(byte & b)
+{
+  byte digits = 0;
+  unsigned long start = millis();
+  b = 0;
+  while (digits < 2)
+  {
+    if (!Serial.available())
+    {
+      if ((millis() - start) > LOADTIMEOUT) return false;
+      continue;
+    }
+    char c = Serial.read();
+    if (!digits && isspace(c)) continue;
+    if ((c >= '0') && (c <= '9')) c -= '0';
+    else if ((c >= 'A') && (c <= 'F')) c -= 'A' - 10;
+    else if ((c >= 'a') && (c <= 'f')) c -= 'a' - 10;
+    else return false;
+    b = (b << 4) | c;
+    ++digits;
+    start = millis();
+  }
+  return true;
+}
+
+bool read_hex_bytes(unsigned int & s1, unsigned int & s2, void * vmemory, byte count)
+{
+  byte * memory = (byte *)vmemory;
+  for (; count; --count, ++memory)
+  {
+    if (!read_hex_byte(*memory)) return false;
+    update_checksum(s1, s2, *memory);
+  }
+  return true;
+}
+
+void print_tables(byte pin_size, byte task_size)
+{
+  unsigned int s1 = 0;
+  unsigned int s2 = 0;
+  byte pc = pin_size ? pin_count : 0;
+  byte tc = task_size ? task_count : 0;
+  for (byte pi = 0; pi < pc; ++pi) checksum_bytes(s1, s2, pins + pi, pin_size);
+  for (byte ti = 0; ti < tc; ++ti) checksum_bytes(s1, s2, tasks + ti, task_size);
+  Serial.print(F("load ")); Serial.print(pin_size); Serial.print(ss); Serial.print(task_size); Serial.print(ss);
+  Serial.print(pc); Serial.print(ss); Serial.print(tc); Serial.print(ss); Serial.print((s2 << 8) | s1); Serial.print(F(EOL));
+  for (byte pi = 0; pi < pc; ++pi) print_hex_bytes(pins + pi, pin_size);
+  for (byte ti = 0; ti < tc; ++ti) print_hex_bytes(tasks + ti, task_size);
+}
+
+// checks the references of a task as dtask does: pc and tc are the pin and task counts it will run with
+bool check_task(const struct task & t, byte pc, byte tc)
+{
+  if (t.trigger > TRGSTOP) return false;
+  if ((t.trigger >= TRGUP) && (t.trigger <= TRGLOW) && (t.srcpin >= pc)) return false;
+  if ((t.trigger >= TRGSTART) && (t.srcpin >= tc)) return false;
+  if (t.action > ACTKICTASK) return false;
+  if ((t.action != ACTNONE) && (t.action <= ACTLASTPIN) && (t.dstpin >= pc)) return false;
+  if ((t.action > ACTLASTPIN) && (t.dstpin >= tc) && !((t.action == ACTSTOTASK) && (t.dstpin == NOPIN))) return false;
+  if (t.options & ~(OPTAUTOARM | OPTSTARTARM | OPTINTERRUPT | OPTSTOP)) return false;
+  return true;
+}
+
+void cmd_load(byte cmd_index, byte argc, char**argv)
+{
+  if (argc < 5)
+  {
+    print_tables((argc && !strcmp(argv[0], "task")) ? 0 : PINSIZE, (argc && !strcmp(argv[0], "pin")) ? 0 : TASKSIZE);
+    return;
+  }
+  byte pin_size = parse_byte(argv[0]);
+  byte task_size = parse_byte(argv[1]);
+  byte new_pin_count = pin_size ? parse_byte(argv[2]) : 0;
+  byte new_task_count = task_size ? parse_byte(argv[3]) : 0;
+  unsigned long checksum = parse_ulong(argv[4]);
+  if ((pin_size && ((pin_size != PINSIZE) || (new_pin_count > PINCOUNT))) ||
+      (task_size && ((task_size != TASKSIZE) || (new_task_count > TASKCOUNT))))
+  {
+    // read away the image
+    byte b;
+    for (unsigned long n = (unsigned long)pin_size * new_pin_count + (unsigned long)task_size * new_task_count; n; --n)
+    {
+      if (!read_hex_byte(b)) break;
+    }
+    Serial.print(F("load error: the image does not match the pin and task layout" EOL));
+    return;
+  }
+
+  // the image is received into a staging copy: the active tables only change when the whole image is valid
+  unsigned int pin_bytes = (unsigned int)PINSIZE * new_pin_count;
+  unsigned int task_bytes = (unsigned int)TASKSIZE * new_task_count;
+  byte * image = (byte *)malloc(pin_bytes + task_bytes + 1);
+  if (!image)
+  {
+    byte b;
+    for (unsigned int n = pin_bytes + task_bytes; n; --n)
+    {
+      if (!read_hex_byte(b)) break;
+    }
+    Serial.print(F("load error: not enough memory to receive the image, kept the active pins and tasks" EOL));
+    return;
+  }
+  unsigned int s1 = 0;
+  unsigned int s2 = 0;
+  bool ok = true;
+  byte * record = image;
+  for (byte pi = 0; ok && (pi < new_pin_count); ++pi, record += PINSIZE) ok = read_hex_bytes(s1, s2, record, PINSIZE);
+  for (byte ti = 0; ok && (ti < new_task_count); ++ti, record += TASKSIZE) ok = read_hex_bytes(s1, s2, record, TASKSIZE);
+  if (ok && (((s2 << 8) | s1) != checksum)) ok = false;
+
+  // the records are copied out of the image to check them: it has no alignment
+  byte pc = pin_size ? new_pin_count : pin_count;
+  byte tc = task_size ? new_task_count : task_count;
+  for (byte pi = 0; ok && (pi < new_pin_count); ++pi)
+  {
+    struct pin p;
+    memcpy(&p, image + (unsigned int)pi * PINSIZE, PINSIZE);
+    ok = checkpin(p.pin) && (p.startup_mode < countof(mode_values));
+  }
+  // the tasks that are active after the load (also after loading only pins) must refer to existing pins and tasks
+  for (byte ti = 0; ok && (ti < tc); ++ti)
+  {
+    struct task t;
+    if (task_size) memcpy(&t, image + pin_bytes + (unsigned int)ti * TASKSIZE, TASKSIZE);
+    else memcpy(&t, tasks + ti, TASKSIZE);
+    ok = check_task(t, pc, tc);
+  }
+  if (!ok)
+  {
+    free(image);
+    Serial.print(F("load error: invalid or incomplete image, kept the active pins and tasks" EOL));
+    return;
+  }
+
+  // swap in the tables while all tasks are halted
+  byte was_halted = halt;
+  halt = 1;
+  stop_tasks();
+  {
+    disable_interrupts di;
+    if (pin_size) pin_count = 0;
+    task_count = 0;
+  }
+  for (byte pi = 0; pi < new_pin_count; ++pi)
+  {
+    memcpy(pins + pi, image + (unsigned int)pi * PINSIZE, PINSIZE);
+    pins[pi].name[MAX_NAME_LENGTH] = 0;
+  }
+  for (byte ti = 0; ti < new_task_count; ++ti)
+  {
+    memcpy(tasks + ti, image + pin_bytes + (unsigned int)ti * TASKSIZE, TASKSIZE);
+    tasks[ti].name[MAX_NAME_LENGTH] = 0;
+    tasks[ti].options &= ~OPTSTOP;
+  }
+  free(image);
+  pin_count = pc;
+  if (pin_size)
+  {
+    store_pins();
+    init_pins();
+  }
+  task_count = tc;
+  init_tasks(0, -1);
+  Serial.print(F("load done: ")); Serial.print(pin_count); Serial.print(F(" pins, ")); Serial.print(task_count); Serial.print(F(" tasks" EOL));
+  halt = was_halted;
+  if (!halt) init_tasks(0, -1);
+}
+
 inline void SerialWriteULong(unsigned long ul)
 {
   byte * p = (byte*)&ul;
@@ -3697,6 +3909,16 @@ void report_changes()
   }
 }
 
+// when subscribed, the state changes are pushed without waiting for the '.' command.
+// changes of the same pin or task within the interval are coalesced because only the last state is reported.
+void push_changes()
+{
+  unsigned long now = millis();
+  if ((now - subscribe_tick) < subscribe) return;
+  subscribe_tick = now;
+  report_changes();
+}
+
 void report_changes2()
 {
   for (byte pi = 0; pi < pin_count; ++pi)
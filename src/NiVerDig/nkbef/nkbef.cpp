@@ -0,0 +1,480 @@
+// nkbef: command line tool for NiVerDig binary event recordings (*.nkbef)
+//
+// build (Linux): g++ -O2 -std=c++17 -pthread -o nkbef nkbef.cpp
+//
+// usage:
+//   nkbef info [-j jobs] <recording.nkbef>...
+//     prints the size, time range and pins of the recordings
+//   nkbef stats [-j jobs] <recording.nkbef>...
+//     prints per channel the number of samples and edges and the histograms of the
+//     high and low pulse widths and the periods of the digital channels
+//   nkbef measure [-f seconds] [-t seconds] [-l from[r|f]:to[r|f]]... [-j threads] <recording.nkbef>
+//     prints per channel the edges, the mean pulse widths and period and the duty cycle
+//     from -f up to -t seconds after the first sample, the histograms, and the histograms
+//     of the latency from the rising (r, default) or falling (f) edges of channel from to
+//     those of channel to
+//   nkbef slice [-f seconds] [-t seconds] <recording.nkbef> <output.nkbef>
+//     copies the samples from -f up to -t seconds after the first sample
+//   nkbef export [-r] [-j threads] <recording.nkbef> <output.nktef|output.nkref>
+//     writes the samples as text with absolute local time (.nktef) or with the
+//     microseconds since the first sample (-r or .nkref)
+//   nkbef render [-f seconds] [-t seconds] [-w width] [-h height] <recording.nkbef> <output.png|output.svg>
+//     draws the pins from -f up to -t seconds after the first sample as the scope window does,
+//     as an image (.png) or as vector graphics (.svg). without -h the height fits the pins.
+//
+// info and stats process the recordings in parallel, the output is printed in the
+// order of the arguments. stats of one recording and measure process it in parallel.
+// a compressed recording (*.nkcef) is accepted wherever a recording is read: its samples
+// are decoded into a temporary file first.
+
+#include "nkbef.h"
+#include "nkbefMeasure.h"
+#include "nkbefRender.h"
+#include <stdlib.h>
+#include <errno.h>
+#include <atomic>
+
+static int usage()
+{
+	fprintf(stderr,
+		"usage:\n"
+		"  nkbef info [-j jobs] <recording.nkbef>...\n"
+		"  nkbef stats [-j jobs] <recording.nkbef>...\n"
+		"  nkbef measure [-f seconds] [-t seconds] [-l from[r|f]:to[r|f]]... [-j threads] <recording.nkbef>\n"
+		"  nkbef slice [-f seconds] [-t seconds] <recording.nkbef> <output.nkbef>\n"
+		"  nkbef export [-r] [-j threads] <recording.nkbef> <output.nktef|output.nkref>\n"
+		"  nkbef render [-f seconds] [-t seconds] [-w width] [-h height] <recording.nkbef> <output.png|output.svg>\n");
+	return 2;
+}
+
+static bool open_recording(nkbefFile& file, const char* path, std::string& error)
+{
+	if (file.Open(path)) return true;
+	if (file.m_compressed) error = std::string(path) + ": the compressed recording could not be decoded\n";
+	else error = std::string(path) + ": " + strerror(errno) + "\n";
+	return false;
+}
+
+static std::string format_time(uint64_t timestamp)
+{
+	std::string s;
+	nkbefLocalTime localTime;
+	localTime.Append(s, timestamp);
+	return s;
+}
+
+static std::string format_double(double value)
+{
+	char buf[32];
+	snprintf(buf, sizeof(buf), "%.3f", value);
+	return buf;
+}
+
+// run process(file, output) for all files on jobs threads and print the output in order
+typedef bool (*file_function)(const char* path, std::string& out);
+
+static int run_files(const std::vector<const char*>& files, unsigned jobs, file_function process)
+{
+	if (!jobs) jobs = std::thread::hardware_concurrency();
+	if (!jobs) jobs = 1;
+	if (jobs > files.size()) jobs = (unsigned)files.size();
+	std::vector<std::string> outputs(files.size());
+	std::vector<char> results(files.size(), 0);
+	std::atomic<size_t> next(0);
+	auto worker = [&]()
+	{
+		for (size_t i = next++; i < files.size(); i = next++)
+		{
+			results[i] = process(files[i], outputs[i]);
+		}
+	};
+	std::vector<std::thread> workers;
+	for (unsigned i = 1; i < jobs; ++i)
+	{
+		workers.push_back(std::thread(worker));
+	}
+	worker();
+	for (auto& w : workers)
+	{
+		w.join();
+	}
+	int result = 0;
+	for (size_t i = 0; i < files.size(); ++i)
+	{
+		fwrite(outputs[i].data(), 1, outputs[i].size(), results[i] ? stdout : stderr);
+		if (!results[i]) result = 1;
+	}
+	return result;
+}
+
+static bool info_file(const char* path, std::string& out)
+{
+	nkbefFile file;
+	if (!open_recording(file, path, out)) return false;
+	size_t count = file.Count();
+	out += std::string("file\t") + path + "\n";
+	out += "size\t" + std::to_string(file.m_size) + "\n";
+	out += "samples\t" + std::to_string(count) + "\n";
+	out += "bits\t" + std::to_string(file.m_bits) + "\n";
+	if (file.m_compressed) out += "chunks\t" + std::to_string(file.m_chunks.size()) + "\n";
+	if (file.m_base)
+	{
+		out += "header\t" + std::to_string(file.m_base) + "\n";
+		out += "complete\t" + std::string(file.m_flags & NKBEF_HEADER_COMPLETE ? "yes" : "no") + "\n";
+		out += "start\t" + format_time(file.m_startTime) + "\n";
+	}
+	if (file.m_clockError >= 0.)
+	{
+		// the correction of the device clock to host time and the error of its fit
+		out += "clock\t" + format_double(file.m_clockPpm) + " ppm\t" + format_double(file.m_clockError) + " us rms\t" + format_double(file.m_clockMaxError) + " us max\n";
+	}
+	for (const auto& device : file.m_devices)
+	{
+		// the channels and the clock correction of the other devices of a merged recording
+		out += "device\t" + device.name + "\tchannels " + std::to_string(device.first) + "-" + std::to_string(device.first + device.channels - 1)
+			+ "\t" + format_double(device.clockPpm) + " ppm\t" + format_double(device.clockError) + " us rms\t" + format_double(device.clockMaxError) + " us max\n";
+	}
+	if (count)
+	{
+		// the first and last samples are within NKBEF_DISORDER of the extremes
+		uint64_t first = file.Timestamp(0);
+		uint64_t last = file.Timestamp(count - 1);
+		for (size_t i = 1; (i < count) && (file.Timestamp(i) < first + NKBEF_DISORDER); ++i)
+		{
+			if (file.Timestamp(i) < first) first = file.Timestamp(i);
+		}
+		for (size_t i = count - 1; i-- > 0 && (file.Timestamp(i) + NKBEF_DISORDER > last); )
+		{
+			if (file.Timestamp(i) > last) last = file.Timestamp(i);
+		}
+		out += "first\t" + format_time(first) + "\n";
+		out += "last\t" + format_time(last) + "\n";
+		out += "duration\t" + format_double(double(last - first) / NKBEF_SECOND) + "\n";
+	}
+	for (auto& pin : file.m_pins)
+	{
+		out += "pin\t" + std::to_string(pin.index) + "\t" + pin.name + "\t" + std::to_string(pin.type) + "\n";
+	}
+	out += "\n";
+	return true;
+}
+
+static void print_histogram(std::string& out, const std::string& label, const nkbefHistogram& h)
+{
+	if (!h.count) return;
+	out += label + " [us]\tn " + std::to_string(h.count) + "\tmin " + std::to_string(h.min)
+		+ "\tmean " + format_double(h.mean()) + "\tmax " + std::to_string(h.max) + "\n";
+	for (int bin = 0; bin < 64; ++bin)
+	{
+		if (!h.bins[bin]) continue;
+		out += "\t" + std::to_string(bin ? 1ULL << bin : 0ULL) + "-" + std::to_string((2ULL << bin) - 1) + "\t" + std::to_string(h.bins[bin]) + "\n";
+	}
+}
+
+static void print_histograms(std::string& out, const nkbefMeasure& measure)
+{
+	for (size_t i = 0; i < measure.m_channels.size(); ++i)
+	{
+		const nkbefChannelMeasure& c = measure.m_channels[i];
+		print_histogram(out, std::to_string(i) + "\thigh", c.high);
+		print_histogram(out, std::to_string(i) + "\tlow", c.low);
+		print_histogram(out, std::to_string(i) + "\tperiod", c.period);
+	}
+}
+
+// threads of the measurement of one file: the files are processed in parallel
+static unsigned measure_threads = 1;
+
+static bool stats_file(const char* path, std::string& out)
+{
+	nkbefFile file;
+	if (!open_recording(file, path, out)) return false;
+	nkbefMeasure measure;
+	measure.m_threads = measure_threads;
+	measure.Run(file);
+	out += std::string("file\t") + path + "\n";
+	out += "channel\tname\tsamples\tedges\tmin\tmax\n";
+	for (size_t i = 0; i < measure.m_channels.size(); ++i)
+	{
+		const nkbefChannelMeasure& c = measure.m_channels[i];
+		if (!c.samples) continue;
+		std::string name = (i < file.m_pins.size()) ? file.m_pins[i].name : std::string();
+		out += std::to_string(i) + "\t" + name + "\t" + std::to_string(c.samples) + "\t" + std::to_string(c.edges)
+			+ "\t" + std::to_string(c.min) + "\t" + std::to_string(c.max) + "\n";
+	}
+	print_histograms(out, measure);
+	out += "\n";
+	return true;
+}
+
+static void parse_files(int argc, char** argv, unsigned& jobs, std::vector<const char*>& files)
+{
+	for (int i = 0; i < argc; ++i)
+	{
+		if (!strcmp(argv[i], "-j") && (i + 1 < argc)) jobs = (unsigned)atoi(argv[++i]);
+		else files.push_back(argv[i]);
+	}
+}
+
+static int cmd_info(int argc, char** argv)
+{
+	unsigned jobs = 0;
+	std::vector<const char*> files;
+	parse_files(argc, argv, jobs, files);
+	if (files.empty()) return usage();
+	return run_files(files, jobs, info_file);
+}
+
+static int cmd_stats(int argc, char** argv)
+{
+	unsigned jobs = 0;
+	std::vector<const char*> files;
+	parse_files(argc, argv, jobs, files);
+	if (files.empty()) return usage();
+	if (files.size() == 1) measure_threads = jobs;
+	return run_files(files, jobs, stats_file);
+}
+
+// from[r|f]:to[r|f]
+static bool parse_latency(const char* arg, nkbefMeasure& measure)
+{
+	char* p;
+	long from = strtol(arg, &p, 10);
+	bool fromRising = *p != 'f';
+	if ((*p == 'r') || (*p == 'f')) ++p;
+	if (*p++ != ':') return false;
+	long to = strtol(p, &p, 10);
+	bool toRising = *p != 'f';
+	if ((*p == 'r') || (*p == 'f')) ++p;
+	if (*p || (from < 0) || (to < 0) || (from >= NKBEF_MEASURE_CHANNELS) || (to >= NKBEF_MEASURE_CHANNELS)) return false;
+	measure.AddLatency(from, fromRising, to, toRising);
+	return true;
+}
+
+static int cmd_measure(int argc, char** argv)
+{
+	double from = 0.;
+	double to = -1.;
+	nkbefMeasure measure;
+	std::vector<const char*> files;
+	for (int i = 0; i < argc; ++i)
+	{
+		if (!strcmp(argv[i], "-f") && (i + 1 < argc)) from = atof(argv[++i]);
+		else if (!strcmp(argv[i], "-t") && (i + 1 < argc)) to = atof(argv[++i]);
+		else if (!strcmp(argv[i], "-j") && (i + 1 < argc)) measure.m_threads = (unsigned)atoi(argv[++i]);
+		else if (!strcmp(argv[i], "-l") && (i + 1 < argc))
+		{
+			if (!parse_latency(argv[++i], measure)) return usage();
+		}
+		else files.push_back(argv[i]);
+	}
+	if (files.size() != 1) return usage();
+	nkbefFile file;
+	std::string out;
+	if (!open_recording(file, files[0], out))
+	{
+		fputs(out.c_str(), stderr);
+		return 1;
+	}
+	uint64_t start = file.Count() ? file.Timestamp(0) : 0;
+	measure.m_first = start + uint64_t(from * NKBEF_SECOND);
+	measure.m_last = (to < 0.) ? ~0ULL : start + uint64_t(to * NKBEF_SECOND);
+	measure.Run(file);
+	out += std::string("file\t") + files[0] + "\n";
+	out += "channel\tname\tedges\thigh [us]\tlow [us]\tperiod [us]\tduty [%]\n";
+	for (size_t i = 0; i < measure.m_channels.size(); ++i)
+	{
+		const nkbefChannelMeasure& c = measure.m_channels[i];
+		if (!c.edges) continue;
+		std::string name = (i < file.m_pins.size()) ? file.m_pins[i].name : std::string();
+		out += std::to_string(i) + "\t" + name + "\t" + std::to_string(c.edges) + "\t" + format_double(c.high.mean())
+			+ "\t" + format_double(c.low.mean()) + "\t" + format_double(c.period.mean())
+			+ "\t" + (c.duty() < 0. ? std::string("-") : format_double(100. * c.duty())) + "\n";
+	}
+	print_histograms(out, measure);
+	for (const auto& l : measure.m_latencies)
+	{
+		std::string label = "latency\t" + std::to_string(l.from) + (l.fromRising ? "r" : "f") + ":" + std::to_string(l.to) + (l.toRising ? "r" : "f");
+		if (l.latency.count) print_histogram(out, label, l.latency);
+		else out += label + "\tnone\n";
+	}
+	fwrite(out.data(), 1, out.size(), stdout);
+	return 0;
+}
+
+static int cmd_slice(int argc, char** argv)
+{
+	double from = 0.;
+	double to = -1.;
+	std::vector<const char*> files;
+	for (int i = 0; i < argc; ++i)
+	{
+		if (!strcmp(argv[i], "-f") && (i + 1 < argc)) from = atof(argv[++i]);
+		else if (!strcmp(argv[i], "-t") && (i + 1 < argc)) to = atof(argv[++i]);
+		else files.push_back(argv[i]);
+	}
+	if (files.size() != 2) return usage();
+	nkbefFile file;
+	std::string error;
+	if (!open_recording(file, files[0], error))
+	{
+		fputs(error.c_str(), stderr);
+		return 1;
+	}
+	FILE* out = fopen(files[1], "wb");
+	if (!out)
+	{
+		fprintf(stderr, "%s: %s\n", files[1], strerror(errno));
+		return 1;
+	}
+	size_t count = file.Count();
+	uint64_t start = count ? file.Timestamp(0) : 0;
+	uint64_t first = start + uint64_t(from * NKBEF_SECOND);
+	uint64_t last = (to < 0.) ? ~0ULL : start + uint64_t(to * NKBEF_SECOND);
+	size_t end = (last == ~0ULL) ? count : file.Find(last + 2 * NKBEF_DISORDER);
+	uint64_t written = NKBEF_HEADER_SIZE;
+	bool ok = nkbefWriteHeader(out, file.m_pins, file.m_bits, file.m_startTime ? file.m_startTime : start, NKBEF_HEADER_COMPLETE);
+	// copy the runs of samples in the range
+	for (size_t i = file.Find(first); ok && (i < end); )
+	{
+		size_t j = i;
+		while ((j < end) && (file.Timestamp(j) >= first) && (file.Timestamp(j) < last)) ++j;
+		if (j > i)
+		{
+			size_t size = (j - i) * file.m_sampleSize;
+			ok = fwrite(file.Sample(i), 1, size, out) == size;
+			written += size;
+			i = j;
+		}
+		else
+		{
+			++i;
+		}
+	}
+	if (ok) ok = nkbefWriteAppendix(out, file.m_pins, file.m_bits, written);
+	if (fclose(out)) ok = false;
+	if (!ok)
+	{
+		fprintf(stderr, "%s: write error\n", files[1]);
+		return 1;
+	}
+	return 0;
+}
+
+static int cmd_export(int argc, char** argv)
+{
+	bool relative = false;
+	unsigned threads = 0;
+	std::vector<const char*> files;
+	for (int i = 0; i < argc; ++i)
+	{
+		if (!strcmp(argv[i], "-r")) relative = true;
+		else if (!strcmp(argv[i], "-j") && (i + 1 < argc)) threads = (unsigned)atoi(argv[++i]);
+		else files.push_back(argv[i]);
+	}
+	if (files.size() != 2) return usage();
+	size_t len = strlen(files[1]);
+	if ((len > 6) && !strcmp(files[1] + len - 6, ".nkref")) relative = true;
+	nkbefFile file;
+	std::string error;
+	if (!open_recording(file, files[0], error))
+	{
+		fputs(error.c_str(), stderr);
+		return 1;
+	}
+	FILE* out = fopen(files[1], "wb");
+	if (!out)
+	{
+		fprintf(stderr, "%s: %s\n", files[1], strerror(errno));
+		return 1;
+	}
+	std::vector<std::string> names;
+	for (auto& pin : file.m_pins)
+	{
+		names.push_back(pin.name);
+	}
+	bool ok = nkbefExportText(file, names, out, relative, threads);
+	if (fclose(out)) ok = false;
+	if (!ok)
+	{
+		fprintf(stderr, "%s: write error\n", files[1]);
+		return 1;
+	}
+	return 0;
+}
+
+static int cmd_render(int argc, char** argv)
+{
+	double from = 0.;
+	double to = -1.;
+	int width = 1200;
+	int height = 0;
+	std::vector<const char*> files;
+	for (int i = 0; i < argc; ++i)
+	{
+		if (!strcmp(argv[i], "-f") && (i + 1 < argc)) from = atof(argv[++i]);
+		else if (!strcmp(argv[i], "-t") && (i + 1 < argc)) to = atof(argv[++i]);
+		else if (!strcmp(argv[i], "-w") && (i + 1 < argc)) width = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "-h") && (i + 1 < argc)) height = atoi(argv[++i]);
+		else files.push_back(argv[i]);
+	}
+	if ((files.size() != 2) || (width < 100) || (width > 32768) || (height < 0) || (height > 32768)) return usage();
+	size_t len = strlen(files[1]);
+	bool svg = (len > 4) && !strcmp(files[1] + len - 4, ".svg");
+	nkbefFile file;
+	std::string error;
+	if (!open_recording(file, files[0], error))
+	{
+		fputs(error.c_str(), stderr);
+		return 1;
+	}
+	// the window: by default up to the last sample
+	size_t count = file.Count();
+	uint64_t start = count ? file.Timestamp(0) : 0;
+	uint64_t end = count ? file.Timestamp(count - 1) : 0;
+	for (size_t i = count; i-- > 0 && (file.Timestamp(i) + NKBEF_DISORDER > end); )
+	{
+		if (file.Timestamp(i) > end) end = file.Timestamp(i);
+	}
+	uint64_t first = start + uint64_t(from * NKBEF_SECOND);
+	uint64_t last = (to < 0.) ? end : start + uint64_t(to * NKBEF_SECOND);
+	nkbefRender render;
+	nkbefSvg graphics;
+	nkbefRaster image;
+	render.Draw(file, first, last, width, height, svg ? (nkbefCanvas&)graphics : (nkbefCanvas&)image);
+	FILE* out = fopen(files[1], "wb");
+	if (!out)
+	{
+		fprintf(stderr, "%s: %s\n", files[1], strerror(errno));
+		return 1;
+	}
+	bool ok;
+	if (svg)
+	{
+		const std::string& text = graphics.End();
+		ok = fwrite(text.data(), 1, text.size(), out) == text.size();
+	}
+	else
+	{
+		ok = image.WritePng(out);
+	}
+	if (fclose(out)) ok = false;
+	if (!ok)
+	{
+		fprintf(stderr, "%s: write error\n", files[1]);
+		return 1;
+	}
+	return 0;
+}
+
+int main(int argc, char** argv)
+{
+	if (argc < 2) return usage();
+	if (!strcmp(argv[1], "info")) return cmd_info(argc - 2, argv + 2);
+	if (!strcmp(argv[1], "stats")) return cmd_stats(argc - 2, argv + 2);
+	if (!strcmp(argv[1], "measure")) return cmd_measure(argc - 2, argv + 2);
+	if (!strcmp(argv[1], "slice")) return cmd_slice(argc - 2, argv + 2);
+	if (!strcmp(argv[1], "export")) return cmd_export(argc - 2, argv + 2);
+	if (!strcmp(argv[1], "render")) return cmd_render(argc - 2, argv + 2);
+	return usage();
+}
@@ -0,0 +1,1134 @@
+#pragma once
+
+// portable reader and text exporter of NiVerDig binary event recordings (*.nkbef).
+// a recording starts with a header of NKBEF_HEADER_SIZE bytes (older recordings have none),
+// holds packed fileSample<T> records {char channel; T state; size_t timestamp} where T is
+// a byte or a word, followed by the appendix written by panelScope::SaveFileInfo:
+// UTF-16 text lines, optional binary blocks and, as the last 8 bytes, the file offset of
+// the appendix.
+// the header (scopeFileHeader in NkDigTimerScope.h), little endian:
+//   0  char[8]  "NKBEF"
+//   8  uint32   version
+//   12 uint32   header size: offset of the first sample
+//   16 uint32   sample size
+//   20 uint32   bits
+//   24 uint32   number of channels
+//   28 uint32   flags: NKBEF_HEADER_COMPLETE when the appendix is written
+//   32 uint64   start of the recording (FILETIME)
+//   40 channel table: { int32 type; UTF-16 name[NKBEF_HEADER_NAME] }
+// a compressed recording (*.nkcef, scopeChunkFileHeader in NkDigTimerScope.h) starts with
+// "NKCEF", version and sample size, holds chunks of encoded and XPRESS compressed samples and
+// an appendix with the chunk table. the reader decodes it into a temporary file, so its samples
+// are accessed as those of an uncompressed recording.
+// used by the NiVerDig application and by the nkbef command line tool.
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <string>
+#include <vector>
+#include <thread>
+#include <algorithm>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#define NKBEF_SECOND       10000000ULL           // timestamps are in 100 ns units
+#define NKBEF_UNIX_EPOCH   11644473600ULL        // 1970-01-01 in seconds since 1601
+#define NKBEF_EXPORT_RANGE (1024 * 1024)         // samples per range formatted by one thread
+#define NKBEF_DISORDER     10000ULL              // samples are sorted within the 1 ms delay of the recorder fifo
+#define NKBEF_ADC_PIN      5                     // SItem::eAdcPin
+#define NKBEF_HEADER_SIZE     65536                 // a multiple of the mapping granularity
+#define NKBEF_HEADER_VERSION  1
+#define NKBEF_HEADER_COMPLETE 1
+#define NKBEF_HEADER_NAME     32
+#define NKBEF_HEADER_CHANNEL  (4 + 2 * NKBEF_HEADER_NAME)
+#define NKBEF_HEADER_CHANNELS ((NKBEF_HEADER_SIZE - 40) / NKBEF_HEADER_CHANNEL)
+#define NKBEF_CHUNK_FILE_HEADER 16        // "NKCEF", uint32 version, uint32 sample size
+#define NKBEF_CHUNK_HEADER    36          // packed scopeChunkHeader
+#define NKBEF_CHUNK_ENTRY     32          // scopeChunkEntry of the appendix
+#define NKBEF_COLUMN_HEADER   17          // packed scopeColumnHeader
+#define NKBEF_CHUNK_MAGIC     0x4B4E4843  // 'CHNK'
+#define NKBEF_CHUNK_PACKED    1
+#define NKBEF_CHUNK_COLUMNS   2
+
+struct nkbefPin
+{
+	long long   index;
+	std::string name; // UTF-8
+	long        type; // SItem::EItemType
+};
+
+// a device of a merged recording: its pins are channels first to first + channels - 1
+struct nkbefDevice
+{
+	std::string name;  // UTF-8: the port
+	long        first;
+	long        channels;
+	double      clockPpm; // correction of its clock to host time
+	double      clockError;
+	double      clockMaxError;
+};
+
+// an entry of the level-of-detail pyramid of the appendix (scopeLodEntry in NkDigTimerScope.h):
+// the samples of a channel in a bucket of 2^(shift + level) timestamp units
+#define NKBEF_LOD_ENTRY 22 // packed size in the file
+
+struct nkbefLodEntry
+{
+	uint64_t bucket;  // timestamp >> (shift + level)
+	uint32_t edges;   // number of state changes in the bucket
+	uint16_t before;  // state at the start of the bucket
+	uint16_t min;
+	uint16_t max;
+	uint16_t last;    // state at the end of the bucket
+	uint8_t  channel;
+	uint8_t  level;
+};
+
+struct nkbefSample
+{
+	signed char channel;   // ~i for the tick events of channel i
+	unsigned    state;
+	uint64_t    timestamp; // FILETIME: 100 ns since 1601
+};
+
+// an entry of the chunk table of a compressed recording (scopeChunkEntry in NkDigTimerScope.h)
+struct nkbefChunk
+{
+	uint64_t first;  // lowest timestamp in the chunk
+	uint64_t last;   // highest timestamp in the chunk
+	uint64_t offset; // file offset of the chunk header
+	uint64_t count;  // number of samples
+};
+
+// decompress the XPRESS (plain LZ77, [MS-XCA] 2.4) data written by the Windows Compression API
+// with COMPRESS_ALGORITHM_XPRESS | COMPRESS_RAW. returns false unless exactly raw_size bytes result.
+inline bool nkbefXpressDecompress(const unsigned char* in, size_t in_size, unsigned char* out, size_t out_size)
+{
+	const unsigned char* end = in + in_size;
+	const unsigned char* half = NULL; // the byte of which the high nibble holds the next match length
+	size_t pos = 0;
+	uint32_t flags = 0;
+	int bits = 0;
+	while (pos < out_size)
+	{
+		if (!bits)
+		{
+			if (end - in < 4) return false;
+			flags = in[0] | (in[1] << 8) | (in[2] << 16) | ((uint32_t)in[3] << 24);
+			in += 4;
+			bits = 32;
+		}
+		--bits;
+		if (!(flags & (1U << bits)))
+		{
+			if (in >= end) return false;
+			out[pos++] = *in++;
+			continue;
+		}
+		if (end - in < 2) return false;
+		size_t match = in[0] | (in[1] << 8);
+		in += 2;
+		size_t offset = (match >> 3) + 1;
+		size_t length = match & 7;
+		if (length == 7)
+		{
+			if (!half)
+			{
+				if (in >= end) return false;
+				half = in++;
+				length = *half & 15;
+			}
+			else
+			{
+				length = *half >> 4;
+				half = NULL;
+			}
+			if (length == 15)
+			{
+				if (in >= end) return false;
+				length = *in++;
+				if (length == 255)
+				{
+					if (end - in < 2) return false;
+					length = in[0] | (in[1] << 8);
+					in += 2;
+					if (!length)
+					{
+						if (end - in < 4) return false;
+						length = in[0] | (in[1] << 8) | (in[2] << 16) | ((size_t)in[3] << 24);
+						in += 4;
+					}
+					if (length < 15 + 7) return false;
+					length -= 15 + 7;
+				}
+				length += 15;
+			}
+			length += 7;
+		}
+		length += 3;
+		if ((offset > pos) || (length > out_size - pos)) return false;
+		// the copy overlaps the output when offset < length: copy byte by byte
+		for (size_t i = 0; i < length; ++i, ++pos) out[pos] = out[pos - offset];
+	}
+	return true;
+}
+
+// read-only view of a range of a file: a Windows file mapping or a POSIX mmap.
+// the offset of a view must be a multiple of Granularity().
+class nkbefMap
+{
+public:
+#ifdef _WIN32
+	typedef HANDLE file_t;
+#else
+	typedef int    file_t;
+#endif
+	enum eAdvice { ADVICE_NORMAL, ADVICE_SEQUENTIAL, ADVICE_RANDOM };
+
+	nkbefMap()
+	: m_data(NULL)
+	, m_offset(0)
+	, m_size(0)
+#ifdef _WIN32
+	, m_map(NULL)
+#endif
+	{
+	}
+
+	~nkbefMap()
+	{
+		Unmap();
+	}
+
+	static size_t Granularity()
+	{
+#ifdef _WIN32
+		SYSTEM_INFO si;
+		GetSystemInfo(&si);
+		return si.dwAllocationGranularity;
+#else
+		return (size_t)sysconf(_SC_PAGESIZE);
+#endif
+	}
+
+	bool Map(file_t file, uint64_t offset, size_t size)
+	{
+		Unmap();
+		if (!size) return false;
+#ifdef _WIN32
+		m_map = CreateFileMapping(file, NULL, PAGE_READONLY, 0, 0, NULL);
+		if (!m_map) return false;
+		m_data = (const unsigned char*)MapViewOfFile(m_map, FILE_MAP_READ, DWORD(offset >> 32), DWORD(offset), size);
+		if (!m_data)
+		{
+			Unmap();
+			return false;
+		}
+#else
+		void* data = mmap(NULL, size, PROT_READ, MAP_SHARED, file, (off_t)offset);
+		if (data == MAP_FAILED) return false;
+		m_data = (const unsigned char*)data;
+#endif
+		m_offset = offset;
+		m_size = size;
+		return true;
+	}
+
+	void Unmap()
+	{
+#ifdef _WIN32
+		if (m_data) UnmapViewOfFile(m_data);
+		if (m_map) CloseHandle(m_map);
+		m_map = NULL;
+#else
+		if (m_data) munmap((void*)m_data, m_size);
+#endif
+		m_data = NULL;
+		m_offset = 0;
+		m_size = 0;
+	}
+
+	// on Windows the access pattern is a flag of the file handle (FILE_FLAG_SEQUENTIAL_SCAN or FILE_FLAG_RANDOM_ACCESS)
+	void Advise(eAdvice advice) const
+	{
+#ifndef _WIN32
+		if (m_data) madvise((void*)m_data, m_size, (advice == ADVICE_SEQUENTIAL) ? MADV_SEQUENTIAL : (advice == ADVICE_RANDOM) ? MADV_RANDOM : MADV_NORMAL);
+#else
+		(void)advice;
+#endif
+	}
+
+	bool Contains(uint64_t offset, size_t size) const
+	{
+		return m_data && (offset >= m_offset) && (offset + size <= m_offset + m_size);
+	}
+
+	const unsigned char* At(uint64_t offset) const
+	{
+		return m_data + (offset - m_offset);
+	}
+
+	const unsigned char* m_data;
+	uint64_t             m_offset; // file offset of m_data
+	size_t               m_size;
+#ifdef _WIN32
+	HANDLE               m_map;
+#endif
+};
+
+class nkbefFile
+{
+public:
+	nkbefFile()
+	: m_data(NULL)
+	, m_size(0)
+	, m_lastsample(0)
+	, m_base(0)
+	, m_sampleSize(10)
+	, m_bits(8)
+	, m_startTime(0)
+	, m_flags(0)
+	, m_clockPpm(0.)
+	, m_clockError(-1.)
+	, m_clockMaxError(-1.)
+	, m_lodShift(0)
+	, m_lodLast(0)
+	, m_compressed(false)
+	, m_rangeFirst(0)
+	, m_rangeLast(~0ULL)
+#ifdef _WIN32
+	, m_file(INVALID_HANDLE_VALUE)
+	, m_temp(INVALID_HANDLE_VALUE)
+#else
+	, m_fd(-1)
+	, m_temp(NULL)
+#endif
+	{
+	}
+
+	~nkbefFile()
+	{
+		Close();
+	}
+
+#ifdef _WIN32
+	bool Open(const wchar_t* path)
+	{
+		Close();
+		m_file = CreateFileW(path, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+		if (m_file == INVALID_HANDLE_VALUE) return false;
+		LARGE_INTEGER size;
+		if (!GetFileSizeEx(m_file, &size))
+		{
+			Close();
+			return false;
+		}
+		m_size = size.QuadPart;
+		if (m_size && !MapAll(m_file))
+		{
+			Close();
+			return false;
+		}
+		return Parse();
+	}
+#else
+	bool Open(const char* path)
+	{
+		Close();
+		m_fd = open(path, O_RDONLY);
+		if (m_fd < 0) return false;
+		struct stat st;
+		if (fstat(m_fd, &st))
+		{
+			Close();
+			return false;
+		}
+		m_size = st.st_size;
+		if (m_size && !MapAll(m_fd))
+		{
+			Close();
+			return false;
+		}
+		return Parse();
+	}
+#endif
+
+	void Close()
+	{
+		m_view.Unmap();
+#ifdef _WIN32
+		if (m_file != INVALID_HANDLE_VALUE) CloseHandle(m_file);
+		m_file = INVALID_HANDLE_VALUE;
+		if (m_temp != INVALID_HANDLE_VALUE) CloseHandle(m_temp);
+		m_temp = INVALID_HANDLE_VALUE;
+#else
+		if (m_fd >= 0) close(m_fd);
+		m_fd = -1;
+		if (m_temp) fclose(m_temp);
+		m_temp = NULL;
+#endif
+		m_data = NULL;
+		m_size = 0;
+		m_lastsample = 0;
+		m_base = 0;
+		m_startTime = 0;
+		m_flags = 0;
+		m_clockPpm = 0.;
+		m_clockError = -1.;
+		m_clockMaxError = -1.;
+		m_pins.clear();
+		m_devices.clear();
+		m_lod.clear();
+		m_lodShift = 0;
+		m_lodLast = 0;
+		m_compressed = false;
+		m_chunks.clear();
+	}
+
+	// decode only part of a compressed recording: the chunks that can hold samples in [first, last]
+	// and the samples of the selected channels (empty: all; tick events follow their channel),
+	// as scopeReader::SetChannels. set before Open; an uncompressed recording is read as a whole.
+	void SetRange(uint64_t first, uint64_t last)
+	{
+		m_rangeFirst = first;
+		m_rangeLast = last;
+	}
+
+	void SetChannels(const std::vector<bool>& channels)
+	{
+		m_selected = channels;
+	}
+
+	// for recordings without appendix (e.g. while recording) the caller knows the sample size
+	void SetBits(long bits)
+	{
+		m_bits = bits;
+		m_sampleSize = (bits == 8) ? 10 : 11;
+	}
+
+	size_t Count() const
+	{
+		return (m_lastsample > m_base) ? size_t((m_lastsample - m_base) / m_sampleSize) : 0;
+	}
+
+	const unsigned char* Sample(size_t i) const
+	{
+		return m_data + m_base + i * m_sampleSize;
+	}
+
+	uint64_t Timestamp(size_t i) const
+	{
+		uint64_t timestamp;
+		memcpy(&timestamp, Sample(i) + m_sampleSize - 8, 8);
+		return timestamp;
+	}
+
+	// index of the first sample that can have a timestamp at or after timestamp
+	size_t Find(uint64_t timestamp) const
+	{
+		if (timestamp > NKBEF_DISORDER) timestamp -= NKBEF_DISORDER;
+		else timestamp = 0;
+		size_t lo = 0;
+		size_t hi = Count();
+		while (lo < hi)
+		{
+			size_t mid = lo + (hi - lo) / 2;
+			if (Timestamp(mid) < timestamp) lo = mid + 1;
+			else hi = mid;
+		}
+		return lo;
+	}
+
+	void Get(size_t i, nkbefSample& s) const
+	{
+		const unsigned char* p = Sample(i);
+		s.channel = (signed char)p[0];
+		if (m_sampleSize == 10)
+		{
+			s.state = p[1];
+		}
+		else
+		{
+			uint16_t state;
+			memcpy(&state, p + 1, sizeof(state));
+			s.state = state;
+		}
+		memcpy(&s.timestamp, p + m_sampleSize - 8, 8);
+	}
+
+	const unsigned char* m_data;
+	uint64_t             m_size;
+	uint64_t             m_lastsample; // end of the samples: start of the appendix
+	uint64_t             m_base;       // offset of the first sample: the header size
+	size_t               m_sampleSize; // 10 (8 bits) or 11 bytes
+	long                 m_bits;
+	uint64_t             m_startTime;  // from the header
+	unsigned long        m_flags;      // from the header
+	double               m_clockPpm;   // correction of the device clock, from the 'clock' line
+	double               m_clockError; // rms error of the clock correction in us, negative without 'clock' line
+	double               m_clockMaxError;
+	std::vector<nkbefLodEntry> m_lod; // from the 'lod' block: sorted on level, channel and bucket
+	unsigned             m_lodShift;  // level 0 buckets are 2^m_lodShift timestamp units
+	uint64_t             m_lodLast;   // highest timestamp in the pyramid
+	bool                 m_compressed; // *.nkcef: the samples are decoded into a temporary file
+	std::vector<nkbefChunk> m_chunks; // from the 'chunks' block of a compressed recording
+	std::vector<nkbefPin> m_pins;
+	std::vector<nkbefDevice> m_devices; // from the 'device' lines of a merged recording
+
+private:
+	bool MapAll(nkbefMap::file_t file)
+	{
+		if ((m_size != size_t(m_size)) || !m_view.Map(file, 0, size_t(m_size))) return false;
+		m_view.Advise(nkbefMap::ADVICE_SEQUENTIAL);
+		m_data = m_view.m_data;
+		return true;
+	}
+
+	bool Parse()
+	{
+		m_pins.clear();
+		m_lastsample = m_size;
+		m_compressed = (m_size >= 8) && !memcmp(m_data, "NKCEF", 6);
+		if (m_compressed) return ParseCompressed();
+		SetBits(8);
+		bool header = ParseHeader();
+		// a recording with a header has an appendix only when it is complete
+		if ((m_size >= m_base + 8) && (!header || (m_flags & NKBEF_HEADER_COMPLETE)))
+		{
+			uint64_t pos;
+			memcpy(&pos, m_data + m_size - 8, 8);
+			if ((pos >= m_base) && (pos < m_size - 8))
+			{
+				ParseAppendix(m_data + pos, size_t(m_size - 8 - pos), !header);
+				m_lastsample = pos;
+			}
+		}
+		if (m_pins.empty())
+		{
+			// name the channels after the first samples, like pinItems::LoadFromFile
+			nkbefSample s;
+			for (size_t i = 0; i < Count(); ++i)
+			{
+				Get(i, s);
+				if (s.channel != (signed char)i) break;
+				nkbefPin pin = { (long long)i, std::to_string(i + 1), 0 };
+				m_pins.push_back(pin);
+			}
+		}
+		return true;
+	}
+
+	bool ParseCompressed()
+	{
+		if (m_size < NKBEF_CHUNK_FILE_HEADER + 8) return false;
+		uint32_t fields[2];
+		memcpy(fields, m_data + 8, sizeof(fields));
+		if ((fields[0] != 1) || ((fields[1] != 10) && (fields[1] != 11))) return false;
+		uint64_t pos;
+		memcpy(&pos, m_data + m_size - 8, 8);
+		if ((pos < NKBEF_CHUNK_FILE_HEADER) || (pos >= m_size - 8)) return false;
+		SetBits(fields[1] == 10 ? 8 : 16);
+		ParseAppendix(m_data + pos, size_t(m_size - 8 - pos), true);
+		if (m_sampleSize != fields[1]) return false;
+		return Decode(pos);
+	}
+
+	// decode the chunks one by one into the temporary file and map that
+	bool Decode(uint64_t end)
+	{
+		if (!CreateTemp()) return false;
+		std::vector<unsigned char> raw;
+		std::vector<unsigned char> out;
+		std::vector<nkbefSample> samples;
+		uint64_t size = 0;
+		for (const auto& chunk : m_chunks)
+		{
+			if ((chunk.last < m_rangeFirst) || (chunk.first > m_rangeLast)) continue;
+			if (!DecodeChunk(chunk, end, raw, samples, out) || !WriteTemp(out)) return false;
+			size += out.size();
+		}
+		m_view.Unmap();
+		m_data = NULL;
+		m_base = 0;
+		m_lastsample = 0;
+		if (!size) return true;
+#ifdef _WIN32
+		if ((size != size_t(size)) || !m_view.Map(m_temp, 0, size_t(size))) return false;
+#else
+		if ((size != size_t(size)) || fflush(m_temp) || !m_view.Map(fileno(m_temp), 0, size_t(size))) return false;
+#endif
+		m_view.Advise(nkbefMap::ADVICE_SEQUENTIAL);
+		m_data = m_view.m_data;
+		m_lastsample = size;
+		return true;
+	}
+
+	// the samples of a chunk as records of m_sampleSize bytes in out
+	bool DecodeChunk(const nkbefChunk& chunk, uint64_t end, std::vector<unsigned char>& raw, std::vector<nkbefSample>& samples, std::vector<unsigned char>& out)
+	{
+		out.clear();
+		if ((chunk.offset < NKBEF_CHUNK_FILE_HEADER) || (chunk.offset > end) || (end - chunk.offset < NKBEF_CHUNK_HEADER)) return false;
+		const unsigned char* p = m_data + chunk.offset;
+		uint32_t magic, count, rawSize, packedSize, flags;
+		memcpy(&magic, p, 4);
+		memcpy(&count, p + 4, 4);
+		memcpy(&rawSize, p + 24, 4);
+		memcpy(&packedSize, p + 28, 4);
+		memcpy(&flags, p + 32, 4);
+		if ((magic != NKBEF_CHUNK_MAGIC) || (count != chunk.count) || (packedSize > end - chunk.offset - NKBEF_CHUNK_HEADER)) return false;
+		p += NKBEF_CHUNK_HEADER;
+		if (!(flags & NKBEF_CHUNK_COLUMNS))
+		{
+			size_t size = (flags & NKBEF_CHUNK_PACKED) ? rawSize : packedSize;
+			const unsigned char* data = Unpack(p, packedSize, rawSize, flags, raw);
+			return data && DecodeSamples(data, size, count, out);
+		}
+		// one column per channel: merge them on timestamp
+		if ((rawSize % NKBEF_COLUMN_HEADER) || (rawSize > packedSize)) return false;
+		samples.clear();
+		const unsigned char* column = p + rawSize;
+		for (size_t d = 0; d < rawSize; d += NKBEF_COLUMN_HEADER)
+		{
+			uint32_t columnCount, columnRaw, columnPacked, columnFlags;
+			memcpy(&columnCount, p + d + 1, 4);
+			memcpy(&columnRaw, p + d + 5, 4);
+			memcpy(&columnPacked, p + d + 9, 4);
+			memcpy(&columnFlags, p + d + 13, 4);
+			if (columnPacked > size_t(p + packedSize - column)) return false;
+			if (!Selected((signed char)p[d]))
+			{
+				// only the columns of the selected channels are decompressed
+				column += columnPacked;
+				continue;
+			}
+			size_t size = (columnFlags & NKBEF_CHUNK_PACKED) ? columnRaw : columnPacked;
+			const unsigned char* data = Unpack(column, columnPacked, columnRaw, columnFlags, raw);
+			if (!data || !DecodeColumn(data, size, columnCount, (signed char)p[d], samples)) return false;
+			column += columnPacked;
+		}
+		std::stable_sort(samples.begin(), samples.end(),
+			[](const nkbefSample& a, const nkbefSample& b) { return a.timestamp < b.timestamp; });
+		for (const auto& s : samples) Put(out, s);
+		return true;
+	}
+
+	const unsigned char* Unpack(const unsigned char* p, size_t packedSize, size_t rawSize, uint32_t flags, std::vector<unsigned char>& raw)
+	{
+		if (!(flags & NKBEF_CHUNK_PACKED)) return p;
+		raw.resize(rawSize + 1);
+		return nkbefXpressDecompress(p, packedSize, &raw[0], rawSize) ? &raw[0] : NULL;
+	}
+
+	static bool GetVarint(const unsigned char*& p, const unsigned char* end, uint64_t& value)
+	{
+		value = 0;
+		for (int shift = 0; (p < end) && (shift < 64); shift += 7)
+		{
+			unsigned char c = *p++;
+			value |= (uint64_t)(c & 0x7F) << shift;
+			if (!(c & 0x80)) return true;
+		}
+		return false;
+	}
+
+	static int64_t UnZigZag(uint64_t value) { return (int64_t)(value >> 1) ^ -(int64_t)(value & 1); }
+
+	// see ScopeDecodeSamples: the timestamp delta, then a token byte for a digital sample or
+	// 0x80, the channel and the state delta of that channel
+	bool DecodeSamples(const unsigned char* p, size_t size, size_t count, std::vector<unsigned char>& out)
+	{
+		const unsigned char* end = p + size;
+		unsigned mask = (m_sampleSize == 10) ? 0xFF : 0xFFFF;
+		unsigned states[256] = { 0 };
+		nkbefSample s = { 0, 0, 0 };
+		for (size_t i = 0; i < count; ++i)
+		{
+			uint64_t value;
+			if (!GetVarint(p, end, value) || (p >= end)) return false;
+			s.timestamp += (uint64_t)UnZigZag(value);
+			unsigned char token = *p++;
+			if (token < 0x80)
+			{
+				s.channel = (signed char)(token >> 1);
+				s.state = token & 1;
+			}
+			else
+			{
+				if (p >= end) return false;
+				unsigned char channel = *p++;
+				if (!GetVarint(p, end, value)) return false;
+				s.channel = (signed char)channel;
+				s.state = unsigned(states[channel] + UnZigZag(value)) & mask;
+			}
+			states[(unsigned char)s.channel] = s.state;
+			if (Selected(s.channel)) Put(out, s);
+		}
+		return true;
+	}
+
+	bool Selected(signed char channel) const
+	{
+		if (m_selected.empty()) return true;
+		size_t c = (unsigned char)(channel < 0 ? ~channel : channel);
+		return (c < m_selected.size()) && m_selected[c];
+	}
+
+	// see ScopeDecodeColumn: per sample the timestamp delta and the state delta
+	bool DecodeColumn(const unsigned char* p, size_t size, size_t count, signed char channel, std::vector<nkbefSample>& samples)
+	{
+		const unsigned char* end = p + size;
+		unsigned mask = (m_sampleSize == 10) ? 0xFF : 0xFFFF;
+		nkbefSample s = { channel, 0, 0 };
+		for (size_t i = 0; i < count; ++i)
+		{
+			uint64_t dt, ds;
+			if (!GetVarint(p, end, dt) || !GetVarint(p, end, ds)) return false;
+			s.timestamp += (uint64_t)UnZigZag(dt);
+			s.state = unsigned(s.state + UnZigZag(ds)) & mask;
+			samples.push_back(s);
+		}
+		return true;
+	}
+
+	// a fileSample record: channel, state (1 or 2 bytes) and timestamp, little endian
+	void Put(std::vector<unsigned char>& out, const nkbefSample& s)
+	{
+		out.push_back((unsigned char)s.channel);
+		out.push_back((unsigned char)s.state);
+		if (m_sampleSize == 11) out.push_back((unsigned char)(s.state >> 8));
+		for (int i = 0; i < 8; ++i) out.push_back((unsigned char)(s.timestamp >> (8 * i)));
+	}
+
+#ifdef _WIN32
+	bool CreateTemp()
+	{
+		wchar_t dir[MAX_PATH];
+		wchar_t path[MAX_PATH];
+		if (!GetTempPathW(MAX_PATH, dir) || !GetTempFileNameW(dir, L"nkc", 0, path)) return false;
+		m_temp = CreateFileW(path, GENERIC_READ | GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_TEMPORARY | FILE_FLAG_DELETE_ON_CLOSE, NULL);
+		return m_temp != INVALID_HANDLE_VALUE;
+	}
+
+	bool WriteTemp(const std::vector<unsigned char>& data)
+	{
+		DWORD written = 0;
+		return data.empty() || (WriteFile(m_temp, &data[0], DWORD(data.size()), &written, NULL) && (written == data.size()));
+	}
+#else
+	bool CreateTemp()
+	{
+		m_temp = tmpfile();
+		return m_temp != NULL;
+	}
+
+	bool WriteTemp(const std::vector<unsigned char>& data)
+	{
+		return data.empty() || (fwrite(&data[0], 1, data.size(), m_temp) == data.size());
+	}
+#endif
+
+	bool ParseHeader()
+	{
+		if ((m_size < NKBEF_HEADER_SIZE) || memcmp(m_data, "NKBEF", 6)) return false;
+		uint32_t fields[6];
+		memcpy(fields, m_data + 8, sizeof(fields));
+		if ((fields[0] != NKBEF_HEADER_VERSION) || (fields[1] < NKBEF_HEADER_SIZE) || (fields[1] > m_size)) return false;
+		if ((fields[4] > NKBEF_HEADER_CHANNELS) || ((fields[2] != 10) && (fields[2] != 11))) return false;
+		m_base = fields[1];
+		SetBits(fields[2] == 10 ? 8 : fields[3]);
+		m_flags = fields[5];
+		memcpy(&m_startTime, m_data + 32, 8);
+		for (uint32_t i = 0; i < fields[4]; ++i)
+		{
+			const unsigned char* p = m_data + 40 + i * NKBEF_HEADER_CHANNEL;
+			int32_t type;
+			memcpy(&type, p, 4);
+			nkbefPin pin = { (long long)i, std::string(), (long)type };
+			for (size_t c = 0; c < NKBEF_HEADER_NAME; ++c)
+			{
+				unsigned ch = p[4 + 2 * c] | (p[5 + 2 * c] << 8);
+				if (!ch) break;
+				if ((ch >= 0xD800) && (ch < 0xDC00) && (c + 1 < NKBEF_HEADER_NAME))
+				{
+					++c;
+					ch = 0x10000 + ((ch - 0xD800) << 10) + ((p[4 + 2 * c] | (p[5 + 2 * c] << 8)) - 0xDC00);
+				}
+				AppendUtf8(pin.name, ch);
+			}
+			m_pins.push_back(pin);
+		}
+		return true;
+	}
+
+	// pins: read the pin and bits lines (the header has them)
+	void ParseAppendix(const unsigned char* p, size_t size, bool pins)
+	{
+		// the UTF-16 text ends at a NUL character or at the end of the appendix.
+		// the binary blocks follow the NUL character in the order of their lines.
+		std::string text;
+		size_t blocks = size;
+		for (size_t i = 0; i + 1 < size; i += 2)
+		{
+			unsigned c = p[i] | (p[i + 1] << 8);
+			if (!c)
+			{
+				blocks = i + 2;
+				break;
+			}
+			if ((c >= 0xD800) && (c < 0xDC00) && (i + 3 < size))
+			{
+				unsigned c2 = p[i + 2] | (p[i + 3] << 8);
+				c = 0x10000 + ((c - 0xD800) << 10) + (c2 - 0xDC00);
+				i += 2;
+			}
+			AppendUtf8(text, c);
+		}
+		uint64_t chunks = 0;
+		uint64_t index = 0;
+		uint64_t lod = 0;
+		size_t begin = 0;
+		while (begin < text.size())
+		{
+			size_t end = text.find('\n', begin);
+			if (end == std::string::npos) end = text.size();
+			std::vector<std::string> fields;
+			for (size_t f = begin; f <= end; )
+			{
+				size_t tab = text.find('\t', f);
+				if ((tab == std::string::npos) || (tab > end)) tab = end;
+				fields.push_back(text.substr(f, tab - f));
+				f = tab + 1;
+			}
+			begin = end + 1;
+			if (!pins && ((fields[0] == "pin") || (fields[0] == "bits")))
+			{
+				continue;
+			}
+			if ((fields[0] == "pin") && (fields.size() == 4))
+			{
+				nkbefPin pin = { atoll(fields[1].c_str()), fields[2], atol(fields[3].c_str()) };
+				if (pin.index != (long long)m_pins.size()) break;
+				m_pins.push_back(pin);
+			}
+			else if ((fields[0] == "bits") && (fields.size() == 2))
+			{
+				long bits = atol(fields[1].c_str());
+				SetBits(bits < 8 ? 8 : bits > 16 ? 16 : bits);
+			}
+			else if ((fields[0] == "clock") && (fields.size() >= 4))
+			{
+				m_clockPpm = atof(fields[1].c_str());
+				m_clockError = atof(fields[2].c_str());
+				m_clockMaxError = atof(fields[3].c_str());
+			}
+			else if ((fields[0] == "device") && (fields.size() >= 7))
+			{
+				nkbefDevice device = { fields[1], atol(fields[2].c_str()), atol(fields[3].c_str()),
+					atof(fields[4].c_str()), atof(fields[5].c_str()), atof(fields[6].c_str()) };
+				m_devices.push_back(device);
+			}
+			else if ((fields[0] == "chunks") && (fields.size() >= 2))
+			{
+				chunks = strtoull(fields[1].c_str(), NULL, 10);
+			}
+			else if ((fields[0] == "index") && (fields.size() >= 2))
+			{
+				index = strtoull(fields[1].c_str(), NULL, 10);
+			}
+			else if ((fields[0] == "lod") && (fields.size() >= 4))
+			{
+				lod = strtoull(fields[1].c_str(), NULL, 10);
+				m_lodShift = (unsigned)atol(fields[2].c_str());
+				m_lodLast = strtoull(fields[3].c_str(), NULL, 10);
+			}
+		}
+		// the chunk table only occurs in compressed recordings; an index entry is 16 bytes
+		if ((blocks > size) || (chunks > (size - blocks) / NKBEF_CHUNK_ENTRY)) return;
+		size_t offset = blocks;
+		m_chunks.resize(size_t(chunks));
+		for (auto& c : m_chunks)
+		{
+			memcpy(&c, p + offset, NKBEF_CHUNK_ENTRY);
+			offset += NKBEF_CHUNK_ENTRY;
+		}
+		if (!lod || (index > (size - offset) / 16)) return;
+		offset += size_t(index) * 16;
+		if (lod > (size - offset) / NKBEF_LOD_ENTRY) return;
+		m_lod.resize(size_t(lod));
+		for (auto& e : m_lod)
+		{
+			memcpy(&e.bucket, p + offset, 8);
+			memcpy(&e.edges, p + offset + 8, 4);
+			memcpy(&e.before, p + offset + 12, 2);
+			memcpy(&e.min, p + offset + 14, 2);
+			memcpy(&e.max, p + offset + 16, 2);
+			memcpy(&e.last, p + offset + 18, 2);
+			e.channel = p[offset + 20];
+			e.level = p[offset + 21];
+			offset += NKBEF_LOD_ENTRY;
+		}
+	}
+
+	static void AppendUtf8(std::string& s, unsigned c)
+	{
+		if (c < 0x80)
+		{
+			s += char(c);
+		}
+		else if (c < 0x800)
+		{
+			s += char(0xC0 | (c >> 6));
+			s += char(0x80 | (c & 0x3F));
+		}
+		else if (c < 0x10000)
+		{
+			s += char(0xE0 | (c >> 12));
+			s += char(0x80 | ((c >> 6) & 0x3F));
+			s += char(0x80 | (c & 0x3F));
+		}
+		else
+		{
+			s += char(0xF0 | (c >> 18));
+			s += char(0x80 | ((c >> 12) & 0x3F));
+			s += char(0x80 | ((c >> 6) & 0x3F));
+			s += char(0x80 | (c & 0x3F));
+		}
+	}
+
+	nkbefMap m_view;
+	uint64_t m_rangeFirst; // the part of a compressed recording that is decoded
+	uint64_t m_rangeLast;
+	std::vector<bool> m_selected;
+#ifdef _WIN32
+	HANDLE m_file;
+	HANDLE m_temp;  // the decoded samples of a compressed recording
+#else
+	int    m_fd;
+	FILE*  m_temp;
+#endif
+};
+
+// UTF-8 to UTF-16LE
+inline void nkbefAppendUtf16(std::vector<unsigned char>& utf16, const std::string& text)
+{
+	for (size_t i = 0; i < text.size(); )
+	{
+		unsigned c = (unsigned char)text[i++];
+		int more = (c >= 0xF0) ? 3 : (c >= 0xE0) ? 2 : (c >= 0xC0) ? 1 : 0;
+		if (more) c &= 0x3F >> more;
+		for (; more && (i < text.size()); --more) c = (c << 6) | (text[i++] & 0x3F);
+		if (c >= 0x10000)
+		{
+			c -= 0x10000;
+			unsigned high = 0xD800 + (c >> 10);
+			utf16.push_back((unsigned char)high);
+			utf16.push_back((unsigned char)(high >> 8));
+			c = 0xDC00 + (c & 0x3FF);
+		}
+		utf16.push_back((unsigned char)c);
+		utf16.push_back((unsigned char)(c >> 8));
+	}
+}
+
+// write the header: the samples follow at NKBEF_HEADER_SIZE
+inline bool nkbefWriteHeader(FILE* out, const std::vector<nkbefPin>& pins, long bits, uint64_t startTime, uint32_t flags)
+{
+	if (pins.size() > NKBEF_HEADER_CHANNELS) return false;
+	std::vector<unsigned char> header(NKBEF_HEADER_SIZE, 0);
+	uint32_t fields[6] = { NKBEF_HEADER_VERSION, NKBEF_HEADER_SIZE, uint32_t(bits == 8 ? 10 : 11), uint32_t(bits), uint32_t(pins.size()), flags };
+	memcpy(&header[0], "NKBEF", 6);
+	memcpy(&header[8], fields, sizeof(fields));
+	memcpy(&header[32], &startTime, 8);
+	for (size_t i = 0; i < pins.size(); ++i)
+	{
+		unsigned char* p = &header[40 + i * NKBEF_HEADER_CHANNEL];
+		int32_t type = int32_t(pins[i].type);
+		memcpy(p, &type, 4);
+		std::vector<unsigned char> name;
+		nkbefAppendUtf16(name, pins[i].name);
+		if (name.size() > 2 * (NKBEF_HEADER_NAME - 1)) name.resize(2 * (NKBEF_HEADER_NAME - 1));
+		if (name.size()) memcpy(p + 4, &name[0], name.size());
+	}
+	return fwrite(&header[0], 1, header.size(), out) == header.size();
+}
+
+// write the 'pin' and 'bits' lines of the appendix and the offset of the appendix (the end of the samples)
+inline bool nkbefWriteAppendix(FILE* out, const std::vector<nkbefPin>& pins, long bits, uint64_t lastsample)
+{
+	std::string text;
+	for (auto& pin : pins)
+	{
+		text += "pin\t" + std::to_string(pin.index) + "\t" + pin.name + "\t" + std::to_string(pin.type) + "\n";
+	}
+	text += "bits\t" + std::to_string(bits) + "\n";
+	std::vector<unsigned char> utf16;
+	nkbefAppendUtf16(utf16, text);
+	if (utf16.size() && (fwrite(&utf16[0], 1, utf16.size(), out) != utf16.size())) return false;
+	return fwrite(&lastsample, 8, 1, out) == 1;
+}
+
+inline void nkbefAppendDigits(std::string& out, uint64_t value, int digits)
+{
+	char buf[20];
+	for (int i = digits - 1; i >= 0; --i)
+	{
+		buf[i] = char('0' + value % 10);
+		value /= 10;
+	}
+	out.append(buf, digits);
+}
+
+inline void nkbefAppendUnsigned(std::string& out, uint64_t value)
+{
+	char buf[20];
+	int i = 20;
+	do
+	{
+		buf[--i] = char('0' + value % 10);
+		value /= 10;
+	} while (value);
+	out.append(buf + i, 20 - i);
+}
+
+inline void nkbefAppendSigned(std::string& out, long long value)
+{
+	if (value < 0)
+	{
+		out += '-';
+		nkbefAppendUnsigned(out, 0ULL - (uint64_t)value);
+	}
+	else
+	{
+		nkbefAppendUnsigned(out, (uint64_t)value);
+	}
+}
+
+// formats FILETIME timestamps as local time 'yyyy-mm-dd hh:mm:ss.uuuuuu'.
+// the date and time part is converted once per second.
+class nkbefLocalTime
+{
+public:
+	nkbefLocalTime()
+	: m_second(~0ULL)
+	{
+		m_prefix[0] = 0;
+	}
+
+	void Append(std::string& out, uint64_t timestamp)
+	{
+		uint64_t second = timestamp / NKBEF_SECOND;
+		if (second != m_second)
+		{
+			m_second = second;
+			time_t t = (time_t)((long long)second - (long long)NKBEF_UNIX_EPOCH);
+			struct tm tm;
+#ifdef _WIN32
+			bool ok = !localtime_s(&tm, &t);
+#else
+			bool ok = localtime_r(&t, &tm) != NULL;
+#endif
+			if (!ok) memset(&tm, 0, sizeof(tm));
+			std::string prefix;
+			nkbefAppendDigits(prefix, tm.tm_year + 1900, 4);
+			prefix += '-';
+			nkbefAppendDigits(prefix, tm.tm_mon + 1, 2);
+			prefix += '-';
+			nkbefAppendDigits(prefix, tm.tm_mday, 2);
+			prefix += ' ';
+			nkbefAppendDigits(prefix, tm.tm_hour, 2);
+			prefix += ':';
+			nkbefAppendDigits(prefix, tm.tm_min, 2);
+			prefix += ':';
+			nkbefAppendDigits(prefix, tm.tm_sec, 2);
+			prefix += '.';
+			memcpy(m_prefix, prefix.c_str(), prefix.size());
+		}
+		out.append(m_prefix, 20);
+		nkbefAppendDigits(out, (timestamp % NKBEF_SECOND) / 10, 6);
+	}
+
+private:
+	uint64_t m_second;
+	char     m_prefix[20];
+};
+
+// format the samples [begin, end) of the channels < channels as text lines
+inline void nkbefFormatRange(const nkbefFile* file, size_t begin, size_t end, size_t channels, bool relative, uint64_t start, std::string* out)
+{
+	nkbefLocalTime localTime;
+	nkbefSample s;
+	out->clear();
+	out->reserve((end - begin) * 32);
+	for (size_t i = begin; i < end; ++i)
+	{
+		file->Get(i, s);
+		if ((s.channel < 0) || ((size_t)s.channel >= channels)) continue;
+		if (relative)
+		{
+			nkbefAppendSigned(*out, ((long long)(s.timestamp - start)) / 10);
+		}
+		else
+		{
+			localTime.Append(*out, s.timestamp);
+		}
+		*out += '\t';
+		nkbefAppendUnsigned(*out, (uint64_t)s.channel);
+		*out += '\t';
+		nkbefAppendUnsigned(*out, s.state);
+		*out += '\n';
+	}
+}
+
+// write the recording as text, like the *.nktef (absolute local time) and *.nkref (microseconds
+// since the first sample) formats of panelScope::SaveFile. ranges of NKBEF_EXPORT_RANGE samples
+// are formatted in parallel and written in order.
+inline bool nkbefExportText(const nkbefFile& file, const std::vector<std::string>& names, FILE* out, bool relative, unsigned threads = 0)
+{
+	if (!threads) threads = std::thread::hardware_concurrency();
+	if (!threads) threads = 1;
+	std::string header;
+	for (size_t i = 0; i < names.size(); ++i)
+	{
+		if (names[i].empty()) continue;
+		header += "pin\t";
+		nkbefAppendUnsigned(header, i);
+		header += '\t';
+		header += names[i];
+		header += '\n';
+	}
+	header += "time\tpin\tstate\n";
+	if (fwrite(header.c_str(), 1, header.size(), out) != header.size()) return false;
+	size_t count = file.Count();
+	if (!count) return true;
+	nkbefSample first;
+	file.Get(0, first);
+	std::vector<std::string> buffers(threads);
+	for (size_t begin = 0; begin < count; begin += threads * (size_t)NKBEF_EXPORT_RANGE)
+	{
+		std::vector<std::thread> workers;
+		size_t ranges = 0;
+		for (; ranges < threads; ++ranges)
+		{
+			size_t b = begin + ranges * NKBEF_EXPORT_RANGE;
+			if (b >= count) break;
+			size_t e = (count - b > NKBEF_EXPORT_RANGE) ? b + NKBEF_EXPORT_RANGE : count;
+			if (ranges) workers.push_back(std::thread(nkbefFormatRange, &file, b, e, names.size(), relative, first.timestamp, &buffers[ranges]));
+			else nkbefFormatRange(&file, b, e, names.size(), relative, first.timestamp, &buffers[0]);
+		}
+		for (auto& worker : workers)
+		{
+			worker.join();
+		}
+		for (size_t i = 0; i < ranges; ++i)
+		{
+			if (fwrite(buffers[i].data(), 1, buffers[i].size(), out) != buffers[i].size()) return false;
+		}
+	}
+	return true;
+}
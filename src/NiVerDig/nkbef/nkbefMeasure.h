@@ -0,0 +1,368 @@
+#pragma once
+
+// measurement engine for NiVerDig binary event recordings (*.nkbef): per channel the number
+// of samples and edges, the distributions of the high and low pulse widths and the periods,
+// the duty cycle, and the latency from the edges of one channel to those of another
+// (e.g. a trigger output to an exposure input). it does not depend on the user interface:
+// used by the scope window and by the nkbef command line tool.
+// the samples are measured in ranges of NKBEF_MEASURE_RANGE samples on several threads:
+//   1: per range the last state of every channel, so every range knows the states at its start
+//   2: per range the edges, intervals and latencies within the range, and the first and last
+//      edges needed for the intervals that cross into the next range
+// the partial results are merged in the order of the ranges, so the result is that of a
+// sequential pass. as the levels alternate, an interval that crosses into the next range
+// ends at the first rising or falling edge of that range.
+
+#include "nkbef.h"
+#include <atomic>
+
+#define NKBEF_MEASURE_RANGE    (1024 * 1024) // samples per range measured by one thread
+#define NKBEF_MEASURE_CHANNELS 128           // the channel is a char and the tick events use its bitwise not
+
+// durations in microseconds in power of two bins
+struct nkbefHistogram
+{
+	nkbefHistogram()
+	: count(0)
+	, sum(0.)
+	, min(~0ULL)
+	, max(0)
+	{
+		memset(bins, 0, sizeof(bins));
+	}
+
+	void add(uint64_t us)
+	{
+		int bin = 0;
+		while ((bin < 63) && ((us >> (bin + 1)) != 0)) ++bin;
+		++bins[bin];
+		++count;
+		sum += double(us);
+		if (us < min) min = us;
+		if (us > max) max = us;
+	}
+
+	void add(const nkbefHistogram& h)
+	{
+		for (int bin = 0; bin < 64; ++bin)
+		{
+			bins[bin] += h.bins[bin];
+		}
+		count += h.count;
+		sum += h.sum;
+		if (h.min < min) min = h.min;
+		if (h.max > max) max = h.max;
+	}
+
+	double mean() const { return count ? sum / count : 0.; }
+
+	uint64_t bins[64];
+	uint64_t count;
+	double   sum;
+	uint64_t min;
+	uint64_t max;
+};
+
+struct nkbefChannelMeasure
+{
+	nkbefChannelMeasure()
+	: samples(0)
+	, edges(0)
+	, min(~0U)
+	, max(0)
+	, state(-1)
+	, rise(0)
+	, fall(0)
+	, firstRise(0)
+	, firstFall(0)
+	, fallFirst(false)
+	{
+	}
+
+	// the fraction of the time high, -1 without complete pulses
+	double duty() const
+	{
+		double total = high.sum + low.sum;
+		return total ? high.sum / total : -1.;
+	}
+
+	uint64_t       samples;
+	uint64_t       edges;
+	unsigned       min;
+	unsigned       max;
+	nkbefHistogram high;
+	nkbefHistogram low;
+	nkbefHistogram period;
+	// the state and the edges at the borders of a range, see nkbefMeasure::Merge
+	long           state;     // -1: unknown
+	uint64_t       rise;      // last rising edge (0: none)
+	uint64_t       fall;      // last falling edge
+	uint64_t       firstRise; // first rising edge
+	uint64_t       firstFall; // first falling edge
+	bool           fallFirst; // the first edge falls
+};
+
+// the time from an edge on channel from to the next edge on channel to.
+// an edge on from that is not answered before the next one is dropped.
+struct nkbefLatency
+{
+	long           from;
+	bool           fromRising;
+	long           to;
+	bool           toRising;
+	nkbefHistogram latency;
+	uint64_t       pending;  // the unanswered edge on from (0: none)
+	uint64_t       firstTo;  // the first edge on to before the first edge on from
+	bool           sawFrom;  // an edge on from
+};
+
+class nkbefMeasure
+{
+public:
+	nkbefMeasure()
+	: m_first(0)
+	, m_last(~0ULL)
+	, m_threads(0)
+	, m_channels(NKBEF_MEASURE_CHANNELS)
+	{
+	}
+
+	void AddLatency(long from, bool fromRising, long to, bool toRising)
+	{
+		nkbefLatency latency = { from, fromRising, to, toRising, nkbefHistogram(), 0, 0, false };
+		m_latencies.push_back(latency);
+	}
+
+	// measure the samples from m_first up to m_last. the state of a channel is known
+	// from its first sample in the range.
+	bool Run(const nkbefFile& file)
+	{
+		unsigned threads = m_threads ? m_threads : std::thread::hardware_concurrency();
+		if (!threads) threads = 1;
+		size_t count = file.Count();
+		size_t begin = file.Find(m_first);
+		size_t end = (m_last == ~0ULL) ? count : file.Find(m_last + 2 * NKBEF_DISORDER);
+		if (end < begin) end = begin;
+		size_t ranges = (end - begin + NKBEF_MEASURE_RANGE - 1) / NKBEF_MEASURE_RANGE;
+		// 1: the states at the end of every range
+		std::vector<std::vector<long> > states(ranges + 1, std::vector<long>(NKBEF_MEASURE_CHANNELS, -1));
+		std::vector<std::vector<long> > ticks(ranges, std::vector<long>(NKBEF_MEASURE_CHANNELS, -1));
+		std::atomic<size_t> next(0);
+		auto scan = [&]()
+		{
+			for (size_t r = next++; r < ranges; r = next++)
+			{
+				size_t b = begin + r * NKBEF_MEASURE_RANGE;
+				States(file, b, (end - b > NKBEF_MEASURE_RANGE) ? b + NKBEF_MEASURE_RANGE : end, states[r + 1], ticks[r]);
+			}
+		};
+		Parallel(scan, threads);
+		for (size_t r = 0; r < ranges; ++r)
+		{
+			for (size_t c = 0; c < NKBEF_MEASURE_CHANNELS; ++c)
+			{
+				// a tick event only sets an unknown state
+				if (states[r + 1][c] < 0) states[r + 1][c] = (states[r][c] >= 0) ? states[r][c] : ticks[r][c];
+			}
+		}
+		// 2: the ranges of a batch are measured in parallel and merged in order
+		std::vector<nkbefMeasure> parts(threads);
+		for (size_t batch = 0; batch < ranges; batch += threads)
+		{
+			size_t n = (ranges - batch < threads) ? ranges - batch : threads;
+			for (size_t i = 0; i < n; ++i)
+			{
+				parts[i].Reset(*this, states[batch + i]);
+			}
+			next = 0;
+			auto measure = [&]()
+			{
+				for (size_t i = next++; i < n; i = next++)
+				{
+					size_t b = begin + (batch + i) * NKBEF_MEASURE_RANGE;
+					parts[i].Scan(file, b, (end - b > NKBEF_MEASURE_RANGE) ? b + NKBEF_MEASURE_RANGE : end);
+				}
+			};
+			Parallel(measure, (unsigned)n);
+			for (size_t i = 0; i < n; ++i)
+			{
+				Merge(parts[i]);
+			}
+		}
+		return true;
+	}
+
+	uint64_t m_first;  // range of the measurement: timestamps (FILETIME)
+	uint64_t m_last;
+	unsigned m_threads; // 0: one per processor
+	std::vector<nkbefChannelMeasure> m_channels;
+	std::vector<nkbefLatency> m_latencies;
+
+private:
+	template <typename F>
+	static void Parallel(F& work, unsigned threads)
+	{
+		std::vector<std::thread> workers;
+		for (unsigned i = 1; i < threads; ++i)
+		{
+			workers.push_back(std::thread([&work]() { work(); }));
+		}
+		work();
+		for (auto& worker : workers)
+		{
+			worker.join();
+		}
+	}
+
+	bool InRange(uint64_t timestamp) const
+	{
+		return (timestamp >= m_first) && (timestamp < m_last);
+	}
+
+	// the last state of the samples and the first state of the tick events in [begin, end)
+	void States(const nkbefFile& file, size_t begin, size_t end, std::vector<long>& states, std::vector<long>& ticks) const
+	{
+		nkbefSample s;
+		for (size_t i = begin; i < end; ++i)
+		{
+			file.Get(i, s);
+			if (!InRange(s.timestamp)) continue;
+			if (s.channel < 0)
+			{
+				if (ticks[~s.channel] < 0) ticks[~s.channel] = s.state;
+			}
+			else
+			{
+				states[s.channel] = s.state;
+			}
+		}
+	}
+
+	// an empty part of the measurement of owner that starts with the states
+	void Reset(const nkbefMeasure& owner, const std::vector<long>& states)
+	{
+		m_first = owner.m_first;
+		m_last = owner.m_last;
+		m_channels.assign(NKBEF_MEASURE_CHANNELS, nkbefChannelMeasure());
+		for (size_t c = 0; c < NKBEF_MEASURE_CHANNELS; ++c)
+		{
+			m_channels[c].state = states[c];
+		}
+		m_latencies = owner.m_latencies;
+		for (auto& l : m_latencies)
+		{
+			l.latency = nkbefHistogram();
+			l.pending = 0;
+			l.firstTo = 0;
+			l.sawFrom = false;
+		}
+	}
+
+	void Scan(const nkbefFile& file, size_t begin, size_t end)
+	{
+		nkbefSample s;
+		for (size_t i = begin; i < end; ++i)
+		{
+			file.Get(i, s);
+			if (!InRange(s.timestamp)) continue;
+			bool tick = s.channel < 0;
+			nkbefChannelMeasure& c = m_channels[tick ? ~s.channel : s.channel];
+			if (tick)
+			{
+				// tick events repeat the state
+				if (c.state < 0) c.state = s.state;
+				continue;
+			}
+			++c.samples;
+			if (s.state < c.min) c.min = s.state;
+			if (s.state > c.max) c.max = s.state;
+			if ((c.state >= 0) && (s.state != (unsigned)c.state))
+			{
+				++c.edges;
+				// the pulses are between the changes of the level: zero or not
+				bool adc = ((size_t)s.channel < file.m_pins.size()) && (file.m_pins[s.channel].type == NKBEF_ADC_PIN);
+				if (!adc && ((s.state != 0) != (c.state != 0))) Edge(c, s.channel, s.state != 0, s.timestamp);
+			}
+			c.state = s.state;
+		}
+	}
+
+	void Edge(nkbefChannelMeasure& c, long channel, bool rising, uint64_t timestamp)
+	{
+		if (rising)
+		{
+			if (c.fall) c.low.add((timestamp - c.fall) / 10);
+			if (c.rise) c.period.add((timestamp - c.rise) / 10);
+			if (!c.firstRise) c.firstRise = timestamp;
+			c.rise = timestamp;
+		}
+		else
+		{
+			if (c.rise) c.high.add((timestamp - c.rise) / 10);
+			if (!c.firstRise && !c.firstFall) c.fallFirst = true;
+			if (!c.firstFall) c.firstFall = timestamp;
+			c.fall = timestamp;
+		}
+		for (auto& l : m_latencies)
+		{
+			if ((l.from == channel) && (l.fromRising == rising))
+			{
+				l.pending = timestamp;
+				l.sawFrom = true;
+			}
+			else if ((l.to == channel) && (l.toRising == rising))
+			{
+				if (l.pending) l.latency.add((timestamp - l.pending) / 10);
+				else if (!l.sawFrom && !l.firstTo) l.firstTo = timestamp;
+				l.pending = 0;
+			}
+		}
+	}
+
+	// append the next range: the intervals that cross the border end at the first edges of
+	// the part and start at the last edges of this
+	void Merge(const nkbefMeasure& part)
+	{
+		for (size_t i = 0; i < m_channels.size(); ++i)
+		{
+			nkbefChannelMeasure& c = m_channels[i];
+			const nkbefChannelMeasure& p = part.m_channels[i];
+			if (p.firstRise)
+			{
+				if (c.fall && !(p.firstFall && p.fallFirst)) c.low.add((p.firstRise - c.fall) / 10);
+				if (c.rise) c.period.add((p.firstRise - c.rise) / 10);
+			}
+			if (p.firstFall && c.rise && !(p.firstRise && !p.fallFirst)) c.high.add((p.firstFall - c.rise) / 10);
+			if (!c.firstRise && !c.firstFall) c.fallFirst = p.fallFirst;
+			if (!c.firstRise) c.firstRise = p.firstRise;
+			if (!c.firstFall) c.firstFall = p.firstFall;
+			if (p.rise) c.rise = p.rise;
+			if (p.fall) c.fall = p.fall;
+			c.state = p.state;
+			c.samples += p.samples;
+			c.edges += p.edges;
+			if (p.min < c.min) c.min = p.min;
+			if (p.max > c.max) c.max = p.max;
+			c.high.add(p.high);
+			c.low.add(p.low);
+			c.period.add(p.period);
+		}
+		for (size_t i = 0; i < m_latencies.size(); ++i)
+		{
+			nkbefLatency& l = m_latencies[i];
+			const nkbefLatency& p = part.m_latencies[i];
+			if (p.firstTo)
+			{
+				if (l.pending) l.latency.add((p.firstTo - l.pending) / 10);
+				else if (!l.sawFrom && !l.firstTo) l.firstTo = p.firstTo;
+				l.pending = 0;
+			}
+			if (p.sawFrom)
+			{
+				l.pending = p.pending;
+				l.sawFrom = true;
+			}
+			l.latency.add(p.latency);
+		}
+	}
+};
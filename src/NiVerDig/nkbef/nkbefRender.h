@@ -0,0 +1,890 @@
+#pragma once
+
+// headless renderer of a window of a NiVerDig binary event recording (*.nkbef), with the
+// layout of the scope window (NkDigTimerGraph): the pin names left of the graph area, a lane
+// per pin (digital pins low or high, ADC pins scaled to the lane), a grid of 10 divisions
+// and the time since the start of the window below it.
+// the layout draws on a nkbefCanvas: nkbefSvg writes vector graphics, nkbefRaster an image
+// that is saved as PNG. when a pixel spans at least a bucket of the level-of-detail pyramid
+// of the appendix, the window is drawn from the pyramid, else from the samples. per lane at
+// most one vertical line per pixel column is drawn, whatever the number of samples.
+// used by the nkbef command line tool; the time axis is shared with NkDigTimerGraph.
+
+#include "nkbef.h"
+#include <algorithm>
+
+#define NKBEF_US_PER_MS     1000ULL
+#define NKBEF_US_PER_SECOND (1000ULL * NKBEF_US_PER_MS)
+#define NKBEF_US_PER_MINUTE (60ULL * NKBEF_US_PER_SECOND)
+#define NKBEF_US_PER_HOUR   (60ULL * NKBEF_US_PER_MINUTE)
+#define NKBEF_US_PER_DAY    (24ULL * NKBEF_US_PER_HOUR)
+
+#define NKBEF_WHITE      0xFFFFFF
+#define NKBEF_LIGHT_GREY 0xC0C0C0
+#define NKBEF_BLACK      0x000000
+#define NKBEF_BLUE       0x0000FF
+
+#define NKBEF_STATE_SCAN (1024 * 1024) // samples scanned back for the state of the lanes without pyramid
+
+// the step of the time axis labels in microseconds: the first of 1-2-5 up to seconds,
+// then 10 s, 30 s, 1, 5, 10 and 30 minutes, 1, 4 and 8 hours, a day and a week,
+// that is at least the time per label
+inline uint64_t nkbefTimeStep(uint64_t us_per_label)
+{
+	static const uint64_t steps[] =
+	{
+		1, 2, 5, 10, 20, 50, 100, 200, 500,
+		NKBEF_US_PER_MS, 2 * NKBEF_US_PER_MS, 5 * NKBEF_US_PER_MS, 10 * NKBEF_US_PER_MS, 20 * NKBEF_US_PER_MS, 50 * NKBEF_US_PER_MS,
+		100 * NKBEF_US_PER_MS, 200 * NKBEF_US_PER_MS, 500 * NKBEF_US_PER_MS,
+		NKBEF_US_PER_SECOND, 2 * NKBEF_US_PER_SECOND, 5 * NKBEF_US_PER_SECOND, 10 * NKBEF_US_PER_SECOND, 30 * NKBEF_US_PER_SECOND,
+		NKBEF_US_PER_MINUTE, 5 * NKBEF_US_PER_MINUTE, 10 * NKBEF_US_PER_MINUTE, 30 * NKBEF_US_PER_MINUTE,
+		NKBEF_US_PER_HOUR, 4 * NKBEF_US_PER_HOUR, 8 * NKBEF_US_PER_HOUR, NKBEF_US_PER_DAY, 7 * NKBEF_US_PER_DAY
+	};
+	size_t i = 0;
+	while ((i + 1 < sizeof(steps) / sizeof(steps[0])) && (steps[i] < us_per_label)) ++i;
+	return steps[i];
+}
+
+// the label of the time t (microseconds since the start of the window) in the unit of the caption
+inline std::string nkbefTimeLabel(uint64_t t, uint64_t step)
+{
+	char text[32];
+	unsigned long long value;
+	const char* format = "%02llu";
+	if (step < NKBEF_US_PER_MS)
+	{
+		value = t;
+		format = "%6llu";
+	}
+	else if (step < NKBEF_US_PER_SECOND)
+	{
+		value = t / NKBEF_US_PER_MS;
+		format = "%3llu";
+	}
+	else if (step < NKBEF_US_PER_MINUTE) value = t / NKBEF_US_PER_SECOND;
+	else if (step < NKBEF_US_PER_HOUR) value = t / NKBEF_US_PER_MINUTE;
+	else value = t / NKBEF_US_PER_HOUR;
+	snprintf(text, sizeof(text), format, value);
+	return text;
+}
+
+inline const char* nkbefTimeCaption(uint64_t step)
+{
+	if (step < NKBEF_US_PER_MS) return "[microseconds]";
+	if (step < NKBEF_US_PER_SECOND) return "[milliseconds]";
+	if (step < NKBEF_US_PER_MINUTE) return "[seconds]";
+	if (step < NKBEF_US_PER_HOUR) return "[minutes]";
+	return "[hours]";
+}
+
+// the output of the renderer. colors are 0xRRGGBB.
+class nkbefCanvas
+{
+public:
+	enum EAlign { ALIGN_LEFT, ALIGN_CENTER, ALIGN_RIGHT };
+
+	virtual ~nkbefCanvas() {}
+	virtual void Begin(int width, int height) = 0;
+	virtual void Fill(int x, int y, int width, int height, uint32_t color) = 0;
+	virtual void Line(int x1, int y1, int x2, int y2, uint32_t color) = 0;
+	// the text vertically centered between top and bottom
+	virtual void Text(int left, int right, int top, int bottom, const std::string& text, EAlign align, uint32_t color) = 0;
+	virtual int TextWidth(const std::string& text) const = 0;
+	virtual int TextHeight() const = 0;
+};
+
+// SVG: the lines of a color are collected in one path
+class nkbefSvg : public nkbefCanvas
+{
+public:
+	nkbefSvg()
+	: m_color(0)
+	, m_x(-1)
+	, m_y(-1)
+	{}
+
+	virtual void Begin(int width, int height)
+	{
+		m_text = "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n";
+		m_text += "<svg xmlns=\"http://www.w3.org/2000/svg\" width=\"" + std::to_string(width) + "\" height=\"" + std::to_string(height)
+			+ "\" viewBox=\"0 0 " + std::to_string(width) + " " + std::to_string(height) + "\" shape-rendering=\"crispEdges\""
+			+ " font-family=\"monospace\" font-size=\"12\">\n";
+		m_path.clear();
+		m_x = m_y = -1;
+	}
+
+	virtual void Fill(int x, int y, int width, int height, uint32_t color)
+	{
+		Flush();
+		m_text += "<rect x=\"" + std::to_string(x) + "\" y=\"" + std::to_string(y) + "\" width=\"" + std::to_string(width)
+			+ "\" height=\"" + std::to_string(height) + "\" fill=\"" + Color(color) + "\"/>\n";
+	}
+
+	virtual void Line(int x1, int y1, int x2, int y2, uint32_t color)
+	{
+		if (m_path.size() && (color != m_color)) Flush();
+		m_color = color;
+		// pixel centers, as the lines of the raster
+		if ((x1 != m_x) || (y1 != m_y)) m_path += "M" + std::to_string(x1) + ".5 " + std::to_string(y1) + ".5";
+		m_path += "L" + std::to_string(x2) + ".5 " + std::to_string(y2) + ".5";
+		m_x = x2;
+		m_y = y2;
+	}
+
+	virtual void Text(int left, int right, int top, int bottom, const std::string& text, EAlign align, uint32_t color)
+	{
+		Flush();
+		int x = (align == ALIGN_LEFT) ? left : (align == ALIGN_RIGHT) ? right : (left + right) / 2;
+		const char* anchor = (align == ALIGN_LEFT) ? "start" : (align == ALIGN_RIGHT) ? "end" : "middle";
+		m_text += "<text x=\"" + std::to_string(x) + "\" y=\"" + std::to_string((top + bottom) / 2) + "\" text-anchor=\"" + anchor
+			+ "\" dominant-baseline=\"central\" fill=\"" + Color(color) + "\">";
+		for (char c : text)
+		{
+			if (c == '<') m_text += "&lt;";
+			else if (c == '>') m_text += "&gt;";
+			else if (c == '&') m_text += "&amp;";
+			else m_text += c;
+		}
+		m_text += "</text>\n";
+	}
+
+	virtual int TextWidth(const std::string& text) const { return int(text.size()) * 7; }
+	virtual int TextHeight() const { return 14; }
+
+	// the document
+	const std::string& End()
+	{
+		Flush();
+		m_text += "</svg>\n";
+		return m_text;
+	}
+
+private:
+	void Flush()
+	{
+		if (m_path.empty()) return;
+		m_text += "<path fill=\"none\" stroke=\"" + Color(m_color) + "\" d=\"" + m_path + "\"/>\n";
+		m_path.clear();
+		m_x = m_y = -1;
+	}
+
+	static std::string Color(uint32_t color)
+	{
+		char text[8];
+		snprintf(text, sizeof(text), "#%06X", (unsigned)(color & 0xFFFFFF));
+		return text;
+	}
+
+	std::string m_text;
+	std::string m_path;  // the lines since the last element
+	uint32_t    m_color; // of the path
+	int         m_x;     // end of the path
+	int         m_y;
+};
+
+// RGB image with a 5x7 pixel font, saved as PNG
+class nkbefRaster : public nkbefCanvas
+{
+public:
+	nkbefRaster()
+	: m_width(0)
+	, m_height(0)
+	{}
+
+	virtual void Begin(int width, int height)
+	{
+		m_width = width > 0 ? width : 0;
+		m_height = height > 0 ? height : 0;
+		m_pixels.assign(size_t(m_width) * m_height * 3, 0xFF);
+	}
+
+	virtual void Fill(int x, int y, int width, int height, uint32_t color)
+	{
+		for (int j = y; j < y + height; ++j)
+		{
+			for (int i = x; i < x + width; ++i)
+			{
+				Set(i, j, color);
+			}
+		}
+	}
+
+	// Bresenham, both end points included
+	virtual void Line(int x1, int y1, int x2, int y2, uint32_t color)
+	{
+		int dx = x2 > x1 ? x2 - x1 : x1 - x2;
+		int dy = y2 > y1 ? y1 - y2 : y2 - y1;
+		int sx = x1 < x2 ? 1 : -1;
+		int sy = y1 < y2 ? 1 : -1;
+		int error = dx + dy;
+		for (;;)
+		{
+			Set(x1, y1, color);
+			if ((x1 == x2) && (y1 == y2)) break;
+			int e2 = 2 * error;
+			if (e2 >= dy)
+			{
+				error += dy;
+				x1 += sx;
+			}
+			if (e2 <= dx)
+			{
+				error += dx;
+				y1 += sy;
+			}
+		}
+	}
+
+	virtual void Text(int left, int right, int top, int bottom, const std::string& text, EAlign align, uint32_t color)
+	{
+		int width = TextWidth(text);
+		int x = (align == ALIGN_LEFT) ? left : (align == ALIGN_RIGHT) ? right - width : (left + right - width) / 2;
+		int y = (top + bottom - 7) / 2;
+		for (unsigned char c : text)
+		{
+			// UTF-8 continuation bytes are skipped, other characters outside ASCII are drawn as '?'
+			if ((c & 0xC0) == 0x80) continue;
+			if ((c < 32) || (c > 126)) c = '?';
+			const unsigned char* glyph = Glyph(c);
+			for (int row = 0; row < 7; ++row)
+			{
+				for (int column = 0; column < 5; ++column)
+				{
+					if (glyph[row] & (0x10 >> column)) Set(x + column, y + row, color);
+				}
+			}
+			x += 6;
+		}
+	}
+
+	virtual int TextWidth(const std::string& text) const
+	{
+		int count = 0;
+		for (unsigned char c : text)
+		{
+			if ((c & 0xC0) != 0x80) ++count;
+		}
+		return count ? count * 6 - 1 : 0;
+	}
+
+	virtual int TextHeight() const { return 11; }
+
+	// PNG: 8-bit RGB without filters, compressed with fixed Huffman codes and matches with the
+	// previous pixel and the previous row, which is all a graph of lines needs
+	bool WritePng(FILE* out) const
+	{
+		size_t stride = size_t(m_width) * 3 + 1;
+		std::vector<unsigned char> raw(stride * m_height, 0);
+		for (int y = 0; y < m_height; ++y)
+		{
+			if (m_width) memcpy(&raw[y * stride + 1], &m_pixels[size_t(y) * m_width * 3], stride - 1);
+		}
+		std::vector<unsigned char> png(8);
+		memcpy(&png[0], "\x89PNG\r\n\x1A\n", 8);
+		unsigned char header[13] = { 0 };
+		Put32(header, m_width);
+		Put32(header + 4, m_height);
+		header[8] = 8; // bits
+		header[9] = 2; // RGB
+		Chunk(png, "IHDR", header, sizeof(header));
+		std::vector<unsigned char> z;
+		Deflate(raw, stride, z);
+		Chunk(png, "IDAT", z.data(), z.size());
+		Chunk(png, "IEND", NULL, 0);
+		return fwrite(png.data(), 1, png.size(), out) == png.size();
+	}
+
+	int m_width;
+	int m_height;
+	std::vector<unsigned char> m_pixels; // RGB, top row first
+
+private:
+	void Set(int x, int y, uint32_t color)
+	{
+		if ((x < 0) || (y < 0) || (x >= m_width) || (y >= m_height)) return;
+		unsigned char* p = &m_pixels[(size_t(y) * m_width + x) * 3];
+		p[0] = (unsigned char)(color >> 16);
+		p[1] = (unsigned char)(color >> 8);
+		p[2] = (unsigned char)color;
+	}
+
+	static const unsigned char* Glyph(unsigned char c)
+	{
+		// rows of 5 pixels, the left pixel in bit 4
+		static const unsigned char font[95][7] =
+		{
+			{ 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 }, // space
+			{ 0x04, 0x04, 0x04, 0x04, 0x04, 0x00, 0x04 }, // !
+			{ 0x0A, 0x0A, 0x0A, 0x00, 0x00, 0x00, 0x00 }, // "
+			{ 0x0A, 0x0A, 0x1F, 0x0A, 0x1F, 0x0A, 0x0A }, // #
+			{ 0x04, 0x0F, 0x14, 0x0E, 0x05, 0x1E, 0x04 }, // $
+			{ 0x18, 0x19, 0x02, 0x04, 0x08, 0x13, 0x03 }, // %
+			{ 0x0C, 0x12, 0x14, 0x08, 0x15, 0x12, 0x0D }, // &
+			{ 0x04, 0x04, 0x08, 0x00, 0x00, 0x00, 0x00 }, // '
+			{ 0x02, 0x04, 0x08, 0x08, 0x08, 0x04, 0x02 }, // (
+			{ 0x08, 0x04, 0x02, 0x02, 0x02, 0x04, 0x08 }, // )
+			{ 0x00, 0x04, 0x15, 0x0E, 0x15, 0x04, 0x00 }, // *
+			{ 0x00, 0x04, 0x04, 0x1F, 0x04, 0x04, 0x00 }, // +
+			{ 0x00, 0x00, 0x00, 0x00, 0x0C, 0x04, 0x08 }, // ,
+			{ 0x00, 0x00, 0x00, 0x1F, 0x00, 0x00, 0x00 }, // -
+			{ 0x00, 0x00, 0x00, 0x00, 0x00, 0x0C, 0x0C }, // .
+			{ 0x00, 0x01, 0x02, 0x04, 0x08, 0x10, 0x00 }, // /
+			{ 0x0E, 0x11, 0x13, 0x15, 0x19, 0x11, 0x0E }, // 0
+			{ 0x04, 0x0C, 0x04, 0x04, 0x04, 0x04, 0x0E }, // 1
+			{ 0x0E, 0x11, 0x01, 0x02, 0x04, 0x08, 0x1F }, // 2
+			{ 0x1F, 0x02, 0x04, 0x02, 0x01, 0x11, 0x0E }, // 3
+			{ 0x02, 0x06, 0x0A, 0x12, 0x1F, 0x02, 0x02 }, // 4
+			{ 0x1F, 0x10, 0x1E, 0x01, 0x01, 0x11, 0x0E }, // 5
+			{ 0x06, 0x08, 0x10, 0x1E, 0x11, 0x11, 0x0E }, // 6
+			{ 0x1F, 0x01, 0x02, 0x04, 0x08, 0x08, 0x08 }, // 7
+			{ 0x0E, 0x11, 0x11, 0x0E, 0x11, 0x11, 0x0E }, // 8
+			{ 0x0E, 0x11, 0x11, 0x0F, 0x01, 0x02, 0x0C }, // 9
+			{ 0x00, 0x0C, 0x0C, 0x00, 0x0C, 0x0C, 0x00 }, // :
+			{ 0x00, 0x0C, 0x0C, 0x00, 0x0C, 0x04, 0x08 }, // ;
+			{ 0x02, 0x04, 0x08, 0x10, 0x08, 0x04, 0x02 }, // <
+			{ 0x00, 0x00, 0x1F, 0x00, 0x1F, 0x00, 0x00 }, // =
+			{ 0x08, 0x04, 0x02, 0x01, 0x02, 0x04, 0x08 }, // >
+			{ 0x0E, 0x11, 0x01, 0x02, 0x04, 0x00, 0x04 }, // ?
+			{ 0x0E, 0x11, 0x01, 0x0D, 0x15, 0x15, 0x0E }, // @
+			{ 0x0E, 0x11, 0x11, 0x1F, 0x11, 0x11, 0x11 }, // A
+			{ 0x1E, 0x11, 0x11, 0x1E, 0x11, 0x11, 0x1E }, // B
+			{ 0x0E, 0x11, 0x10, 0x10, 0x10, 0x11, 0x0E }, // C
+			{ 0x1C, 0x12, 0x11, 0x11, 0x11, 0x12, 0x1C }, // D
+			{ 0x1F, 0x10, 0x10, 0x1E, 0x10, 0x10, 0x1F }, // E
+			{ 0x1F, 0x10, 0x10, 0x1E, 0x10, 0x10, 0x10 }, // F
+			{ 0x0E, 0x11, 0x10, 0x17, 0x11, 0x11, 0x0F }, // G
+			{ 0x11, 0x11, 0x11, 0x1F, 0x11, 0x11, 0x11 }, // H
+			{ 0x0E, 0x04, 0x04, 0x04, 0x04, 0x04, 0x0E }, // I
+			{ 0x07, 0x02, 0x02, 0x02, 0x02, 0x12, 0x0C }, // J
+			{ 0x11, 0x12, 0x14, 0x18, 0x14, 0x12, 0x11 }, // K
+			{ 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x1F }, // L
+			{ 0x11, 0x1B, 0x15, 0x15, 0x11, 0x11, 0x11 }, // M
+			{ 0x11, 0x11, 0x19, 0x15, 0x13, 0x11, 0x11 }, // N
+			{ 0x0E, 0x11, 0x11, 0x11, 0x11, 0x11, 0x0E }, // O
+			{ 0x1E, 0x11, 0x11, 0x1E, 0x10, 0x10, 0x10 }, // P
+			{ 0x0E, 0x11, 0x11, 0x11, 0x15, 0x12, 0x0D }, // Q
+			{ 0x1E, 0x11, 0x11, 0x1E, 0x14, 0x12, 0x11 }, // R
+			{ 0x0F, 0x10, 0x10, 0x0E, 0x01, 0x01, 0x1E }, // S
+			{ 0x1F, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04 }, // T
+			{ 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x0E }, // U
+			{ 0x11, 0x11, 0x11, 0x11, 0x11, 0x0A, 0x04 }, // V
+			{ 0x11, 0x11, 0x11, 0x15, 0x15, 0x15, 0x0A }, // W
+			{ 0x11, 0x11, 0x0A, 0x04, 0x0A, 0x11, 0x11 }, // X
+			{ 0x11, 0x11, 0x11, 0x0A, 0x04, 0x04, 0x04 }, // Y
+			{ 0x1F, 0x01, 0x02, 0x04, 0x08, 0x10, 0x1F }, // Z
+			{ 0x0E, 0x08, 0x08, 0x08, 0x08, 0x08, 0x0E }, // [
+			{ 0x00, 0x10, 0x08, 0x04, 0x02, 0x01, 0x00 }, // backslash
+			{ 0x0E, 0x02, 0x02, 0x02, 0x02, 0x02, 0x0E }, // ]
+			{ 0x04, 0x0A, 0x11, 0x00, 0x00, 0x00, 0x00 }, // ^
+			{ 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x1F }, // _
+			{ 0x08, 0x04, 0x02, 0x00, 0x00, 0x00, 0x00 }, // `
+			{ 0x00, 0x00, 0x0E, 0x01, 0x0F, 0x11, 0x0F }, // a
+			{ 0x10, 0x10, 0x16, 0x19, 0x11, 0x11, 0x1E }, // b
+			{ 0x00, 0x00, 0x0E, 0x10, 0x10, 0x11, 0x0E }, // c
+			{ 0x01, 0x01, 0x0D, 0x13, 0x11, 0x11, 0x0F }, // d
+			{ 0x00, 0x00, 0x0E, 0x11, 0x1F, 0x10, 0x0E }, // e
+			{ 0x06, 0x09, 0x08, 0x1C, 0x08, 0x08, 0x08 }, // f
+			{ 0x00, 0x0F, 0x11, 0x11, 0x0F, 0x01, 0x0E }, // g
+			{ 0x10, 0x10, 0x16, 0x19, 0x11, 0x11, 0x11 }, // h
+			{ 0x04, 0x00, 0x0C, 0x04, 0x04, 0x04, 0x0E }, // i
+			{ 0x02, 0x00, 0x06, 0x02, 0x02, 0x12, 0x0C }, // j
+			{ 0x10, 0x10, 0x12, 0x14, 0x18, 0x14, 0x12 }, // k
+			{ 0x0C, 0x04, 0x04, 0x04, 0x04, 0x04, 0x0E }, // l
+			{ 0x00, 0x00, 0x1A, 0x15, 0x15, 0x11, 0x11 }, // m
+			{ 0x00, 0x00, 0x16, 0x19, 0x11, 0x11, 0x11 }, // n
+			{ 0x00, 0x00, 0x0E, 0x11, 0x11, 0x11, 0x0E }, // o
+			{ 0x00, 0x00, 0x1E, 0x11, 0x1E, 0x10, 0x10 }, // p
+			{ 0x00, 0x00, 0x0D, 0x13, 0x0F, 0x01, 0x01 }, // q
+			{ 0x00, 0x00, 0x16, 0x19, 0x10, 0x10, 0x10 }, // r
+			{ 0x00, 0x00, 0x0E, 0x10, 0x0E, 0x01, 0x1E }, // s
+			{ 0x08, 0x08, 0x1C, 0x08, 0x08, 0x09, 0x06 }, // t
+			{ 0x00, 0x00, 0x11, 0x11, 0x11, 0x13, 0x0D }, // u
+			{ 0x00, 0x00, 0x11, 0x11, 0x11, 0x0A, 0x04 }, // v
+			{ 0x00, 0x00, 0x11, 0x11, 0x15, 0x15, 0x0A }, // w
+			{ 0x00, 0x00, 0x11, 0x0A, 0x04, 0x0A, 0x11 }, // x
+			{ 0x00, 0x00, 0x11, 0x11, 0x0F, 0x01, 0x0E }, // y
+			{ 0x00, 0x00, 0x1F, 0x02, 0x04, 0x08, 0x1F }, // z
+			{ 0x02, 0x04, 0x04, 0x08, 0x04, 0x04, 0x02 }, // {
+			{ 0x04, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04 }, // |
+			{ 0x08, 0x04, 0x04, 0x02, 0x04, 0x04, 0x08 }, // }
+			{ 0x00, 0x00, 0x08, 0x15, 0x02, 0x00, 0x00 }, // ~
+		};
+		return font[c - 32];
+	}
+
+	static void Put32(unsigned char* p, uint32_t value)
+	{
+		p[0] = (unsigned char)(value >> 24);
+		p[1] = (unsigned char)(value >> 16);
+		p[2] = (unsigned char)(value >> 8);
+		p[3] = (unsigned char)value;
+	}
+
+	static void Chunk(std::vector<unsigned char>& png, const char* type, const unsigned char* data, size_t size)
+	{
+		static uint32_t table[256];
+		if (!table[1])
+		{
+			for (uint32_t n = 0; n < 256; ++n)
+			{
+				uint32_t c = n;
+				for (int k = 0; k < 8; ++k) c = (c & 1) ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+				table[n] = c;
+			}
+		}
+		size_t start = png.size();
+		png.resize(start + 12 + size);
+		Put32(&png[start], (uint32_t)size);
+		memcpy(&png[start + 4], type, 4);
+		if (size) memcpy(&png[start + 8], data, size);
+		uint32_t crc = 0xFFFFFFFF;
+		for (size_t i = start + 4; i < start + 8 + size; ++i) crc = table[(crc ^ png[i]) & 0xFF] ^ (crc >> 8);
+		Put32(&png[start + 8 + size], crc ^ 0xFFFFFFFF);
+	}
+
+	// deflate bits are written from the least significant bit, Huffman codes from their most significant bit
+	struct bits
+	{
+		std::vector<unsigned char>& out;
+		uint32_t value;
+		int      count;
+
+		void put(uint32_t v, int n)
+		{
+			value |= v << count;
+			count += n;
+			while (count >= 8)
+			{
+				out.push_back((unsigned char)value);
+				value >>= 8;
+				count -= 8;
+			}
+		}
+
+		void code(uint32_t c, int n)
+		{
+			uint32_t reversed = 0;
+			for (int i = 0; i < n; ++i) reversed |= ((c >> i) & 1) << (n - 1 - i);
+			put(reversed, n);
+		}
+
+		void symbol(unsigned s)
+		{
+			if (s < 144) code(0x30 + s, 8);
+			else if (s < 256) code(0x190 + s - 144, 9);
+			else if (s < 280) code(s - 256, 7);
+			else code(0xC0 + s - 280, 8);
+		}
+	};
+
+	static void Deflate(const std::vector<unsigned char>& raw, size_t stride, std::vector<unsigned char>& z)
+	{
+		static const unsigned short lengthBase[29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+		static const unsigned char lengthExtra[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+		static const unsigned short distanceBase[30] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+		static const unsigned char distanceExtra[30] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+		z.push_back(0x78);
+		z.push_back(0x01);
+		bits out = { z, 0, 0 };
+		out.put(1, 1); // the last block
+		out.put(1, 2); // fixed Huffman codes
+		size_t distances[2] = { 3, stride <= 32768 ? stride : 3 };
+		size_t size = raw.size();
+		for (size_t i = 0; i < size; )
+		{
+			size_t length = 0;
+			size_t distance = 0;
+			for (size_t d : distances)
+			{
+				if (i < d) continue;
+				size_t n = 0;
+				while ((n < 258) && (i + n < size) && (raw[i + n] == raw[i + n - d])) ++n;
+				if (n > length)
+				{
+					length = n;
+					distance = d;
+				}
+			}
+			if (length < 3)
+			{
+				out.symbol(raw[i++]);
+				continue;
+			}
+			int l = 28;
+			while (lengthBase[l] > length) --l;
+			out.symbol(257 + l);
+			out.put(unsigned(length - lengthBase[l]), lengthExtra[l]);
+			int d = 29;
+			while (distanceBase[d] > distance) --d;
+			out.code(d, 5);
+			out.put(unsigned(distance - distanceBase[d]), distanceExtra[d]);
+			i += length;
+		}
+		out.symbol(256);
+		if (out.count) out.put(0, 8 - out.count);
+		uint32_t a = 1;
+		uint32_t b = 0;
+		for (size_t i = 0; i < size; ++i)
+		{
+			a = (a + raw[i]) % 65521;
+			b = (b + a) % 65521;
+		}
+		unsigned char adler[4];
+		Put32(adler, (b << 16) | a);
+		z.insert(z.end(), adler, adler + 4);
+	}
+};
+
+// the layout of NkDigTimerGraph::OnSize and the drawing of OnPaintImpl, PaintLod and Trace
+class nkbefRender
+{
+public:
+	struct lane
+	{
+		std::string label;
+		int  top;
+		int  bottom;
+		bool adc;
+		// the pen: the trace is drawn up to column x, where it spans ymin to ymax and ends at y
+		bool pen;
+		int  x;
+		int  y;
+		int  ymin;
+		int  ymax;
+	};
+
+	nkbefRender()
+	: m_width(0)
+	, m_height(0)
+	, m_left(0)
+	, m_top(0)
+	, m_right(0)
+	, m_bottom(0)
+	, m_adcScale(1)
+	, m_first(0)
+	, m_last(0)
+	, m_hscale(0.)
+	, m_canvas(NULL)
+	{}
+
+	// draws the samples from first up to last (timestamps) of file on canvas.
+	// a height of 0 fits the lanes.
+	void Draw(const nkbefFile& file, uint64_t first, uint64_t last, int width, int height, nkbefCanvas& canvas)
+	{
+		m_canvas = &canvas;
+		m_first = first;
+		m_last = last > first ? last : first + 1;
+		m_adcScale = (1 << file.m_bits) / 256;
+		if (m_adcScale < 1) m_adcScale = 1;
+		Layout(file, width, height);
+		m_hscale = double(m_right - m_left) / double(m_last - m_first);
+		canvas.Begin(m_width, m_height);
+		canvas.Fill(0, 0, m_width, m_height, NKBEF_WHITE);
+		DrawGrid();
+		DrawTimeAxis();
+		if (!DrawLod(file)) DrawSamples(file);
+	}
+
+	int m_width;
+	int m_height;
+	int m_left;   // the graph area
+	int m_top;
+	int m_right;
+	int m_bottom;
+	std::vector<lane> m_lanes; // per pin
+
+private:
+	void Layout(const nkbefFile& file, int width, int height)
+	{
+		int textWidth = m_canvas->TextWidth("24:00:00.000");
+		int textHeight = m_canvas->TextHeight();
+		size_t adcCount = 0;
+		m_lanes.resize(file.m_pins.size());
+		for (size_t i = 0; i < m_lanes.size(); ++i)
+		{
+			m_lanes[i].label = file.m_pins[i].name;
+			m_lanes[i].adc = file.m_pins[i].type == NKBEF_ADC_PIN;
+			if (m_lanes[i].adc) ++adcCount;
+		}
+		if (height <= 0) height = int(m_lanes.size()) * 30 + int(adcCount) * 90 + textHeight * 3 + 10;
+		m_width = width;
+		m_height = height;
+		m_left = (textWidth * 3) / 2 + 10;
+		m_right = m_width - textHeight;
+		m_top = 0;
+		m_bottom = m_height - (textHeight * 3 + 10);
+		if (m_lanes.size())
+		{
+			int areaHeight = m_bottom - m_top;
+			int lineHeight = areaHeight / int(m_lanes.size());
+			if (lineHeight < 20) lineHeight = 20;
+			if (lineHeight > 50) lineHeight = 50;
+			int adcHeight = lineHeight;
+			int extra = areaHeight - int(m_lanes.size()) * lineHeight;
+			if ((extra > 0) && adcCount)
+			{
+				adcHeight += extra / int(adcCount);
+				if (adcHeight > 256 + 8) adcHeight = 256 + 8;
+			}
+			int pos = m_top;
+			for (auto& l : m_lanes)
+			{
+				l.top = pos;
+				pos += l.adc ? adcHeight : lineHeight;
+				l.bottom = pos;
+				l.pen = false;
+			}
+			m_bottom = pos;
+		}
+	}
+
+	void DrawGrid()
+	{
+		double xstep = (m_right - m_left) / 10.;
+		for (int i = 0; i <= 10; ++i)
+		{
+			int x = int(m_left + i * xstep + 0.5);
+			m_canvas->Line(x, m_top, x, m_bottom, NKBEF_LIGHT_GREY);
+		}
+		for (auto& l : m_lanes)
+		{
+			m_canvas->Line(m_left, l.top, m_right, l.top, NKBEF_LIGHT_GREY);
+		}
+		for (auto& l : m_lanes)
+		{
+			m_canvas->Text(10, m_left - 10, l.top, l.bottom, l.label, nkbefCanvas::ALIGN_RIGHT, NKBEF_BLACK);
+		}
+	}
+
+	void DrawTimeAxis()
+	{
+		int textWidth = m_canvas->TextWidth("24:00:00.000");
+		int textHeight = m_canvas->TextHeight();
+		uint64_t microseconds = (m_last - m_first) / 10;
+		if (microseconds)
+		{
+			// as the scope window, but at least the width of a label apart
+			int spacing = m_canvas->TextWidth("000000") + textHeight / 2;
+			if (spacing < textHeight * 2) spacing = textHeight * 2;
+			int maxLabels = (m_right - m_left) / spacing;
+			if (maxLabels <= 2) maxLabels = 2;
+			uint64_t step = nkbefTimeStep(microseconds / maxLabels);
+			double hscale = double(m_right - m_left) / double(microseconds);
+			int top = m_bottom + 10;
+			for (uint64_t t = 0; t <= microseconds; t += step)
+			{
+				int x = int(m_left + double(t) * hscale + 0.5);
+				m_canvas->Line(x, m_bottom, x, m_bottom + 10, NKBEF_BLACK);
+				m_canvas->Text(x - textWidth, x + textWidth, top, top + textHeight, nkbefTimeLabel(t, step), nkbefCanvas::ALIGN_CENTER, NKBEF_BLACK);
+			}
+			top += textHeight + 10;
+			m_canvas->Text(m_left, m_right, top, top + textHeight, nkbefTimeCaption(step), nkbefCanvas::ALIGN_CENTER, NKBEF_BLACK);
+			nkbefLocalTime localTime;
+			std::string first;
+			std::string last;
+			localTime.Append(first, m_first);
+			localTime.Append(last, m_last);
+			m_canvas->Text(m_left, m_right, top, top + textHeight, first, nkbefCanvas::ALIGN_LEFT, NKBEF_BLACK);
+			m_canvas->Text(m_left, m_right, top, top + textHeight, last, nkbefCanvas::ALIGN_RIGHT, NKBEF_BLACK);
+		}
+		m_canvas->Line(m_left, m_bottom, m_right, m_bottom, NKBEF_BLACK);
+	}
+
+	int X(uint64_t t) const
+	{
+		if (t <= m_first) return m_left;
+		if (t >= m_last) return m_right;
+		return m_left + int(double(t - m_first) * m_hscale);
+	}
+
+	int Y(const lane& l, unsigned value) const
+	{
+		if (l.adc)
+		{
+			int pos = int(((value / m_adcScale) * (l.bottom - l.top - 8)) / 256);
+			return l.bottom - 4 - pos;
+		}
+		return value ? l.top + 4 : l.bottom - 4;
+	}
+
+	// the trace of lane l is at y from column x
+	void Step(lane& l, int x, int y)
+	{
+		if (!l.pen)
+		{
+			l.pen = true;
+			l.x = x;
+			l.y = l.ymin = l.ymax = y;
+			return;
+		}
+		if (x > l.x)
+		{
+			if (l.ymin < l.ymax) m_canvas->Line(l.x, l.ymin, l.x, l.ymax, NKBEF_BLUE);
+			if (l.adc)
+			{
+				m_canvas->Line(l.x, l.y, x, y, NKBEF_BLUE);
+				l.ymin = l.ymax = y;
+			}
+			else
+			{
+				m_canvas->Line(l.x, l.y, x, l.y, NKBEF_BLUE);
+				l.ymin = l.ymax = l.y;
+			}
+			l.x = x;
+		}
+		if (y < l.ymin) l.ymin = y;
+		if (y > l.ymax) l.ymax = y;
+		l.y = y;
+	}
+
+	void Finish(lane& l, int x)
+	{
+		if (!l.pen) return;
+		Step(l, x, l.y);
+		if (l.ymin < l.ymax) m_canvas->Line(l.x, l.ymin, l.x, l.ymax, NKBEF_BLUE);
+		l.pen = false;
+	}
+
+	// the order of the pyramid: level, channel, bucket
+	static bool LodBefore(const nkbefLodEntry& e, const nkbefLodEntry& key)
+	{
+		if (e.level != key.level) return e.level < key.level;
+		if (e.channel != key.channel) return e.channel < key.channel;
+		return e.bucket < key.bucket;
+	}
+
+	// as NkDigTimerGraph::PaintLod: the buckets of the level of which a pixel spans at least one
+	bool DrawLod(const nkbefFile& file)
+	{
+		const std::vector<nkbefLodEntry>& lod = file.m_lod;
+		if (lod.empty() || (m_right <= m_left)) return false;
+		double units = 1. / m_hscale; // timestamp units per pixel
+		if (units < double(1ULL << file.m_lodShift)) return false;
+		unsigned level = 0;
+		while ((level < lod.back().level) && (double(1ULL << (file.m_lodShift + level + 1)) <= units)) ++level;
+		// the lowest levels of a long recording are not stored, see scopeLod
+		if (level < lod.front().level) return false;
+		unsigned shift = file.m_lodShift + level;
+		uint64_t last = file.m_lodLast < m_last ? file.m_lodLast : m_last;
+		for (size_t c = 0; c < m_lanes.size(); ++c)
+		{
+			lane& l = m_lanes[c];
+			nkbefLodEntry key = { 0, 0, 0, 0, 0, 0, (uint8_t)c, (uint8_t)level };
+			std::vector<nkbefLodEntry>::const_iterator begin = std::lower_bound(lod.begin(), lod.end(), key, LodBefore);
+			key.bucket = ~0ULL;
+			std::vector<nkbefLodEntry>::const_iterator end = std::upper_bound(begin, lod.end(), key, LodBefore);
+			if (begin == end) continue;
+			key.bucket = m_first >> shift;
+			std::vector<nkbefLodEntry>::const_iterator e = std::lower_bound(begin, end, key, LodBefore);
+			unsigned value = (e != begin) ? (e - 1)->last : e->before;
+			int x = ((e == begin) && ((e->bucket << shift) > m_first)) ? X(e->bucket << shift) : m_left;
+			Step(l, x, Y(l, value));
+			for (; (e != end) && ((e->bucket << shift) < m_last); ++e)
+			{
+				x = X(e->bucket << shift);
+				Step(l, x, Y(l, value));
+				if (e->edges)
+				{
+					Step(l, x, Y(l, e->min));
+					Step(l, x, Y(l, e->max));
+				}
+				value = e->last;
+				Step(l, x, Y(l, value));
+			}
+			Finish(l, X(last));
+		}
+		return true;
+	}
+
+	// the state of the lanes at the start of the bucket of the lowest stored level that holds first:
+	// returns that start, or 0 when the pyramid does not reach first
+	uint64_t LodState(const nkbefFile& file, std::vector<long>& value) const
+	{
+		const std::vector<nkbefLodEntry>& lod = file.m_lod;
+		if (lod.empty() || (m_first > file.m_lodLast)) return 0;
+		unsigned level = lod.front().level;
+		unsigned shift = file.m_lodShift + level;
+		uint64_t bucket = m_first >> shift;
+		for (size_t c = 0; c < value.size(); ++c)
+		{
+			// the last bucket of the channel up to the bucket of first
+			nkbefLodEntry key = { bucket, 0, 0, 0, 0, 0, (uint8_t)c, (uint8_t)level };
+			std::vector<nkbefLodEntry>::const_iterator e = std::upper_bound(lod.begin(), lod.end(), key, LodBefore);
+			if (e == lod.begin()) continue;
+			--e;
+			if ((e->level != level) || (e->channel != c)) continue;
+			value[c] = (e->bucket == bucket) ? e->before : e->last;
+		}
+		return bucket << shift;
+	}
+
+	// as NkDigTimerGraph::Rewind and Trace: the state of the lanes at first, then the samples
+	void DrawSamples(const nkbefFile& file)
+	{
+		size_t count = file.Count();
+		size_t start = file.Find(m_first);
+		std::vector<long> value(m_lanes.size(), -1);
+		// the samples before the bucket of first are summarized by the pyramid, without it the scan is limited
+		std::vector<long> lod(m_lanes.size(), -1);
+		uint64_t bound = LodState(file, lod);
+		size_t stop = (bound || (start < NKBEF_STATE_SCAN)) ? 0 : start - NKBEF_STATE_SCAN;
+		size_t unknown = value.size();
+		nkbefSample s;
+		for (size_t i = start; unknown && (i-- > stop); )
+		{
+			file.Get(i, s);
+			if (s.timestamp + NKBEF_DISORDER < bound) break;
+			size_t c = (unsigned char)(s.channel < 0 ? ~s.channel : s.channel);
+			if ((c < value.size()) && (value[c] < 0))
+			{
+				value[c] = s.state;
+				--unknown;
+			}
+		}
+		for (size_t c = 0; c < value.size(); ++c)
+		{
+			if (value[c] < 0) value[c] = lod[c];
+		}
+		// the samples up to first are sorted within NKBEF_DISORDER
+		size_t i = start;
+		for (; i < count; ++i)
+		{
+			file.Get(i, s);
+			if (s.timestamp >= m_first) break;
+			size_t c = (unsigned char)(s.channel < 0 ? ~s.channel : s.channel);
+			if ((c < value.size()) && ((s.channel >= 0) || (value[c] < 0))) value[c] = s.state;
+		}
+		for (size_t c = 0; c < m_lanes.size(); ++c)
+		{
+			if (value[c] >= 0) Step(m_lanes[c], m_left, Y(m_lanes[c], value[c]));
+		}
+		uint64_t current = m_first;
+		for (; i < count; ++i)
+		{
+			file.Get(i, s);
+			if (s.timestamp > current) current = s.timestamp;
+			if (s.timestamp >= m_last)
+			{
+				if (s.timestamp >= m_last + NKBEF_DISORDER) break;
+				continue;
+			}
+			bool tick = s.channel < 0;
+			size_t c = (unsigned char)(tick ? ~s.channel : s.channel);
+			if (c >= m_lanes.size()) continue;
+			// tick events only provide the initial state of a channel
+			if (tick && (value[c] >= 0)) continue;
+			value[c] = s.state;
+			Step(m_lanes[c], X(s.timestamp), Y(m_lanes[c], s.state));
+		}
+		for (auto& l : m_lanes)
+		{
+			Finish(l, X(current));
+		}
+	}
+
+	long    m_adcScale;
+	uint64_t m_first;
+	uint64_t m_last;
+	double  m_hscale; // pixels per timestamp unit
+	nkbefCanvas* m_canvas;
+};